@@ -47,8 +47,8 @@ _start:
     mov esi, ebx
     call setup_page_tables
     call enable_paging
-    mov [magic64], eax
-    mov [addr64], ebx
+    mov [magic64], edi           ;eax is clobbered by enable_paging
+    mov [addr64], esi
     lea eax, [tmp_gdt_ptr]
     lgdt [eax]
     jmp 0x08:long_mode_start
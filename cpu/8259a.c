@@ -13,6 +13,8 @@
 #define ICW4_BUF_MASTER 0x0C
 #define ICW4_SFNM   0x10
 
+#define OCW3_READ_ISR 0x0B
+
 void pic_remap(int offset1, int offset2)
 {
     //save masks
@@ -57,4 +59,12 @@ void pic_clear_mask(uint8_t irq_line)
     uint16_t port = (irq_line < 8) ? PIC1_DATA : PIC2_DATA;
     uint8_t value = inb(port) & ~(1 << (irq_line & 7));
     outb(port, value);
-} 
\ No newline at end of file
+}
+
+// in-service registers of both chips: slave in the high byte
+uint16_t pic_get_isr(void)
+{
+    outb(PIC1_COMMAND, OCW3_READ_ISR);
+    outb(PIC2_COMMAND, OCW3_READ_ISR);
+    return ((uint16_t)inb(PIC2_COMMAND) << 8) | inb(PIC1_COMMAND);
+}
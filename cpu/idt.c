@@ -7,6 +7,12 @@
 #include <vga.h>
 #include <debug.h>
 #include <string.h>
+#include <irqstat.h>
+#include <thread.h>
+#include <latency.h>
+#include <irq.h>
+#include <preempt.h>
+#include <lapic.h>
 
 #define IDT_SIZE 256
 
@@ -28,30 +34,64 @@ static void idt_set_gate(uint8_t vector, uint64_t handler, uint8_t flags)
     idt[vector].zero        = 0;
 }
 
+// IRQ7/IRQ15 with no ISR bit set are PIC spurious interrupts: no EOI for them
+static int isr_is_spurious(uint8_t vec)
+{
+    if (vec != 39 && vec != 47) return 0;
+    if (pic_get_isr() & (1 << (vec - 32))) return 0;
+    if (vec == 47) pic_send_eoi(2); // master still saw the cascade line
+    return 1;
+}
+
 void isr_dispatch(cpu_registers_t* regs)
 {
     uint8_t vec = (uint8_t)regs->int_no;
-    switch (vec) {
-        case 46:
-            kprintf("Page fault!\nEIP: %08X\n", regs->rip);
-            break;
-        case 32:
-            //kprintf("Timer interrupt\n"); //это не нужно оно весь экран засирает
-            break;
-        case 33:
-            //kprintf("Keyboard interrupt\n");
-            break;
-        default:
-            kprintf("\nkernel panic: %s\n", exception_messages[vec]);
-            kprintf("RIP: 0x%016X\n", regs->rip);
-            kprintf("kernel halted");
-            for (;;);
+    if (vec < 32 && !interrupt_handlers[vec]) {
+        kprintf("\nkernel panic: %s\n", exception_messages[vec]);
+        kprintf("RIP: 0x%016X\n", regs->rip);
+        kprintf("kernel halted");
+        for (;;);
     }
+    if (isr_is_spurious(vec)) {
+        irqstat_spurious(vec);
+        return;
+    }
+
+    // interrupt gates cleared IF on entry: that is an irqs-off window
+    // until iretq, charged to the code we interrupted
+    int irqs_were_on = (regs->rflags & RFLAGS_IF) != 0;
+    if (irqs_were_on) latency_irqs_off(regs->rip);
+
+    // handlers may switch threads (the timer does); don't bill that time to the irq
+    thread_t* self = thread_current();
+    uint64_t offcpu = self ? self->offcpu_cycles : 0;
+    uint64_t start = rdtsc();
+
     if (interrupt_handlers[vec])
         interrupt_handlers[vec](regs);
+    // nobody on the line claimed it: counted as spurious, not as handled
+    int spurious = irq_has_chain(vec) && !irq_handle_chain(vec, regs);
+    if (spurious)
+        irqstat_spurious(vec);
 
     if (vec >= 32 && vec <= 47)
         pic_send_eoi(vec - 32);
+    else if (irq_vector_is_dynamic(vec))
+        lapic_eoi(); // MSI: edge triggered, no 8259 involved
+
+    uint64_t cycles = rdtsc() - start;
+    if (self) cycles -= self->offcpu_cycles - offcpu;
+    if (!spurious)
+        irqstat_record(vec, cycles);
+
+    // a woken irq thread should not wait for the next timer tick
+    if (irq_need_resched && preempt_count == 0) {
+        irq_need_resched = 0;
+        thread_yield();
+    }
+
+    if (irqs_were_on)
+        latency_irqs_on(interrupt_handlers[vec] ? (uint64_t)interrupt_handlers[vec] : current_rip());
 }
 
 void idt_init(void)
@@ -0,0 +1,202 @@
+#include <irq.h>
+#include <irqflags.h>
+#include <pic.h>
+#include <thread.h>
+#include <heap.h>
+#include <string.h>
+#include <debug.h>
+#include <vga.h>
+
+#define IRQ_VECTORS 256
+
+typedef struct irq_action {
+    irq_handler_t      handler;
+    irq_thread_fn_t    thread_fn;
+    void*              cookie;
+    uint32_t           flags;
+    uint8_t            vector;
+    volatile int       thread_pending;
+    thread_t*          thread;
+    char               name[16];
+    struct irq_action* next;
+} irq_action_t;
+
+static irq_action_t* irq_chains[IRQ_VECTORS];
+static uint64_t vector_used[IRQ_VECTORS / 64];
+volatile int irq_need_resched = 0;
+
+static int irq_is_pic_vector(uint8_t vector)
+{
+    return vector >= 32 && vector < 48;
+}
+
+static irqreturn_t irq_default_primary(cpu_registers_t* regs, void* cookie)
+{
+    (void)regs; (void)cookie;
+    return IRQ_WAKE_THREAD;
+}
+
+static void irq_thread_main(void)
+{
+    irq_action_t* a = thread_current()->arg;
+    for (;;) {
+        local_irq_disable();
+        if (!a->thread_pending) {
+            // an interrupt between here and the yield just makes us READY again
+            thread_current()->state = THREAD_BLOCKED;
+            local_irq_enable();
+            thread_yield();
+            continue;
+        }
+        a->thread_pending = 0;
+        local_irq_enable();
+
+        a->thread_fn(a->cookie);
+
+        if ((a->flags & IRQF_ONESHOT) && irq_is_pic_vector(a->vector))
+            pic_clear_mask(a->vector - 32);
+    }
+}
+
+int irq_request_threaded(uint8_t vector, irq_handler_t handler, irq_thread_fn_t thread_fn,
+                         uint32_t flags, const char* name, void* cookie, int priority)
+{
+    if (!handler && !thread_fn) return -1;
+    if (!handler) {
+        handler = irq_default_primary;
+        flags |= IRQF_ONESHOT; // a level-triggered line would storm otherwise
+    }
+
+    irq_action_t* a = kmalloc(sizeof(irq_action_t));
+    if (!a) return -2;
+    memset(a, 0, sizeof(*a));
+    a->handler   = handler;
+    a->thread_fn = thread_fn;
+    a->cookie    = cookie;
+    a->flags     = flags;
+    a->vector    = vector;
+    strncpy(a->name, name ? name : "irq", sizeof(a->name) - 1);
+
+    uint64_t irqf = local_irq_save();
+    irq_action_t* head = irq_chains[vector];
+    if (head && (!(flags & IRQF_SHARED) || !(head->flags & IRQF_SHARED))) {
+        local_irq_restore(irqf);
+        kdbg(KERR, "irq_request: vector %d busy (%s)\n", vector, head->name);
+        kfree(a);
+        return -3;
+    }
+
+    if (thread_fn) {
+        char tname[32];
+        snprintf(tname, sizeof(tname), "irq/%d-%s", vector, a->name);
+        a->thread = thread_create(irq_thread_main, tname);
+        if (!a->thread) {
+            local_irq_restore(irqf);
+            kfree(a);
+            return -2;
+        }
+        a->thread->arg = a;
+        thread_set_priority(a->thread, priority);
+        a->thread->state = THREAD_BLOCKED;
+    }
+
+    // append so earlier registrants keep being polled first
+    a->next = NULL;
+    if (!head) {
+        irq_chains[vector] = a;
+    } else {
+        while (head->next) head = head->next;
+        head->next = a;
+    }
+
+    if (irq_is_pic_vector(vector)) {
+        uint8_t line = vector - 32;
+        if (line >= 8) pic_clear_mask(2); // cascade
+        pic_clear_mask(line);
+    }
+    local_irq_restore(irqf);
+    return 0;
+}
+
+int irq_request(uint8_t vector, irq_handler_t handler, uint32_t flags,
+                const char* name, void* cookie)
+{
+    return irq_request_threaded(vector, handler, NULL, flags, name, cookie, 0);
+}
+
+void irq_free(uint8_t vector, void* cookie)
+{
+    uint64_t irqf = local_irq_save();
+    irq_action_t** pp = &irq_chains[vector];
+    while (*pp && (*pp)->cookie != cookie) pp = &(*pp)->next;
+    irq_action_t* a = *pp;
+    if (a) *pp = a->next;
+    if (!irq_chains[vector] && irq_is_pic_vector(vector))
+        pic_set_mask(vector - 32);
+    local_irq_restore(irqf);
+
+    if (!a) return;
+    if (a->thread) thread_stop(a->thread->tid);
+    kfree(a);
+}
+
+static int vector_is_used(int v)
+{
+    return (vector_used[v / 64] >> (v % 64)) & 1;
+}
+
+int irq_alloc_vectors(int count, int align)
+{
+    if (count <= 0) return -1;
+    if (align <= 0) align = 1;
+    uint64_t irqf = local_irq_save();
+    for (int first = IRQ_DYN_VECTOR_BASE; first + count - 1 <= IRQ_DYN_VECTOR_END; first += align) {
+        if (first % align) first += align - first % align;
+        int ok = first + count - 1 <= IRQ_DYN_VECTOR_END;
+        for (int v = first; ok && v < first + count; v++)
+            if (vector_is_used(v) || v == 0x80) ok = 0; // 0x80 is the syscall gate
+        if (!ok) continue;
+        for (int v = first; v < first + count; v++)
+            vector_used[v / 64] |= 1ULL << (v % 64);
+        local_irq_restore(irqf);
+        return first;
+    }
+    local_irq_restore(irqf);
+    return -1;
+}
+
+void irq_free_vectors(int first, int count)
+{
+    uint64_t irqf = local_irq_save();
+    for (int v = first; v < first + count && v < IRQ_VECTORS; v++)
+        vector_used[v / 64] &= ~(1ULL << (v % 64));
+    local_irq_restore(irqf);
+}
+
+int irq_vector_is_dynamic(uint8_t vector)
+{
+    return vector >= IRQ_DYN_VECTOR_BASE && vector <= IRQ_DYN_VECTOR_END && vector_is_used(vector);
+}
+
+int irq_has_chain(uint8_t vector)
+{
+    return irq_chains[vector] != NULL;
+}
+
+int irq_handle_chain(uint8_t vector, cpu_registers_t* regs)
+{
+    int handled = 0;
+    for (irq_action_t* a = irq_chains[vector]; a; a = a->next) {
+        irqreturn_t r = a->handler(regs, a->cookie);
+        if (r == IRQ_NONE) continue;
+        handled = 1;
+        if (r == IRQ_WAKE_THREAD && a->thread) {
+            if ((a->flags & IRQF_ONESHOT) && irq_is_pic_vector(vector))
+                pic_set_mask(vector - 32);
+            a->thread_pending = 1;
+            thread_unblock(a->thread->tid);
+            irq_need_resched = 1;
+        }
+    }
+    return handled;
+}
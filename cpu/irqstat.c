@@ -0,0 +1,54 @@
+#include <irqstat.h>
+#include <irqflags.h>
+#include <string.h>
+#include <vga.h>
+
+irqstat_t irq_stats[IRQSTAT_VECTORS];
+
+void irqstat_reset(void)
+{
+    uint64_t flags = local_irq_save();
+    memset(irq_stats, 0, sizeof(irq_stats));
+    local_irq_restore(flags);
+}
+
+static void irqstat_print_vector(int vec)
+{
+    irqstat_t s = irq_stats[vec];
+    kprintf("vector %d (irq %d): %u handled, %u spurious\n", vec, vec >= 32 && vec < 48 ? vec - 32 : -1,
+            (uint32_t)s.count, (uint32_t)s.spurious);
+    if (s.count == 0) return;
+    kprintf("cycles: min %u, avg %u, max %u\n", (uint32_t)s.min_cycles,
+            (uint32_t)(s.total_cycles / s.count), (uint32_t)s.max_cycles);
+
+    uint32_t peak = 0;
+    for (int b = 0; b < IRQSTAT_BUCKETS; b++)
+        if (s.hist[b] > peak) peak = s.hist[b];
+    for (int b = 0; b < IRQSTAT_BUCKETS; b++) {
+        if (!s.hist[b]) continue;
+        kprintf(" >= 2^%02d: %10u ", b, s.hist[b]);
+        int bar = (int)((uint64_t)s.hist[b] * 40 / peak);
+        for (int i = 0; i < bar; i++) kprint((uint8_t*)"#");
+        kprint((uint8_t*)"\n");
+    }
+}
+
+void irqstat_print(int vec)
+{
+    if (vec >= 0 && vec < IRQSTAT_VECTORS) {
+        irqstat_print_vector(vec);
+        return;
+    }
+    kprintf("vec irq      count   spurious   min cyc   avg cyc   max cyc\n");
+    for (int v = 0; v < IRQSTAT_VECTORS; v++) {
+        irqstat_t* s = &irq_stats[v];
+        if (!s->count && !s->spurious) continue;
+        uint32_t avg = s->count ? (uint32_t)(s->total_cycles / s->count) : 0;
+        if (v >= 32 && v < 48)
+            kprintf("%3d %3d %10u %10u %9u %9u %9u\n", v, v - 32, (uint32_t)s->count, (uint32_t)s->spurious,
+                    (uint32_t)s->min_cycles, avg, (uint32_t)s->max_cycles);
+        else
+            kprintf("%3d   - %10u %10u %9u %9u %9u\n", v, (uint32_t)s->count, (uint32_t)s->spurious,
+                    (uint32_t)s->min_cycles, avg, (uint32_t)s->max_cycles);
+    }
+}
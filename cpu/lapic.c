@@ -0,0 +1,85 @@
+#include <lapic.h>
+#include <acpi.h>
+#include <debug.h>
+#include <vga.h>
+
+#define IA32_APIC_BASE_MSR  0x1B
+#define APIC_BASE_ENABLE    (1 << 11)
+
+#define LAPIC_REG_ID        0x020
+#define LAPIC_REG_TPR       0x080
+#define LAPIC_REG_EOI       0x0B0
+#define LAPIC_REG_SVR       0x0F0
+#define LAPIC_REG_LVT_LINT0 0x350
+#define LAPIC_REG_LVT_LINT1 0x360
+
+#define LAPIC_SVR_ENABLE    0x100
+#define LAPIC_DM_NMI        0x400
+#define LAPIC_DM_EXTINT     0x700
+
+static volatile uint32_t* lapic = 0;
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" :: "c" (msr), "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)));
+}
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+// Enables the local APIC so it accepts MSIs. The 8259 keeps working through
+// LINT0 in virtual-wire mode, so legacy irqs are not affected.
+void lapic_init(void)
+{
+    uint64_t base = acpi_get_info()->lapic_address;
+    uint64_t msr = rdmsr(IA32_APIC_BASE_MSR);
+    if (!base) base = msr & 0xFFFFF000;
+    if (!(msr & APIC_BASE_ENABLE)) wrmsr(IA32_APIC_BASE_MSR, msr | APIC_BASE_ENABLE);
+
+    lapic = (volatile uint32_t*)(uintptr_t)base;
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_DM_EXTINT);
+    lapic_write(LAPIC_REG_LVT_LINT1, LAPIC_DM_NMI);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    kdbg(KINFO, "lapic_init: id %d at 0x%08X\n", lapic_id(), (uint32_t)base);
+}
+
+int lapic_enabled(void)
+{
+    return lapic != 0;
+}
+
+uint8_t lapic_id(void)
+{
+    return lapic ? (uint8_t)(lapic_read(LAPIC_REG_ID) >> 24) : 0;
+}
+
+void lapic_eoi(void)
+{
+    if (lapic) lapic_write(LAPIC_REG_EOI, 0);
+}
+
+int lapic_cpu_count(void)
+{
+    int n = acpi_get_info()->cpu_count;
+    return n > 0 ? n : 1;
+}
+
+int lapic_cpu_index(void)
+{
+    const acpi_info_t* info = acpi_get_info();
+    uint8_t id = lapic_id();
+    for (int i = 0; i < info->cpu_count; i++)
+        if (info->cpu_apic_ids[i] == id) return i;
+    return 0;
+}
@@ -41,10 +41,10 @@ void outl(unsigned short port, uint32_t data)
 
 void insw(unsigned short port, void *buf, unsigned int count)
 {
-    __asm__("rep insw" : "+D" (buf), "+c" (count) : "d" (port));
+    __asm__ volatile("rep insw" : "+D" (buf), "+c" (count) : "d" (port) : "memory");
 }
 
 void outsw(unsigned short port, void *buf, unsigned int count)
 {
-    __asm__("rep outsw" : "+D" (buf), "+c" (count) : "d" (port));
+    __asm__ volatile("rep outsw" : "+S" (buf), "+c" (count) : "d" (port) : "memory");
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include <thread.h>
 #include <debug.h>
 #include <pic.h>
+#include <preempt.h>
+#include <irqflags.h>
 
 #define PIC1_CMD  0x20
 #define PIC1_DATA 0x21
@@ -41,7 +43,8 @@ void timer_handler() {
 
 void timer_isr_wrapper(cpu_registers_t* regs) {
     timer_handler();
-    thread_yield();
+    if (preempt_count == 0)
+        thread_yield();
     pic_send_eoi(0);
 } 
 
@@ -50,7 +53,7 @@ void init_timer() {
 }
 
 void enable_interrupts() {
-    __asm__ volatile ("sti");
+    local_irq_enable();
 }
 
 void wait(uint32_t ms) {
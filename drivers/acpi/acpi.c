@@ -0,0 +1,278 @@
+#include <acpi.h>
+#include <multiboot2.h>
+#include <string.h>
+#include <debug.h>
+#include <vga.h>
+#include <stddef.h>
+
+// everything below 4GB is identity mapped by boot.asm
+#define ACPI_MAPPED_LIMIT 0x100000000ULL
+
+static const acpi_sdt_header_t* tables[ACPI_MAX_TABLES];
+static int table_count = 0;
+
+static const acpi_madt_t* madt = NULL;
+static const acpi_hpet_t* hpet = NULL;
+static const acpi_mcfg_t* mcfg = NULL;
+static const acpi_fadt_t* fadt = NULL;
+
+static acpi_info_t info;
+
+static uint8_t acpi_checksum(const void* ptr, uint32_t len)
+{
+    const uint8_t* p = ptr;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) sum += p[i];
+    return sum;
+}
+
+static const acpi_rsdp_t* acpi_check_rsdp(const void* ptr)
+{
+    const acpi_rsdp_t* rsdp = ptr;
+    if (memcmp(rsdp->signature, "RSD PTR ", 8) != 0) return NULL;
+    if (acpi_checksum(rsdp, 20) != 0) return NULL;
+    if (rsdp->revision >= 2 && acpi_checksum(rsdp, rsdp->length) != 0) return NULL;
+    return rsdp;
+}
+
+static const acpi_rsdp_t* acpi_rsdp_from_multiboot(uint32_t magic, uint32_t mbi_addr)
+{
+    if (magic != MULTIBOOT2_BOOTLOADER_MAGIC || mbi_addr == 0) return NULL;
+
+    const multiboot_info_t* mbi = (const multiboot_info_t*)(uintptr_t)mbi_addr;
+    const uint8_t* p   = (const uint8_t*)mbi + sizeof(multiboot_info_t);
+    const uint8_t* end = (const uint8_t*)mbi + mbi->total_size;
+    const acpi_rsdp_t* found = NULL;
+
+    while (p + sizeof(multiboot_tag_t) <= end) {
+        const multiboot_tag_t* tag = (const multiboot_tag_t*)p;
+        if (tag->type == MULTIBOOT_TAG_TYPE_END) break;
+        if (tag->type == MULTIBOOT_TAG_TYPE_ACPI_NEW) {
+            // the XSDT-capable copy always wins
+            const acpi_rsdp_t* r = acpi_check_rsdp(((const multiboot_tag_acpi_t*)tag)->rsdp);
+            if (r) return r;
+        } else if (tag->type == MULTIBOOT_TAG_TYPE_ACPI_OLD && !found) {
+            found = acpi_check_rsdp(((const multiboot_tag_acpi_t*)tag)->rsdp);
+        }
+        p += (tag->size + 7) & ~7u;
+    }
+    return found;
+}
+
+static const acpi_rsdp_t* acpi_scan_range(uintptr_t start, uintptr_t end)
+{
+    for (uintptr_t p = start; p + sizeof(acpi_rsdp_t) <= end; p += 16) {
+        const acpi_rsdp_t* r = acpi_check_rsdp((const void*)p);
+        if (r) return r;
+    }
+    return NULL;
+}
+
+// legacy BIOS: first KB of the EBDA, then the 0xE0000-0xFFFFF ROM area
+static const acpi_rsdp_t* acpi_rsdp_from_bios(void)
+{
+    uintptr_t ebda = (uintptr_t)(*(volatile uint16_t*)0x40E) << 4;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        const acpi_rsdp_t* r = acpi_scan_range(ebda, ebda + 1024);
+        if (r) return r;
+    }
+    return acpi_scan_range(0xE0000, 0x100000);
+}
+
+static void acpi_add_table(uint64_t phys)
+{
+    if (phys == 0 || phys >= ACPI_MAPPED_LIMIT) {
+        kdbg(KWARN, "acpi: table at 0x%llx is not mapped, skipped\n", phys);
+        return;
+    }
+    const acpi_sdt_header_t* h = (const acpi_sdt_header_t*)(uintptr_t)phys;
+    if (acpi_checksum(h, h->length) != 0) {
+        kdbg(KWARN, "acpi: bad checksum in %c%c%c%c\n",
+             h->signature[0], h->signature[1], h->signature[2], h->signature[3]);
+        return;
+    }
+    if (table_count < ACPI_MAX_TABLES)
+        tables[table_count++] = h;
+}
+
+static void acpi_parse_madt(void)
+{
+    info.lapic_address = madt->lapic_address;
+    info.pcat_compat   = (madt->flags & ACPI_MADT_PCAT_COMPAT) != 0;
+
+    const uint8_t* p   = madt->entries;
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (p + sizeof(acpi_madt_entry_t) <= end) {
+        const acpi_madt_entry_t* e = (const acpi_madt_entry_t*)p;
+        if (e->length < sizeof(acpi_madt_entry_t)) break;
+        switch (e->type) {
+            case ACPI_MADT_LAPIC: {
+                const acpi_madt_lapic_t* l = (const acpi_madt_lapic_t*)e;
+                if ((l->flags & ACPI_MADT_LAPIC_ENABLED) && info.cpu_count < ACPI_MAX_CPUS)
+                    info.cpu_apic_ids[info.cpu_count++] = l->apic_id;
+                break;
+            }
+            case ACPI_MADT_IOAPIC: {
+                const acpi_madt_ioapic_t* io = (const acpi_madt_ioapic_t*)e;
+                if (info.ioapic_count < ACPI_MAX_IOAPICS) {
+                    acpi_ioapic_info_t* dst = &info.ioapics[info.ioapic_count++];
+                    dst->id       = io->ioapic_id;
+                    dst->address  = io->address;
+                    dst->gsi_base = io->gsi_base;
+                }
+                break;
+            }
+            case ACPI_MADT_ISO: {
+                const acpi_madt_iso_t* iso = (const acpi_madt_iso_t*)e;
+                if (info.override_count < ACPI_MAX_OVERRIDES) {
+                    acpi_irq_override_t* dst = &info.overrides[info.override_count++];
+                    dst->source = iso->source;
+                    dst->gsi    = iso->gsi;
+                    dst->flags  = iso->flags;
+                }
+                break;
+            }
+            case ACPI_MADT_LAPIC_OVERRIDE:
+                info.lapic_address = ((const acpi_madt_lapic_override_t*)e)->address;
+                break;
+            default:
+                break;
+        }
+        p += e->length;
+    }
+}
+
+static void acpi_parse_hpet(void)
+{
+    if (hpet->base_address.space_id != ACPI_GAS_MEMORY) return;
+    info.hpet_address  = hpet->base_address.address;
+    info.hpet_min_tick = hpet->min_tick;
+}
+
+static void acpi_parse_mcfg(void)
+{
+    uint32_t n = (mcfg->header.length - sizeof(acpi_mcfg_t)) / sizeof(acpi_mcfg_alloc_t);
+    for (uint32_t i = 0; i < n && info.mcfg_count < ACPI_MAX_MCFG; i++)
+        info.mcfg[info.mcfg_count++] = mcfg->allocs[i];
+}
+
+static void acpi_parse_fadt(void)
+{
+    uint32_t len = fadt->header.length;
+    info.sci_irq = fadt->sci_int;
+    if (len > offsetof(acpi_fadt_t, century))
+        info.century_reg = fadt->century;
+    if (len >= offsetof(acpi_fadt_t, flags) + sizeof(fadt->flags))
+        info.pm_timer_32bit = (fadt->flags & ACPI_FADT_TMR_VAL_EXT) != 0;
+
+    if (len >= offsetof(acpi_fadt_t, x_pm_tmr_blk) + sizeof(acpi_gas_t) &&
+        fadt->x_pm_tmr_blk.space_id == ACPI_GAS_IO && fadt->x_pm_tmr_blk.address)
+        info.pm_timer_port = (uint32_t)fadt->x_pm_tmr_blk.address;
+    else if (fadt->pm_tmr_len == 4)
+        info.pm_timer_port = fadt->pm_tmr_blk;
+}
+
+void acpi_init(uint32_t magic, uint32_t mbi_addr)
+{
+    memset(&info, 0, sizeof(info));
+    table_count = 0;
+
+    const acpi_rsdp_t* rsdp = acpi_rsdp_from_multiboot(magic, mbi_addr);
+    if (rsdp) {
+        kdbg(KINFO, "acpi: rsdp rev %d from multiboot2\n", rsdp->revision);
+    } else {
+        rsdp = acpi_rsdp_from_bios();
+        if (!rsdp) {
+            kdbg(KWARN, "acpi: no rsdp found\n");
+            return;
+        }
+        kdbg(KINFO, "acpi: rsdp rev %d at 0x%08X\n", rsdp->revision, (uint32_t)(uintptr_t)rsdp);
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address && rsdp->xsdt_address < ACPI_MAPPED_LIMIT) {
+        const acpi_sdt_header_t* xsdt = (const acpi_sdt_header_t*)(uintptr_t)rsdp->xsdt_address;
+        if (memcmp(xsdt->signature, "XSDT", 4) == 0 && acpi_checksum(xsdt, xsdt->length) == 0) {
+            uint32_t n = (xsdt->length - sizeof(acpi_sdt_header_t)) / 8;
+            const uint8_t* ent = (const uint8_t*)(xsdt + 1);
+            for (uint32_t i = 0; i < n; i++) {
+                uint64_t addr;
+                memcpy(&addr, ent + i * 8, 8); // entries are only 4-byte aligned
+                acpi_add_table(addr);
+            }
+        }
+    }
+    if (table_count == 0) {
+        const acpi_sdt_header_t* rsdt = (const acpi_sdt_header_t*)(uintptr_t)rsdp->rsdt_address;
+        if (memcmp(rsdt->signature, "RSDT", 4) != 0 || acpi_checksum(rsdt, rsdt->length) != 0) {
+            kdbg(KERR, "acpi: invalid rsdt\n");
+            return;
+        }
+        uint32_t n = (rsdt->length - sizeof(acpi_sdt_header_t)) / 4;
+        const uint32_t* ent = (const uint32_t*)(rsdt + 1);
+        for (uint32_t i = 0; i < n; i++)
+            acpi_add_table(ent[i]);
+    }
+
+    madt = (const acpi_madt_t*)acpi_find_table("APIC");
+    hpet = (const acpi_hpet_t*)acpi_find_table("HPET");
+    mcfg = (const acpi_mcfg_t*)acpi_find_table("MCFG");
+    fadt = (const acpi_fadt_t*)acpi_find_table("FACP");
+
+    if (madt) acpi_parse_madt();
+    if (hpet) acpi_parse_hpet();
+    if (mcfg) acpi_parse_mcfg();
+    if (fadt) acpi_parse_fadt();
+    info.present = 1;
+
+    kdbg(KINFO, "acpi: %d tables, %d cpu(s), %d ioapic(s), lapic 0x%08X\n",
+         table_count, info.cpu_count, info.ioapic_count, (uint32_t)info.lapic_address);
+    if (info.hpet_address)
+        kdbg(KINFO, "acpi: hpet at 0x%08X\n", (uint32_t)info.hpet_address);
+    for (int i = 0; i < info.mcfg_count; i++)
+        kdbg(KINFO, "acpi: ecam seg %d bus %d-%d at 0x%08X\n", info.mcfg[i].segment,
+             info.mcfg[i].start_bus, info.mcfg[i].end_bus, (uint32_t)info.mcfg[i].base_address);
+    if (info.pm_timer_port)
+        kdbg(KINFO, "acpi: pm timer port 0x%x (%d bit)\n", info.pm_timer_port, info.pm_timer_32bit ? 32 : 24);
+}
+
+const acpi_sdt_header_t* acpi_find_table(const char signature[4])
+{
+    for (int i = 0; i < table_count; i++) {
+        if (memcmp(tables[i]->signature, signature, 4) == 0)
+            return tables[i];
+    }
+    return NULL;
+}
+
+const acpi_madt_t* acpi_get_madt(void) { return madt; }
+const acpi_hpet_t* acpi_get_hpet(void) { return hpet; }
+const acpi_mcfg_t* acpi_get_mcfg(void) { return mcfg; }
+const acpi_fadt_t* acpi_get_fadt(void) { return fadt; }
+
+const acpi_info_t* acpi_get_info(void)
+{
+    return &info;
+}
+
+uint32_t acpi_irq_to_gsi(uint8_t irq, uint16_t* flags)
+{
+    for (int i = 0; i < info.override_count; i++) {
+        if (info.overrides[i].source == irq) {
+            if (flags) *flags = info.overrides[i].flags;
+            return info.overrides[i].gsi;
+        }
+    }
+    if (flags) *flags = 0;
+    return irq;
+}
+
+uint64_t acpi_ecam_address(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function)
+{
+    for (int i = 0; i < info.mcfg_count; i++) {
+        const acpi_mcfg_alloc_t* m = &info.mcfg[i];
+        if (m->segment != segment || bus < m->start_bus || bus > m->end_bus) continue;
+        return m->base_address + (((uint64_t)(bus - m->start_bus) << 20) |
+                                  ((uint64_t)device << 15) | ((uint64_t)function << 12));
+    }
+    return 0;
+}
@@ -0,0 +1,371 @@
+#include <bcache.h>
+#include <heap.h>
+#include <string.h>
+#include <debug.h>
+#include <mutex.h>
+#include <thread.h>
+
+extern volatile uint32_t timer_ticks;
+
+static buf_t* hash[BCACHE_HASH_SIZE];
+static buf_t* lru_head;     // most recently used
+static buf_t* lru_tail;
+static mutex_t lock;
+static waitqueue_t ready_wq;
+static uint32_t budget = BCACHE_DEFAULT_BUDGET;
+static uint32_t used;       // bytes of sector data held
+static bcache_stats_t stats;
+
+void bcache_init(void) {
+    mutex_init(&lock);
+    waitqueue_init(&ready_wq);
+}
+
+static uint32_t bhash(block_device_t* disk, uint64_t block) {
+    uint64_t h = ((uintptr_t)disk >> 4) ^ (block * 0x9E3779B97F4A7C15ull);
+    return (uint32_t)(h ^ (h >> 32)) % BCACHE_HASH_SIZE;
+}
+
+static buf_t* hash_find(block_device_t* disk, uint64_t block) {
+    for (buf_t* b = hash[bhash(disk, block)]; b; b = b->hnext)
+        if (b->disk == disk && b->block == block) return b;
+    return NULL;
+}
+
+static void hash_remove(buf_t* b) {
+    buf_t** p = &hash[bhash(b->disk, b->block)];
+    while (*p != b) p = &(*p)->hnext;
+    *p = b->hnext;
+}
+
+static void lru_unlink(buf_t* b) {
+    if (b->prev) b->prev->next = b->next;
+    else lru_head = b->next;
+    if (b->next) b->next->prev = b->prev;
+    else lru_tail = b->prev;
+}
+
+static void lru_push(buf_t* b) {
+    b->prev = NULL;
+    b->next = lru_head;
+    if (lru_head) lru_head->prev = b;
+    else lru_tail = b;
+    lru_head = b;
+}
+
+static void set_clean(buf_t* b) {
+    if (b->flags & B_DIRTY) {
+        b->flags &= ~B_DIRTY;
+        stats.dirty--;
+    }
+}
+
+static void set_dirty(buf_t* b) {
+    if (!(b->flags & B_DIRTY)) {
+        b->flags |= B_DIRTY;
+        b->dirtied = timer_ticks;
+        stats.dirty++;
+    }
+}
+
+static void buf_free(buf_t* b) {
+    hash_remove(b);
+    lru_unlink(b);
+    used -= b->size;
+    stats.buffers--;
+    kfree(b->data);
+    kfree(b);
+}
+
+static int evictable(buf_t* b) {
+    return !b->refcnt && b->ready && !(b->flags & B_DIRTY);
+}
+
+static int buf_io(buf_t* b, int write) {
+    iovec_t iov = { b->data, b->size };
+    return blk_queue_submit(b->disk, b->block, &iov, 1, write);
+}
+
+// write a dirty buffer back; the lock is held and dropped around the I/O
+static int writeback_locked(buf_t* b) {
+    b->refcnt++;
+    set_clean(b);
+    mutex_unlock(&lock);
+    int rc = buf_io(b, 1);
+    mutex_lock(&lock);
+    b->refcnt--;
+    if (rc) set_dirty(b);   // try again later
+    else stats.writebacks++;
+    return rc;
+}
+
+// Free the least recently used clean buffer, or with allow_write write the
+// least recently used dirty one back. 0 if every buffer is pinned or busy.
+static int make_room(int allow_write) {
+    for (buf_t* b = lru_tail; b; b = b->prev) {
+        if (evictable(b)) {
+            buf_free(b);
+            stats.evictions++;
+            return 1;
+        }
+    }
+    if (!allow_write) return 0;
+    for (buf_t* b = lru_tail; b; b = b->prev)
+        if (!b->refcnt && b->ready) return writeback_locked(b) == 0;
+    return 0;
+}
+
+static buf_t* bcache_lookup(block_device_t* dev, uint64_t lba, int read) {
+    if (!dev || lba >= dev->sectors) return NULL;
+    block_device_t* disk = dev;
+    while (disk->parent) {
+        lba += disk->start;
+        disk = disk->parent;
+    }
+    if (!disk->ops || !disk->ops->submit) return NULL;
+    uint32_t size = disk->sector_size;
+
+    mutex_lock(&lock);
+    buf_t* b;
+    // over budget, everything pinned: go over it rather than fail
+    while (!(b = hash_find(disk, lba)) && used + size > budget && make_room(1))
+        ;
+    int do_read = 0, owner = 0;
+    if (b) {
+        stats.hits++;
+        b->refcnt++;
+        lru_unlink(b);
+        lru_push(b);
+        // left invalid by a failed read or an unfilled bcache_get
+        if (read && b->ready && !(b->flags & B_VALID)) {
+            b->ready = 0;
+            do_read = 1;
+        }
+    } else {
+        stats.misses++;
+        b = kmalloc(sizeof(buf_t));
+        uint8_t* data = b ? kmalloc(size) : NULL;
+        if (!data) {
+            kfree(b);
+            mutex_unlock(&lock);
+            kdbg(KERR, "bcache: out of memory\n");
+            return NULL;
+        }
+        memset(b, 0, sizeof(*b));
+        b->disk = disk;
+        b->block = lba;
+        b->data = data;
+        b->size = size;
+        b->refcnt = 1;
+        // a bcache_get buffer stays not ready, owned by its caller, until
+        // it is filled (bcache_dirty) or given up (bcache_release)
+        b->ready = 0;
+        owner = !read;
+        if (owner) b->flags |= B_OWNED;
+        do_read = read;
+        uint32_t h = bhash(disk, lba);
+        b->hnext = hash[h];
+        hash[h] = b;
+        lru_push(b);
+        used += size;
+        stats.buffers++;
+    }
+    mutex_unlock(&lock);
+
+    while (!do_read && !owner && !b->ready) {
+        waitqueue_wait(&ready_wq, &b->ready, 0);
+        // given up unfilled by its owner, or a failed read: read it here
+        mutex_lock(&lock);
+        if (read && b->ready && !(b->flags & B_VALID)) {
+            b->ready = 0;
+            do_read = 1;
+        }
+        mutex_unlock(&lock);
+    }
+    if (do_read) {
+        int rc = buf_io(b, 0);
+        mutex_lock(&lock);
+        if (rc == 0) b->flags |= B_VALID;
+        b->ready = 1;
+        waitqueue_wake_all(&ready_wq);
+        mutex_unlock(&lock);
+    }
+    if (read && !(b->flags & B_VALID)) {
+        bcache_release(b);
+        return NULL;
+    }
+    return b;
+}
+
+buf_t* bcache_read(block_device_t* dev, uint64_t lba) {
+    return bcache_lookup(dev, lba, 1);
+}
+
+buf_t* bcache_get(block_device_t* dev, uint64_t lba) {
+    return bcache_lookup(dev, lba, 0);
+}
+
+// the owner of a bcache_get buffer is done with it: let the others in
+static void disown(buf_t* b) {
+    if (b->flags & B_OWNED) {
+        b->flags &= ~B_OWNED;
+        b->ready = 1;
+        waitqueue_wake_all(&ready_wq);
+    }
+}
+
+void bcache_dirty(buf_t* b) {
+    mutex_lock(&lock);
+    b->flags |= B_VALID;
+    set_dirty(b);
+    disown(b);
+    mutex_unlock(&lock);
+}
+
+void bcache_release(buf_t* b) {
+    mutex_lock(&lock);
+    disown(b);
+    if (--b->refcnt == 0 && used > budget && evictable(b)) {
+        buf_free(b);
+        stats.evictions++;
+    }
+    mutex_unlock(&lock);
+}
+
+int bcache_write(buf_t* b) {
+    int rc = 0;
+    mutex_lock(&lock);
+    if (b->flags & B_DIRTY) rc = writeback_locked(b);
+    mutex_unlock(&lock);
+    return rc;
+}
+
+// write back the dirty buffers of a disk that are at least age ticks old,
+// plugged so that neighbouring sectors leave as one request
+static int writeback_disk(block_device_t* disk, uint32_t age) {
+    mutex_lock(&lock);
+    uint32_t max = stats.dirty, n = 0;
+    buf_t** list = max ? kmalloc(max * sizeof(buf_t*)) : NULL;
+    if (!list) {
+        mutex_unlock(&lock);
+        return max ? -1 : 0;
+    }
+    for (buf_t* b = lru_tail; b && n < max; b = b->prev) {
+        if (b->disk == disk && (b->flags & B_DIRTY) && timer_ticks - b->dirtied >= age) {
+            b->refcnt++;
+            list[n++] = b;
+        }
+    }
+    mutex_unlock(&lock);
+    if (!n) {
+        kfree(list);
+        return 0;
+    }
+
+    int rc = 0;
+    blk_plug(disk);
+    mutex_lock(&lock);
+    for (uint32_t i = 0; i < n; i++)
+        if ((list[i]->flags & B_DIRTY) && writeback_locked(list[i]) != 0) rc = -1;
+    mutex_unlock(&lock);
+    if (blk_unplug(disk) != 0) rc = -1;
+
+    mutex_lock(&lock);
+    for (uint32_t i = 0; i < n; i++) list[i]->refcnt--;
+    mutex_unlock(&lock);
+    kfree(list);
+    return rc;
+}
+
+int bcache_sync(block_device_t* dev) {
+    if (dev) {
+        while (dev->parent) dev = dev->parent;
+        return writeback_disk(dev, 0);
+    }
+    int rc = 0;
+    for (int i = 0; i < block_count(); i++) {
+        block_device_t* d = block_get(i);
+        if (!d->parent && writeback_disk(d, 0) != 0) rc = -1;
+    }
+    return rc;
+}
+
+void bcache_invalidate(block_device_t* dev) {
+    while (dev && dev->parent) dev = dev->parent;
+    mutex_lock(&lock);
+    buf_t* b = lru_head;
+    while (b) {
+        buf_t* next = b->next;
+        if ((!dev || b->disk == dev) && evictable(b)) buf_free(b);
+        b = next;
+    }
+    mutex_unlock(&lock);
+}
+
+void bcache_flusher(void) {
+    for (;;) {
+        thread_sleep(BCACHE_FLUSH_INTERVAL_MS);
+        if (!stats.dirty) continue;
+        for (int i = 0; i < block_count(); i++) {
+            block_device_t* d = block_get(i);
+            if (!d->parent) writeback_disk(d, BCACHE_DIRTY_AGE_MS);
+        }
+    }
+}
+
+void bcache_set_budget(uint32_t bytes) {
+    mutex_lock(&lock);
+    budget = bytes;
+    while (used > budget && make_room(0))
+        ;
+    mutex_unlock(&lock);
+}
+
+void bcache_get_stats(bcache_stats_t* st) {
+    mutex_lock(&lock);
+    *st = stats;
+    st->budget = budget;
+    st->bytes = used;
+    st->pinned = 0;
+    for (buf_t* b = lru_head; b; b = b->next)
+        if (b->refcnt) st->pinned++;
+    mutex_unlock(&lock);
+}
+
+void bcache_io_hook(block_device_t* disk, uint64_t lba, const iovec_t* iov, int iovcnt, int write) {
+    if (!stats.buffers) return;
+    uint32_t ss = disk->sector_size;
+    mutex_lock(&lock);
+    // block_submit only passes whole sectors per segment
+    for (int i = 0; i < iovcnt; i++) {
+        for (uint32_t off = 0; off < iov[i].len; off += ss, lba++) {
+            buf_t* b = hash_find(disk, lba);
+            if (!b || !b->ready) continue;
+            uint8_t* p = (uint8_t*)iov[i].base + off;
+            if (write) {
+                // clean or dirty, that is up to the write's result
+                memcpy(b->data, p, ss);
+                b->flags |= B_VALID;
+            } else if (b->flags & B_DIRTY) {
+                memcpy(p, b->data, ss);
+            }
+        }
+    }
+    mutex_unlock(&lock);
+}
+
+void bcache_write_done(block_device_t* disk, uint64_t lba, const iovec_t* iov, int iovcnt, int rc) {
+    if (!stats.buffers) return;
+    uint32_t ss = disk->sector_size;
+    mutex_lock(&lock);
+    for (int i = 0; i < iovcnt; i++) {
+        for (uint32_t off = 0; off < iov[i].len; off += ss, lba++) {
+            buf_t* b = hash_find(disk, lba);
+            // a buffer changed since holds newer data and keeps its state
+            if (!b || !b->ready || memcmp(b->data, (uint8_t*)iov[i].base + off, ss)) continue;
+            if (rc) set_dirty(b);   // the flusher tries again
+            else set_clean(b);
+        }
+    }
+    mutex_unlock(&lock);
+}
@@ -0,0 +1,107 @@
+#include <block.h>
+#include <irqflags.h>
+#include <string.h>
+#include <debug.h>
+#include <vga.h>
+
+void bio_init(bio_t* bio, block_device_t* dev, uint64_t lba, const iovec_t* iov, int iovcnt, int write) {
+    memset(bio, 0, sizeof(*bio));
+    bio->dev = dev;
+    bio->lba = lba;
+    bio->iov = iov;
+    bio->iovcnt = iovcnt;
+    bio->write = write;
+    waitqueue_init(&bio->wait);
+}
+
+static void bio_complete(bio_t* bio, int status) {
+    bio->status = status;
+    if (bio->end_io) {
+        bio->end_io(bio);
+        return;
+    }
+    // the waiter may free the bio as soon as it runs again
+    uint64_t irqf = local_irq_save();
+    bio->done = 1;
+    waitqueue_wake_all(&bio->wait);
+    local_irq_restore(irqf);
+}
+
+static void bio_execute(bio_t* bio) {
+    bio_complete(bio, block_submit(bio->dev, bio->lba, bio->iov, bio->iovcnt, bio->write));
+}
+
+static void bio_worker(void) {
+    block_device_t* disk = thread_current()->arg;
+    blk_queue_t* q = &disk->queue;
+    for (;;) {
+        uint64_t irqf = local_irq_save();
+        bio_t* bio = q->bio_head;
+        if (!bio) {
+            q->bio_pending = 0;
+            local_irq_restore(irqf);
+            waitqueue_wait(&q->bio_wq, &q->bio_pending, 0);
+            continue;
+        }
+        q->bio_head = bio->next;
+        if (!q->bio_head) q->bio_tail = NULL;
+        local_irq_restore(irqf);
+        bio_execute(bio);
+    }
+}
+
+// workers never exit, so all disks together get at most BIO_MAX_TOTAL_WORKERS
+static int total_workers;
+
+// start the disk's workers on first use; interrupts are off
+static void bio_start_workers(block_device_t* disk) {
+    blk_queue_t* q = &disk->queue;
+    q->workers_started = 1;
+    int n = disk->limits.queue_depth ? disk->limits.queue_depth : 1;
+    if (n > BIO_MAX_WORKERS) n = BIO_MAX_WORKERS;
+    while (q->workers < n && total_workers < BIO_MAX_TOTAL_WORKERS) {
+        char name[32];
+        snprintf(name, sizeof(name), "bio/%s-%d", disk->name, q->workers);
+        thread_t* t = thread_create(bio_worker, name);
+        if (!t) break;
+        t->arg = disk;
+        q->workers++;
+        total_workers++;
+    }
+    if (!q->workers) kdbg(KWARN, "block: %s: no worker threads, bios run synchronously\n", disk->name);
+}
+
+void block_submit_bio(bio_t* bio) {
+    bio->done = 0;
+    bio->next = NULL;
+    block_device_t* disk = bio->dev;
+    if (!disk) {
+        bio_complete(bio, -1);
+        return;
+    }
+    while (disk->parent) disk = disk->parent;
+    blk_queue_t* q = &disk->queue;
+
+    if (!waitqueue_can_sleep()) {
+        bio_execute(bio);
+        return;
+    }
+    uint64_t irqf = local_irq_save();
+    if (!q->workers_started) bio_start_workers(disk);
+    if (!q->workers) {
+        local_irq_restore(irqf);
+        bio_execute(bio);
+        return;
+    }
+    if (q->bio_tail) q->bio_tail->next = bio;
+    else q->bio_head = bio;
+    q->bio_tail = bio;
+    q->bio_pending = 1;
+    waitqueue_wake_all(&q->bio_wq);
+    local_irq_restore(irqf);
+}
+
+int bio_wait(bio_t* bio) {
+    waitqueue_wait(&bio->wait, &bio->done, 0);
+    return bio->status;
+}
@@ -0,0 +1,165 @@
+#include <block.h>
+#include <bcache.h>
+#include <heap.h>
+#include <string.h>
+#include <debug.h>
+#include <vga.h>
+
+#define MBR_PART_TABLE 0x1BE
+#define MBR_PART_GPT   0xEE
+
+static block_device_t* devices[BLOCK_MAX_DEVICES];
+static int device_count = 0;
+
+int block_register(block_device_t* dev) {
+    if (device_count >= BLOCK_MAX_DEVICES) {
+        kdbg(KERR, "block: no room for %s\n", dev->name);
+        return -1;
+    }
+    if (!dev->sector_size) dev->sector_size = 512;
+    if (!dev->limits.max_segments || dev->limits.max_segments > BLOCK_MAX_SEGMENTS)
+        dev->limits.max_segments = BLOCK_MAX_SEGMENTS;
+    if (!dev->parent) blk_queue_init(&dev->queue);
+    dev->index = device_count;
+    devices[device_count++] = dev;
+    kdbg(KINFO, "block %d: %s, %llu sectors%s%s\n", dev->index, dev->name, dev->sectors,
+         dev->model[0] ? ", " : "", dev->model);
+    return dev->index;
+}
+
+int block_count(void) {
+    return device_count;
+}
+
+block_device_t* block_get(int index) {
+    if (index < 0 || index >= device_count) return NULL;
+    return devices[index];
+}
+
+block_device_t* block_find(const char* name) {
+    for (int i = 0; i < device_count; i++)
+        if (strcmp(devices[i]->name, name) == 0) return devices[i];
+    return NULL;
+}
+
+static void block_add_partition(block_device_t* disk, int n, uint8_t type, uint32_t start, uint32_t count) {
+    block_device_t* part = kmalloc(sizeof(block_device_t));
+    if (!part) return;
+    memset(part, 0, sizeof(*part));
+    snprintf(part->name, sizeof(part->name), "%sp%d", disk->name, n);
+    memcpy(part->model, disk->model, sizeof(part->model));
+    part->sector_size = disk->sector_size;
+    part->sectors = count;
+    part->limits = disk->limits;
+    part->ops = disk->ops;
+    part->priv = disk->priv;
+    part->parent = disk;
+    part->start = start;
+    part->part_type = type;
+    if (block_register(part) < 0) kfree(part);
+}
+
+void block_scan_partitions(void) {
+    uint8_t* mbr = kmalloc(512);
+    if (!mbr) return;
+    int disks = device_count;
+    for (int i = 0; i < disks; i++) {
+        block_device_t* disk = devices[i];
+        if (disk->parent || disk->sector_size != 512) continue;
+        if (block_read(disk, 0, 1, mbr) != 0) continue;
+        if (mbr[510] != 0x55 || mbr[511] != 0xAA) continue;
+        for (int p = 0; p < 4; p++) {
+            uint8_t* e = &mbr[MBR_PART_TABLE + p * 16];
+            uint8_t type = e[4];
+            uint32_t start = *(uint32_t*)&e[8];
+            uint32_t count = *(uint32_t*)&e[12];
+            if (type == MBR_PART_GPT) {
+                kdbg(KWARN, "block: %s: gpt disks are not supported\n", disk->name);
+                break;
+            }
+            // a partitionless volume also ends in 55AA; its boot code fails these checks
+            if (!type || !count || !start || (e[0] & 0x7F)) continue;
+            if ((uint64_t)start + count > disk->sectors) continue;
+            block_add_partition(disk, p + 1, type, start, count);
+        }
+    }
+    kfree(mbr);
+}
+
+int block_submit(block_device_t* dev, uint64_t lba, const iovec_t* iov, int iovcnt, int write) {
+    if (!dev || iovcnt < 0) return -1;
+    uint64_t bytes = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (!iov[i].len || iov[i].len % dev->sector_size) return -1;
+        bytes += iov[i].len;
+    }
+    if (!bytes) return 0;
+    uint64_t count = bytes / dev->sector_size;
+    if (lba > dev->sectors || count > dev->sectors - lba) return -1;
+    while (dev->parent) {
+        lba += dev->start;
+        dev = dev->parent;
+    }
+    if (!dev->ops || !dev->ops->submit) return -1;
+    if (write) bcache_io_hook(dev, lba, iov, iovcnt, 1);
+    int rc = blk_queue_submit(dev, lba, iov, iovcnt, write);
+    if (write) bcache_write_done(dev, lba, iov, iovcnt, rc);
+    else if (rc == 0) bcache_io_hook(dev, lba, iov, iovcnt, 0);
+    return rc;
+}
+
+// hand a request to the driver, cut to its limits
+int block_issue(block_device_t* disk, uint64_t lba, const iovec_t* iov, int iovcnt, int write) {
+    uint64_t bytes = iov_total(iov, iovcnt);
+    uint64_t max_bytes = disk->limits.max_sectors ? (uint64_t)disk->limits.max_sectors * disk->sector_size
+                                                  : bytes;
+    int max_segs = disk->limits.max_segments;
+    if (iovcnt <= max_segs && bytes <= max_bytes)
+        return disk->ops->submit(disk, lba, iov, iovcnt, write);
+
+    // cut on segment and size limits; max_bytes is whole sectors, so are the pieces
+    iovec_t part[BLOCK_MAX_SEGMENTS];
+    int idx = 0;
+    uint32_t off = 0;
+    while (idx < iovcnt) {
+        int n = 0;
+        uint64_t chunk = 0;
+        while (idx < iovcnt && n < max_segs && chunk < max_bytes) {
+            uint64_t len = iov[idx].len - off;
+            if (len > max_bytes - chunk) len = max_bytes - chunk;
+            part[n].base = (uint8_t*)iov[idx].base + off;
+            part[n].len = len;
+            n++;
+            chunk += len;
+            off += len;
+            if (off == iov[idx].len) { idx++; off = 0; }
+        }
+        int rc = disk->ops->submit(disk, lba, part, n, write);
+        if (rc) return rc;
+        lba += chunk / disk->sector_size;
+    }
+    return 0;
+}
+
+int block_read(block_device_t* dev, uint64_t lba, uint32_t count, void* buf) {
+    if (!count) return 0;
+    if (!dev || (uint64_t)count * dev->sector_size > 0xFFFFFFFF) return -1;
+    iovec_t iov = { buf, count * dev->sector_size };
+    return block_submit(dev, lba, &iov, 1, 0);
+}
+
+int block_write(block_device_t* dev, uint64_t lba, uint32_t count, const void* buf) {
+    if (!count) return 0;
+    if (!dev || (uint64_t)count * dev->sector_size > 0xFFFFFFFF) return -1;
+    iovec_t iov = { (void*)buf, count * dev->sector_size };
+    return block_submit(dev, lba, &iov, 1, 1);
+}
+
+int block_flush(block_device_t* dev) {
+    if (!dev) return -1;
+    while (dev->parent) dev = dev->parent;
+    int rc = bcache_sync(dev);
+    if (blk_queue_drain(dev) != 0) rc = -1;
+    if (dev->ops && dev->ops->flush && dev->ops->flush(dev) != 0) rc = -1;
+    return rc;
+}
@@ -0,0 +1,242 @@
+#include <block.h>
+#include <bcache.h>
+#include <heap.h>
+#include <string.h>
+#include <debug.h>
+#include <thread.h>
+
+extern volatile uint32_t timer_ticks;
+
+struct blk_request {
+    uint64_t lba;
+    uint32_t sectors;
+    uint32_t deadline;          // timer tick by which it should have been issued
+    uint8_t* data;              // private copy of the data to write
+    blk_request_t* next;        // LBA order
+    blk_request_t* fifo_next;   // arrival order
+};
+
+void blk_queue_init(blk_queue_t* q) {
+    memset(q, 0, sizeof(*q));
+    mutex_init(&q->lock);
+    waitqueue_init(&q->bio_wq);
+}
+
+static void iov_gather(uint8_t* dst, const iovec_t* iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].base, iov[i].len);
+        dst += iov[i].len;
+    }
+}
+
+static void iov_scatter(const iovec_t* iov, int iovcnt, const uint8_t* src) {
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].base, src, iov[i].len);
+        src += iov[i].len;
+    }
+}
+
+static uint32_t blk_max_request(block_device_t* disk) {
+    uint32_t max = BLK_MAX_REQUEST_SECTORS;
+    if (disk->limits.max_sectors && disk->limits.max_sectors < max) max = disk->limits.max_sectors;
+    return max;
+}
+
+static void blk_insert(blk_queue_t* q, blk_request_t* r) {
+    blk_request_t** p = &q->sorted;
+    while (*p && (*p)->lba < r->lba) p = &(*p)->next;
+    r->next = *p;
+    *p = r;
+    p = &q->fifo;
+    while (*p) p = &(*p)->fifo_next;
+    r->fifo_next = NULL;
+    *p = r;
+    q->count++;
+}
+
+static void blk_unlink(blk_queue_t* q, blk_request_t* r) {
+    blk_request_t** p = &q->sorted;
+    while (*p != r) p = &(*p)->next;
+    *p = r->next;
+    p = &q->fifo;
+    while (*p != r) p = &(*p)->fifo_next;
+    *p = r->fifo_next;
+    q->count--;
+}
+
+static int blk_overlaps(blk_queue_t* q, uint64_t lba, uint32_t count) {
+    for (blk_request_t* r = q->sorted; r && r->lba < lba + count; r = r->next)
+        if (r->lba + r->sectors > lba) return 1;
+    return 0;
+}
+
+static blk_request_t* blk_covering(blk_queue_t* q, uint64_t lba, uint32_t count) {
+    for (blk_request_t* r = q->sorted; r && r->lba <= lba; r = r->next)
+        if (lba + count <= r->lba + r->sectors) return r;
+    return NULL;
+}
+
+static int blk_expired(blk_queue_t* q) {
+    return q->fifo && (int32_t)(timer_ticks - q->fifo->deadline) >= 0;
+}
+
+// an expired request goes first, otherwise the next one up from the head
+static blk_request_t* blk_elv_next(blk_queue_t* q) {
+    if (blk_expired(q)) return q->fifo;
+    for (blk_request_t* r = q->sorted; r; r = r->next)
+        if (r->lba >= q->head) return r;
+    return q->sorted; // wrap around to the lowest LBA
+}
+
+// issue every queued request; the queue lock is held
+static void blk_dispatch_all(block_device_t* disk) {
+    blk_queue_t* q = &disk->queue;
+    blk_request_t* r;
+    while (q->sorted) {
+        r = blk_elv_next(q);
+        blk_unlink(q, r);
+        iovec_t iov = { r->data, r->sectors * disk->sector_size };
+        int rc = block_issue(disk, r->lba, &iov, 1, 1);
+        if (rc) {
+            kdbg(KERR, "block: %s: deferred write of %u sectors at %llu failed\n", disk->name,
+                 r->sectors, r->lba);
+            if (!q->error) q->error = rc;
+            // the cache took this data as written when it was queued
+            bcache_write_done(disk, r->lba, &iov, 1, rc);
+        }
+        q->head = r->lba + r->sectors;
+        q->dispatched++;
+        kfree(r->data);
+        kfree(r);
+    }
+}
+
+// Queue a write from the plug owner. Rewrites of queued sectors update the
+// copy in place; writes adjacent to a queued one extend it.
+static int blk_queue_write(block_device_t* disk, uint64_t lba, const iovec_t* iov, int iovcnt, uint32_t count) {
+    blk_queue_t* q = &disk->queue;
+    uint32_t ss = disk->sector_size;
+    uint32_t max = blk_max_request(disk);
+
+    blk_request_t* r = blk_covering(q, lba, count);
+    if (r) {
+        iov_gather(r->data + (lba - r->lba) * ss, iov, iovcnt);
+        q->merges++;
+        return 0;
+    }
+    // partial overlaps would have to be split; let the old data go first
+    if (blk_overlaps(q, lba, count)) blk_dispatch_all(disk);
+
+    for (r = q->sorted; r; r = r->next) {
+        if (r->lba + r->sectors == lba && r->sectors + count <= max) {
+            // back merge, then swallow the next request if the gap closed
+            uint8_t* d = krealloc(r->data, (r->sectors + count) * ss);
+            if (!d) break;
+            r->data = d;
+            iov_gather(d + r->sectors * ss, iov, iovcnt);
+            r->sectors += count;
+            q->merges++;
+            blk_request_t* n = r->next;
+            if (n && n->lba == r->lba + r->sectors && r->sectors + n->sectors <= max &&
+                (d = krealloc(r->data, (r->sectors + n->sectors) * ss))) {
+                r->data = d;
+                memcpy(d + r->sectors * ss, n->data, n->sectors * ss);
+                r->sectors += n->sectors;
+                blk_unlink(q, n);
+                kfree(n->data);
+                kfree(n);
+            }
+            return 0;
+        }
+        if (lba + count == r->lba && r->sectors + count <= max) {
+            // front merge; nothing sits between, so the sort order holds
+            uint8_t* d = kmalloc((r->sectors + count) * ss);
+            if (!d) break;
+            iov_gather(d, iov, iovcnt);
+            memcpy(d + count * ss, r->data, r->sectors * ss);
+            kfree(r->data);
+            r->data = d;
+            r->lba = lba;
+            r->sectors += count;
+            q->merges++;
+            return 0;
+        }
+    }
+
+    r = kmalloc(sizeof(blk_request_t));
+    uint8_t* d = r ? kmalloc(count * ss) : NULL;
+    if (!d) {
+        // no memory to defer it: write through
+        kfree(r);
+        return block_issue(disk, lba, iov, iovcnt, 1);
+    }
+    iov_gather(d, iov, iovcnt);
+    r->lba = lba;
+    r->sectors = count;
+    r->data = d;
+    r->deadline = timer_ticks + BLK_WRITE_DEADLINE_MS;
+    blk_insert(q, r);
+    if (q->count >= BLK_BATCH_REQUESTS) blk_dispatch_all(disk);
+    return 0;
+}
+
+int blk_queue_submit(block_device_t* disk, uint64_t lba, const iovec_t* iov, int iovcnt, int write) {
+    blk_queue_t* q = &disk->queue;
+    uint32_t count = iov_total(iov, iovcnt) / disk->sector_size;
+    mutex_lock(&q->lock);
+    if (write && q->plugged && q->plug_owner == thread_current() && count <= blk_max_request(disk)) {
+        int rc = blk_queue_write(disk, lba, iov, iovcnt, count);
+        if (blk_expired(q)) blk_dispatch_all(disk);
+        mutex_unlock(&q->lock);
+        return rc;
+    }
+    if (!write) {
+        blk_request_t* r = blk_covering(q, lba, count);
+        if (r) {
+            iov_scatter(iov, iovcnt, r->data + (lba - r->lba) * disk->sector_size);
+            mutex_unlock(&q->lock);
+            return 0;
+        }
+    }
+    // anything overlapping must reach the disk before this request does
+    if (blk_overlaps(q, lba, count)) blk_dispatch_all(disk);
+    mutex_unlock(&q->lock);
+    return block_issue(disk, lba, iov, iovcnt, write);
+}
+
+int blk_queue_drain(block_device_t* disk) {
+    blk_queue_t* q = &disk->queue;
+    mutex_lock(&q->lock);
+    blk_dispatch_all(disk);
+    int rc = q->error;
+    q->error = 0;
+    mutex_unlock(&q->lock);
+    return rc;
+}
+
+void blk_plug(block_device_t* dev) {
+    if (!dev) return;
+    while (dev->parent) dev = dev->parent;
+    blk_queue_t* q = &dev->queue;
+    mutex_lock(&q->lock);
+    // one thread plugs a disk at a time; others keep writing through
+    if (!q->plugged) q->plug_owner = thread_current();
+    if (q->plug_owner == thread_current()) q->plugged++;
+    mutex_unlock(&q->lock);
+}
+
+int blk_unplug(block_device_t* dev) {
+    if (!dev) return -1;
+    while (dev->parent) dev = dev->parent;
+    blk_queue_t* q = &dev->queue;
+    int rc = 0;
+    mutex_lock(&q->lock);
+    if (q->plugged && q->plug_owner == thread_current() && --q->plugged == 0) {
+        blk_dispatch_all(dev);
+        rc = q->error;
+        q->error = 0;
+        q->plug_owner = NULL;
+    }
+    mutex_unlock(&q->lock);
+    return rc;
+}
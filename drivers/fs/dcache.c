@@ -0,0 +1,197 @@
+#include <dcache.h>
+#include <heap.h>
+#include <string.h>
+#include <mutex.h>
+
+static dentry_t* hash[DCACHE_HASH_SIZE];
+static dentry_t* chash[DCACHE_HASH_SIZE];
+static dentry_t* lru_head;      // most recently used
+static dentry_t* lru_tail;
+static mutex_t lock;
+static dcache_stats_t stats;
+
+void dcache_init(void) {
+    mutex_init(&lock);
+}
+
+static char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static int name_eq(const char* a, const char* b) {
+    while (*a && fold(*a) == fold(*b)) {
+        a++;
+        b++;
+    }
+    return !*a && !*b;
+}
+
+static uint32_t dhash(uint8_t drive, uint32_t parent, const char* name) {
+    uint32_t h = 2166136261u ^ drive;
+    h = (h ^ parent) * 16777619u;
+    for (; *name; name++) h = (h ^ (uint8_t)fold(*name)) * 16777619u;
+    return h;
+}
+
+static uint32_t chash_of(uint8_t drive, uint32_t cluster) {
+    return (cluster * 2654435761u ^ drive) % DCACHE_HASH_SIZE;
+}
+
+// a subdirectory other than "." and "..", findable by its cluster
+static int is_subdir(const dentry_t* d) {
+    const char* n = d->ent.name;
+    if (n[0] == '.' && (!n[1] || (n[1] == '.' && !n[2]))) return 0;
+    return !d->negative && (d->ent.attr & 0x10) && d->ent.first_cluster >= 2;
+}
+
+static dentry_t* find(uint8_t drive, uint32_t parent, const char* name, uint32_t h) {
+    for (dentry_t* d = hash[h % DCACHE_HASH_SIZE]; d; d = d->hnext)
+        if (d->hash == h && d->drive == drive && d->parent == parent && name_eq(d->ent.name, name)) return d;
+    return NULL;
+}
+
+static void lru_unlink(dentry_t* d) {
+    if (d->prev) d->prev->next = d->next;
+    else lru_head = d->next;
+    if (d->next) d->next->prev = d->prev;
+    else lru_tail = d->prev;
+}
+
+static void lru_push(dentry_t* d) {
+    d->prev = NULL;
+    d->next = lru_head;
+    if (lru_head) lru_head->prev = d;
+    else lru_tail = d;
+    lru_head = d;
+}
+
+static void chash_remove(dentry_t* d) {
+    dentry_t** p = &chash[chash_of(d->drive, d->ent.first_cluster)];
+    while (*p && *p != d) p = &(*p)->cnext;
+    if (*p) *p = d->cnext;
+}
+
+static void chash_insert(dentry_t* d) {
+    uint32_t c = chash_of(d->drive, d->ent.first_cluster);
+    d->cnext = chash[c];
+    chash[c] = d;
+}
+
+static void dentry_free(dentry_t* d) {
+    dentry_t** p = &hash[d->hash % DCACHE_HASH_SIZE];
+    while (*p != d) p = &(*p)->hnext;
+    *p = d->hnext;
+    if (is_subdir(d)) chash_remove(d);
+    lru_unlink(d);
+    stats.entries--;
+    kfree(d);
+}
+
+int dcache_lookup(uint8_t drive, uint32_t parent, const char* name, fat32_entry_t* out) {
+    mutex_lock(&lock);
+    dentry_t* d = find(drive, parent, name, dhash(drive, parent, name));
+    int rc = -1;
+    if (!d) {
+        stats.misses++;
+    } else {
+        lru_unlink(d);
+        lru_push(d);
+        if (d->negative) {
+            stats.negative_hits++;
+            rc = 0;
+        } else {
+            stats.hits++;
+            if (out) *out = d->ent;
+            rc = 1;
+        }
+    }
+    mutex_unlock(&lock);
+    return rc;
+}
+
+int dcache_lookup_dir(uint8_t drive, uint32_t cluster, uint32_t* parent, fat32_entry_t* out) {
+    mutex_lock(&lock);
+    dentry_t* d = chash[chash_of(drive, cluster)];
+    while (d && !(d->drive == drive && d->ent.first_cluster == cluster)) d = d->cnext;
+    if (d) {
+        stats.hits++;
+        lru_unlink(d);
+        lru_push(d);
+        if (parent) *parent = d->parent;
+        if (out) *out = d->ent;
+    } else {
+        stats.misses++;
+    }
+    mutex_unlock(&lock);
+    return d ? 1 : -1;
+}
+
+static void add(uint8_t drive, uint32_t parent, const fat32_entry_t* ent, const char* name) {
+    uint32_t h = dhash(drive, parent, name);
+    mutex_lock(&lock);
+    dentry_t* d = find(drive, parent, name, h);
+    if (d) {
+        // replaced in place: it may change between negative, file and directory
+        if (is_subdir(d)) chash_remove(d);
+        lru_unlink(d);
+    } else {
+        if (stats.entries >= DCACHE_MAX_ENTRIES && lru_tail) {
+            dentry_free(lru_tail);
+            stats.evictions++;
+        }
+        d = kmalloc(sizeof(dentry_t));
+        if (!d) {
+            mutex_unlock(&lock);
+            return;
+        }
+        d->drive = drive;
+        d->parent = parent;
+        d->hash = h;
+        d->hnext = hash[h % DCACHE_HASH_SIZE];
+        hash[h % DCACHE_HASH_SIZE] = d;
+        stats.entries++;
+    }
+    d->negative = !ent;
+    if (ent) {
+        d->ent = *ent;
+    } else {
+        memset(&d->ent, 0, sizeof(d->ent));
+        strncpy(d->ent.name, name, FAT32_MAX_NAME);
+    }
+    if (is_subdir(d)) chash_insert(d);
+    lru_push(d);
+    mutex_unlock(&lock);
+}
+
+void dcache_add(uint8_t drive, uint32_t parent, const fat32_entry_t* ent) {
+    add(drive, parent, ent, ent->name);
+}
+
+void dcache_add_negative(uint8_t drive, uint32_t parent, const char* name) {
+    if (strlen(name) > FAT32_MAX_NAME) return;
+    add(drive, parent, NULL, name);
+}
+
+void dcache_remove(uint8_t drive, uint32_t parent, const char* name) {
+    mutex_lock(&lock);
+    dentry_t* d = find(drive, parent, name, dhash(drive, parent, name));
+    if (d) dentry_free(d);
+    mutex_unlock(&lock);
+}
+
+void dcache_invalidate(uint8_t drive) {
+    mutex_lock(&lock);
+    dentry_t* d = lru_head;
+    while (d) {
+        dentry_t* next = d->next;
+        if (d->drive == drive) dentry_free(d);
+        d = next;
+    }
+    mutex_unlock(&lock);
+}
+
+void dcache_get_stats(dcache_stats_t* st) {
+    mutex_lock(&lock);
+    *st = stats;
+    mutex_unlock(&lock);
+}
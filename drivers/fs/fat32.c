@@ -1,6 +1,8 @@
 // from github
 #include <fat32.h>
-#include <ata.h>
+#include <block.h>
+#include <bcache.h>
+#include <dcache.h>
 #include <vga.h>
 #include <debug.h>
 #include <string.h>
@@ -27,13 +29,57 @@ static uint32_t partition_lba       = 0;  // LBA начала раздела
 /* Hint for fast search for free clusters */
 static uint32_t next_free_hint      = 3;
 
-/* Cache of one FAT sector for speeding up get_next_cluster */
-static uint32_t cached_fat_sector   = 0xFFFFFFFF;
-static uint8_t  fat_cache[512];
+/* Копия первой FAT в памяти и карта свободных кластеров. Для FAT больше
+ * FAT_MEM_MAX таблица остаётся на диске и читается через кеш буферов. */
+#define FAT_MEM_MAX (4u * 1024 * 1024)
+static uint32_t *fat_table          = NULL;
+static uint32_t *free_map           = NULL;  // бит на кластер, 1 — свободен
+static uint8_t  *fat_dirty          = NULL;  // байт на сектор FAT, 1 — изменён
+static uint32_t fat_dirty_lo        = 0xFFFFFFFF;
+static uint32_t fat_dirty_hi        = 0;
+static uint32_t free_clusters       = 0;
+static int      free_known          = 0;     // free_clusters достоверен
+
+/* FSInfo: число свободных кластеров и подсказка, где искать следующий */
+#define FSINFO_LEAD_SIG   0x41615252
+#define FSINFO_STRUCT_SIG 0x61417272
+#define FSINFO_TRAIL_SIG  0xAA550000
+static uint32_t fsinfo_lba          = 0;     // 0 — FSInfo нет
+static int      fsinfo_dirty        = 0;
 
 /* Forward declarations for helpers located later in this file */
 static uint32_t find_free_cluster(uint8_t drive);
+static uint32_t find_free_run(uint8_t drive, uint32_t goal, uint32_t want, uint32_t *got);
 static int      fat_write_fat_entry(uint8_t drive, uint32_t cluster, uint32_t value);
+static void     fat_load(uint8_t drive);
+static void     fsinfo_read(uint8_t drive);
+static int      fsinfo_write(uint8_t drive);
+static int      fat_flush(uint8_t drive);
+static int      create_file(uint8_t drive, uint32_t dir, const char* name);
+
+/* Доступ к диску через блочный слой; drive — индекс блочного устройства.
+ * Одиночные сектора (FAT, каталоги, загрузочный сектор) идут через кеш
+ * буферов, запись — отложенная; многосекторные передачи идут мимо кеша. */
+static int disk_read(uint8_t drive, uint32_t lba, uint32_t count, void *buf) {
+    block_device_t *dev = block_get(drive);
+    if (count != 1) return block_read(dev, lba, count, buf);
+    buf_t *b = bcache_read(dev, lba);
+    if (!b) return -1;
+    memcpy(buf, b->data, 512);
+    bcache_release(b);
+    return 0;
+}
+
+static int disk_write(uint8_t drive, uint32_t lba, uint32_t count, const void *buf) {
+    block_device_t *dev = block_get(drive);
+    if (count != 1) return block_write(dev, lba, count, buf);
+    buf_t *b = bcache_get(dev, lba);
+    if (!b) return -1;
+    memcpy(b->data, buf, 512);
+    bcache_dirty(b);
+    bcache_release(b);
+    return 0;
+}
 
 // ------------------------------------------------------------------
 static char toupper_ascii(char c) {
@@ -117,9 +163,10 @@ static void shortname_to_string(const char in[11], char *out) {
 int fat32_mount(uint8_t drive) {
     uint8_t *sector = kmalloc(512);
     if (!sector) return -1;
+    dcache_invalidate(drive);
     
     // Читаем MBR (сектор 0)
-    if (ata_read_sector(drive, 0, sector)!=0) { kfree(sector); return -2; }
+    if (disk_read(drive, 0, 1, sector)!=0) { kfree(sector); return -2; }
     
     // Проверяем сигнатуру MBR
     if (sector[0x1FE] != 0x55 || sector[0x1FF] != 0xAA) {
@@ -128,32 +175,38 @@ int fat32_mount(uint8_t drive) {
         return -3;
     }
     
-    // Ищем активный раздел FAT32
-    uint32_t partition_lba = 0;
-    for (int i = 0; i < 4; i++) {
-        int offset = 0x1BE + i * 16;
-        uint8_t status = sector[offset];
-        uint8_t type = sector[offset + 4];
-        
-        kdbg(KINFO, "fat32_mount: partition %d: status=0x%02X, type=0x%02X\n", i, status, type);
+    // Раздел, смонтированный напрямую (или диск без таблицы разделов),
+    // начинается с загрузочного сектора FAT32
+    uint32_t volume_lba = 0;
+    if (memcmp(&sector[82], "FAT32   ", 8) == 0) {
+        kdbg(KINFO, "fat32_mount: volume starts at LBA 0\n");
+    } else {
+        // Ищем раздел FAT32
+        for (int i = 0; i < 4; i++) {
+            int offset = 0x1BE + i * 16;
+            uint8_t status = sector[offset];
+            uint8_t type = sector[offset + 4];
+            
+            kdbg(KINFO, "fat32_mount: partition %d: status=0x%02X, type=0x%02X\n", i, status, type);
+            
+            // Проверяем что раздел имеет тип FAT32 (не обязательно активный)
+            if (type == 0x0B || type == 0x0C) {
+                // Читаем LBA первого сектора раздела
+                volume_lba = *(uint32_t*)(&sector[offset + 8]);
+                kdbg(KINFO, "fat32_mount: found fat32 partition at LBA %u\n", volume_lba);
+                break;
+            }
+        }
         
-        // Проверяем что раздел имеет тип FAT32 (не обязательно активный)
-        if (type == 0x0B || type == 0x0C) {
-            // Читаем LBA первого сектора раздела
-            partition_lba = *(uint32_t*)(&sector[offset + 8]);
-            kdbg(KINFO, "fat32_mount: found fat32 partition at LBA %u\n", partition_lba);
-            break;
+        if (volume_lba == 0) {
+            kfree(sector); 
+            kdbg(KERR, "fat32_mount: no fat32 partition found\n"); 
+            return -4;
         }
     }
     
-    if (partition_lba == 0) {
-        kfree(sector); 
-        kdbg(KERR, "fat32_mount: no fat32 partition found\n"); 
-        return -4;
-    }
-    
     // Читаем загрузочный сектор раздела
-    if (ata_read_sector(drive, partition_lba, sector)!=0) { kfree(sector); return -5; }
+    if (disk_read(drive, volume_lba, 1, sector)!=0) { kfree(sector); return -5; }
     
     // Проверяем сигнатуру загрузочного сектора
     if (sector[0x1FE] != 0x55 || sector[0x1FF] != 0xAA) {
@@ -165,9 +218,10 @@ int fat32_mount(uint8_t drive) {
     memcpy(&fat32_bpb, sector, sizeof(fat32_bpb)); /* dst=bpb, src=sector */
 
     if (fat32_bpb.table_size_32==0) { kfree(sector); kdbg(KERR, "fat32_mount: table_size_32 is 0\n"); return -7; }
+    partition_lba       = volume_lba;
     sectors_per_fat     = fat32_bpb.table_size_32;
     fat_start           = fat32_bpb.reserved_sector_count;
-    cluster_begin_lba   = partition_lba + fat_start + fat32_bpb.table_count * sectors_per_fat;
+    cluster_begin_lba   = fat_start + fat32_bpb.table_count * sectors_per_fat; // от начала раздела
     root_dir_first_cluster = fat32_bpb.root_cluster ? fat32_bpb.root_cluster : 2;
     current_dir_cluster = root_dir_first_cluster;
 
@@ -180,10 +234,15 @@ int fat32_mount(uint8_t drive) {
     /* количество доступных кластеров на разделе */
     uint32_t data_sectors = fat32_bpb.total_sectors_32 - cluster_begin_lba;
     total_clusters = data_sectors / fat32_bpb.sectors_per_cluster;
+    /* кластеры, которым нет места в FAT, использовать нельзя */
+    if (total_clusters > sectors_per_fat * 128 - 2) total_clusters = sectors_per_fat * 128 - 2;
 
     kfree(sector);
-    cached_fat_sector = 0xFFFFFFFF; // сброс кеша
-    next_free_hint    = 3;          // сброс hint-указателя
+    fsinfo_read(drive);
+    fat_load(drive);
+    /* исправленный счётчик пишем сразу, а не при первой записи на том */
+    if (fsinfo_dirty && fsinfo_write(drive) != 0)
+        kdbg(KWARN, "fat32: fsinfo update failed\n");
 
     return 0;
 }
@@ -193,85 +252,134 @@ uint32_t fat32_cluster_to_lba(uint32_t cluster) {
 }
 
 uint32_t fat32_get_next_cluster(uint8_t drive, uint32_t cluster) {
+    if (fat_table)
+        return cluster < total_clusters + 2 ? fat_table[cluster] & 0x0FFFFFFF : 0x0FFFFFFF;
+
     uint32_t fat_offset = cluster * 4;               // 4 байта на запись
     uint32_t fat_sector = partition_lba + fat_start + (fat_offset / 512);
     uint32_t ent_offset = fat_offset % 512;
 
-    if (fat_sector != cached_fat_sector) {
-        if (ata_read_sector(drive, fat_sector, fat_cache)!=0)
-            return 0x0FFFFFFF; // ошибка
-        cached_fat_sector = fat_sector;
-    }
-    uint32_t next = *(uint32_t*)(&fat_cache[ent_offset]) & 0x0FFFFFFF;
+    buf_t *b = bcache_read(block_get(drive), fat_sector);
+    if (!b) return 0x0FFFFFFF; // ошибка
+    uint32_t next = *(uint32_t*)(&b->data[ent_offset]) & 0x0FFFFFFF;
+    bcache_release(b);
     return next;
 }
 
 /* ------------------------------------------------------------------
  *            ЧТЕНИЕ КАТАЛОГА (с построением LFN)
  * ----------------------------------------------------------------*/
-int fat32_list_dir(uint8_t drive, uint32_t cluster,
-                   fat32_entry_t* out, int max_entries) {
-    uint8_t *sector = kmalloc(512);
-    if (!sector) return -1;
-    int count = 0;
-
-    char lfn_parts[20][14]; // до 20 частей х 13 символов = 260
-    int  lfn_present = 0;
-
-    uint32_t cl = cluster;
-    while (cl < 0x0FFFFFF8) {
-        for (uint8_t s=0; s<fat32_bpb.sectors_per_cluster; s++) {
-            uint32_t lba = fat32_cluster_to_lba(cl)+s;
-            if (ata_read_sector(drive, lba, sector)!=0) { kfree(sector); return -2; }
+/* ------------------------- Итератор каталога -------------------------*/
+static void dir_unpin(fat32_dir_t *d) {
+    if (d->buf) bcache_release(d->buf);
+    d->buf = NULL;
+}
 
-            for (int off=0; off<512; off+=32) {
-                fat32_dir_entry_t *ent = (fat32_dir_entry_t*)&sector[off];
-                if (ent->name[0]==0x00) { kfree(sector); return count; }
-                if (ent->attr==0x0F) {
-                    fat32_lfn_entry_t *lfn = (fat32_lfn_entry_t*)ent;
-                    int ord = lfn->order & 0x1F;    // 1..N
-                    if (lfn->order & 0x40) {
-                        /* это начало новой цепочки LFN – очищаем буфер */
-                        memset(lfn_parts, 0, sizeof(lfn_parts));
-                    }
-                    if (ord>0 && ord<=20) {
-                        lfn_copy_part(lfn_parts[ord-1], lfn);
-                        if (lfn->order & 0x40) lfn_present = ord; // последний элемент
-                    }
-                    continue;
-                }
-                if (ent->name[0]==0xE5) { lfn_present=0; continue; } // удалённая
-                if ((ent->attr & 0x08)==0x08) { lfn_present=0; continue; } // volume label
-                if (count>=max_entries) { kfree(sector); return count; }
+int fat32_opendir(uint8_t drive, uint32_t cluster, fat32_dir_t *d) {
+    if (!d || !fat32_bpb.sectors_per_cluster) return -1;
+    memset(d, 0, sizeof(*d));
+    d->drive = drive;
+    d->first_cluster = cluster ? cluster : root_dir_first_cluster;
+    d->cluster = d->first_cluster;
+    return 0;
+}
 
-                // --- заполняем выходную структуру ---
-                fat32_entry_t *dst = &out[count];
-                memset(dst,0,sizeof(*dst));
-                if (lfn_present) {
-                    /* склеиваем части LFN в правильном порядке */
-                    dst->name[0] = '\0';
-                    for (int i = lfn_present - 1; i >= 0; i--) {
-                        int len = strlen(lfn_parts[i]);
-                        int pos = strlen(dst->name);
-                        for(int k=0;k<len && pos < FAT32_MAX_NAME; k++)
-                            dst->name[pos++] = lfn_parts[i][k];
-                        dst->name[pos] = '\0';
-                    }
-                } else {
-                    shortname_to_string(ent->name, dst->name);
-                }
-                dst->attr = ent->attr;
-                dst->first_cluster = ((uint32_t)ent->first_cluster_high<<16) | ent->first_cluster_low;
-                dst->size = ent->file_size;
+int fat32_readdir(fat32_dir_t *d, fat32_entry_t *out) {
+    uint32_t per_cluster = fat32_bpb.sectors_per_cluster * 16;
+    while (!d->end) {
+        if (d->cluster < 2 || d->cluster >= 0x0FFFFFF7) { d->end = 1; break; }
+        uint32_t slot = d->pos % per_cluster;
+        uint32_t lba = fat32_cluster_to_lba(d->cluster) + slot / 16;
+        /* сектор держим закреплённым, пока не дойдём до следующего */
+        if (!d->buf || d->buf_lba != lba) {
+            dir_unpin(d);
+            if (!(d->buf = bcache_read(block_get(d->drive), lba))) return -2;
+            d->buf_lba = lba;
+        }
+        uint16_t off = (slot % 16) * 32;
+        fat32_dir_entry_t *ent = (fat32_dir_entry_t*)&d->buf->data[off];
+        if (ent->name[0]==0x00) { d->end = 1; break; }
+        d->pos++;
+        if (d->pos % per_cluster == 0) d->cluster = fat32_get_next_cluster(d->drive, d->cluster);
 
-                count++;
-                lfn_present = 0; // сброс для следующего файла
+        /* удалённая, в том числе запись LFN (у неё 0xE5 — порядковый байт) */
+        if ((uint8_t)ent->name[0]==0xE5) { d->lfn_present=0; continue; }
+        if (ent->attr==0x0F) {
+            fat32_lfn_entry_t *lfn = (fat32_lfn_entry_t*)ent;
+            int ord = lfn->order & 0x1F;    // 1..N
+            if (lfn->order & 0x40) {
+                /* это начало новой цепочки LFN – очищаем буфер */
+                memset(d->lfn, 0, sizeof(d->lfn));
+                d->lfn_sum = lfn->checksum;
+            } else if (lfn->checksum != d->lfn_sum) {
+                d->lfn_present = 0;     // осколок другой цепочки
+            }
+            if (ord>0 && ord<=20) {
+                lfn_copy_part(d->lfn[ord-1], lfn);
+                if (lfn->order & 0x40) d->lfn_present = ord; // последний элемент
             }
+            continue;
         }
-        cl = fat32_get_next_cluster(drive, cl);
+        if ((ent->attr & 0x08)==0x08) { d->lfn_present=0; continue; } // volume label
+
+        // --- заполняем выходную структуру ---
+        memset(out,0,sizeof(*out));
+        /* цепочка LFN, оставшаяся от другой записи, сюда не относится */
+        if (d->lfn_present && shortname_checksum(ent->name) != d->lfn_sum) d->lfn_present = 0;
+        if (d->lfn_present) {
+            /* склеиваем части LFN в правильном порядке */
+            int pos = 0;
+            for (int i = d->lfn_present - 1; i >= 0; i--)
+                for (int k=0; d->lfn[i][k] && pos < FAT32_MAX_NAME; k++)
+                    out->name[pos++] = d->lfn[i][k];
+            out->name[pos] = '\0';
+        } else {
+            shortname_to_string(ent->name, out->name);
+        }
+        out->attr = ent->attr;
+        out->first_cluster = ((uint32_t)ent->first_cluster_high<<16) | ent->first_cluster_low;
+        out->size = ent->file_size;
+        out->dir_lba = lba;
+        out->dir_off = off;
+        d->lfn_present = 0; // сброс для следующего файла
+        return 1;
     }
-    kfree(sector);
-    return count;
+    dir_unpin(d);
+    return 0;
+}
+
+uint32_t fat32_telldir(const fat32_dir_t *d) {
+    return d->pos;
+}
+
+/* pos из telldir — всегда граница между записями, LFN собирать заново */
+void fat32_seekdir(fat32_dir_t *d, uint32_t pos) {
+    uint32_t per_cluster = fat32_bpb.sectors_per_cluster * 16;
+    dir_unpin(d);
+    d->cluster = d->first_cluster;
+    for (uint32_t n = pos / per_cluster; n && d->cluster >= 2 && d->cluster < 0x0FFFFFF7; n--)
+        d->cluster = fat32_get_next_cluster(d->drive, d->cluster);
+    d->pos = pos;
+    d->end = 0;
+    d->lfn_present = 0;
+}
+
+void fat32_closedir(fat32_dir_t *d) {
+    dir_unpin(d);
+    d->end = 1;
+}
+
+int fat32_list_dir(uint8_t drive, uint32_t cluster,
+                   fat32_entry_t* out, int max_entries) {
+    fat32_dir_t *d = kmalloc(sizeof(fat32_dir_t));
+    if (!d) return -1;
+    if (fat32_opendir(drive, cluster, d) != 0) { kfree(d); return -1; }
+    int count = 0, r = 1;
+    while (count < max_entries && (r = fat32_readdir(d, &out[count])) == 1)
+        count++;
+    fat32_closedir(d);
+    kfree(d);
+    return r < 0 ? r : count;
 }
 
 /* Упрощённая обёртка для совместимости: возвращаем только короткие записи
@@ -286,11 +394,11 @@ int fat32_read_dir(uint8_t drive, uint32_t cluster,
     while (cl < 0x0FFFFFF8) {
         for (uint8_t s=0; s<fat32_bpb.sectors_per_cluster; s++) {
             uint32_t lba = fat32_cluster_to_lba(cl)+s;
-            if (ata_read_sector(drive, lba, sector)!=0) { kfree(sector); return -2; }
+            if (disk_read(drive, lba, 1, sector)!=0) { kfree(sector); return -2; }
             for (int off=0; off<512; off+=32) {
                 fat32_dir_entry_t *ent = (fat32_dir_entry_t*)&sector[off];
                 if (ent->name[0]==0x00) { kfree(sector); return count; }
-                if (ent->attr==0x0F || ent->name[0]==0xE5) continue; // пропускаем LFN и удалённые
+                if (ent->attr==0x0F || (uint8_t)ent->name[0]==0xE5) continue; // пропускаем LFN и удалённые
                 if (count>=max_entries) { kfree(sector); return count; }
                 /* копируем 32-байтную запись в выходной массив (src,dst) */
                 for (int j=0;j<sizeof(fat32_dir_entry_t);j++)
@@ -304,205 +412,782 @@ int fat32_read_dir(uint8_t drive, uint32_t cluster,
     return count;
 }
 
+/* ----------------------- Поиск имени в каталоге -----------------------*/
+/* Пройти каталог, складывая записи в кеш dentry, до записи с именем name
+ * или подкаталога с кластером cluster (name == NULL). Каталог, прочитанный
+ * до конца без находки, даёт отрицательную запись для name. 0 — найдено. */
+static int dir_scan(uint8_t drive, uint32_t dir, const char *name, uint32_t cluster, fat32_entry_t *out){
+    fat32_dir_t *d = kmalloc(sizeof(fat32_dir_t));
+    fat32_entry_t *e = kmalloc(sizeof(fat32_entry_t));
+    if(!d || !e || fat32_opendir(drive, dir, d)!=0){ kfree(d); kfree(e); return -1; }
+    int r, found = 0;
+    while(!found && (r = fat32_readdir(d, e)) == 1){
+        dcache_add(drive, dir, e);
+        if(name) found = strcasecmp_ascii(e->name, name)==0;
+        else found = (e->attr & 0x10) && e->first_cluster==cluster &&
+                     strcmp(e->name, ".")!=0 && strcmp(e->name, "..")!=0;
+    }
+    if(found && out) *out = *e;
+    if(!found && name && r == 0) dcache_add_negative(drive, dir, name);
+    fat32_closedir(d);
+    kfree(d);
+    kfree(e);
+    return found ? 0 : -1;
+}
+
+/* запись name каталога dir: из кеша dentry, диск — только при промахе */
+static int dir_lookup(uint8_t drive, uint32_t dir, const char *name, fat32_entry_t *out){
+    int rc = dcache_lookup(drive, dir, name, out);
+    if(rc >= 0) return rc ? 0 : -1;
+    return dir_scan(drive, dir, name, 0, out);
+}
+
+int fat32_dir_name(uint8_t drive, uint32_t cluster, uint32_t *parent, char *name, int size){
+    if(cluster < 2 || cluster == root_dir_first_cluster) return -1;
+    fat32_entry_t *e = kmalloc(sizeof(fat32_entry_t));
+    if(!e) return -1;
+    uint32_t p;
+    /* родитель — из записи "..", 0 в ней означает корень */
+    if(dir_lookup(drive, cluster, "..", e) != 0) { kfree(e); return -1; }
+    p = e->first_cluster ? e->first_cluster : root_dir_first_cluster;
+    if(dcache_lookup_dir(drive, cluster, NULL, e) < 0 && dir_scan(drive, p, NULL, cluster, e) != 0){
+        kfree(e);
+        return -1;
+    }
+    if(parent) *parent = p;
+    if(name && size > 0){
+        strncpy(name, e->name, size - 1);
+        name[size - 1] = '\0';
+    }
+    kfree(e);
+    return 0;
+}
+
+/* ------------------- Векторный ввод-вывод данных файла -------------------*/
+typedef struct {
+    const iovec_t *iov;
+    int      cnt;
+    int      idx;
+    uint32_t off;
+} fat_cursor_t;
+
+static void cursor_advance(fat_cursor_t *c, uint32_t n) {
+    while (n && c->idx < c->cnt) {
+        uint32_t left = c->iov[c->idx].len - c->off;
+        uint32_t k = left < n ? left : n;
+        c->off += k;
+        n -= k;
+        if (c->off == c->iov[c->idx].len) { c->idx++; c->off = 0; }
+    }
+}
+
+/* копирование между буфером и вектором: to_iov=1 — в вектор, 0 — из него */
+static void cursor_copy(fat_cursor_t *c, uint8_t *p, uint32_t n, int to_iov) {
+    while (n && c->idx < c->cnt) {
+        uint32_t left = c->iov[c->idx].len - c->off;
+        uint32_t k = left < n ? left : n;
+        uint8_t *base = (uint8_t*)c->iov[c->idx].base + c->off;
+        if (to_iov) memcpy(base, p, k); else memcpy(p, base, k);
+        p += k;
+        n -= k;
+        cursor_advance(c, k);
+    }
+}
+
+/* ----------------------- Карта экстентов файла ------------------------*/
+void fat32_extmap_init(fat32_extmap_t *m, uint8_t drive, uint32_t first_cluster) {
+    memset(m, 0, sizeof(*m));
+    m->drive = drive;
+    m->first_cluster = first_cluster;
+    m->complete = first_cluster < 2;
+}
+
+void fat32_extmap_free(fat32_extmap_t *m) {
+    kfree(m->ext);
+    fat32_extmap_init(m, m->drive, m->first_cluster);
+}
+
+/* следующий кластер цепочки в конец карты: продолжает последний экстент
+ * или открывает новый */
+static int extmap_push(fat32_extmap_t *m, uint32_t cluster) {
+    fat32_extent_t *last = m->count ? &m->ext[m->count - 1] : NULL;
+    if (last && last->disk_cluster + last->length == cluster) {
+        last->length++;
+        m->mapped++;
+        return 0;
+    }
+    if (m->count == m->cap) {
+        int cap = m->cap ? m->cap * 2 : 8;
+        fat32_extent_t *e = krealloc(m->ext, cap * sizeof(fat32_extent_t));
+        if (!e) return -1;
+        m->ext = e;
+        m->cap = cap;
+    }
+    m->ext[m->count].file_cluster = m->mapped;
+    m->ext[m->count].disk_cluster = cluster;
+    m->ext[m->count].length = 1;
+    m->count++;
+    m->mapped++;
+    return 0;
+}
+
+/* дочитать цепочку из FAT, пока не отображено want кластеров или не конец;
+ * зацикленная цепочка обрывается на total_clusters */
+static int extmap_extend(fat32_extmap_t *m, uint32_t want) {
+    while (!m->complete && m->mapped < want) {
+        uint32_t cl = m->first_cluster;
+        if (m->mapped) {
+            fat32_extent_t *last = &m->ext[m->count - 1];
+            cl = fat32_get_next_cluster(m->drive, last->disk_cluster + last->length - 1);
+        }
+        if (cl < 2 || cl >= 0x0FFFFFF7 ||
+            (total_clusters && (cl >= total_clusters + 2 || m->mapped >= total_clusters))) {
+            m->complete = 1;
+            break;
+        }
+        if (extmap_push(m, cl) != 0) return -1;
+    }
+    return 0;
+}
+
+/* Кластер диска для кластера fc файла и в *run — сколько кластеров подряд
+ * от него; 0, если цепочка короче. Двоичный поиск по экстентам. */
+static uint32_t extmap_lookup(fat32_extmap_t *m, uint32_t fc, uint32_t *run) {
+    if (fc >= m->mapped && (extmap_extend(m, fc + 1) != 0 || fc >= m->mapped)) return 0;
+    int lo = 0, hi = m->count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (m->ext[mid].file_cluster <= fc) lo = mid;
+        else hi = mid - 1;
+    }
+    fat32_extent_t *e = &m->ext[lo];
+    if (run) *run = e->length - (fc - e->file_cluster);
+    return e->disk_cluster + (fc - e->file_cluster);
+}
+
+/* Передача iov_total(iov) байт с позиции offset файла по его карте.
+ * Каждый экстент — одна команда; целые сектора идут
+ * прямо в память вызывающего, через промежуточный сектор — только края,
+ * не выровненные на 512, и сектора на стыке сегментов вектора.
+ * Для записи цепочка должна быть уже достаточно длинной.
+ * Возвращает число байт (меньше при конце цепочки) или <0. */
+static int fat_xfer(fat32_extmap_t *map, uint32_t offset,
+                    const iovec_t *iov, int iovcnt, int write) {
+    uint32_t cluster_bytes = fat32_bpb.sectors_per_cluster * 512;
+    uint8_t drive = map->drive;
+    block_device_t *dev = block_get(drive);
+    if (map->first_cluster < 2 || !cluster_bytes || !dev) return -1;
+    uint64_t want = iov_total(iov, iovcnt);
+    uint32_t size = want > 0x7FFFFFFF ? 0x7FFFFFFF : (uint32_t)want;
+
+    /* карта сразу до конца запроса, чтобы экстенты не дробились */
+    uint32_t fc = offset / cluster_bytes;
+    uint32_t within = offset % cluster_bytes;
+    if (extmap_extend(map, (uint32_t)(((uint64_t)offset + size + cluster_bytes - 1) / cluster_bytes)) != 0)
+        return -2;
+
+    fat_cursor_t cur = { iov, iovcnt, 0, 0 };
+    iovec_t seg[BLOCK_MAX_SEGMENTS];
+    uint8_t *bounce = NULL;
+    uint32_t total = 0;
+    int rc = 0;
+    while (total < size) {
+        uint32_t run;
+        uint32_t first = extmap_lookup(map, fc, &run);
+        if (!first) break;
+
+        uint32_t lba = fat32_cluster_to_lba(first) + within / 512;
+        uint32_t sec_off = within % 512;
+        uint64_t span = (uint64_t)run * cluster_bytes - within;
+        uint32_t bytes = span > size - total ? size - total : (uint32_t)span;
+        while (bytes) {
+            /* выровненные целые сектора — сегментами прямо из вектора */
+            int n = 0;
+            uint32_t direct = 0;
+            while (!sec_off && n < BLOCK_MAX_SEGMENTS && bytes - direct >= 512 && cur.idx < cur.cnt) {
+                uint32_t left = cur.iov[cur.idx].len - cur.off;
+                uint32_t take = (left < bytes - direct ? left : bytes - direct) & ~511u;
+                if (!take) break;
+                seg[n].base = (uint8_t*)cur.iov[cur.idx].base + cur.off;
+                seg[n].len  = take;
+                n++;
+                direct += take;
+                cursor_advance(&cur, take);
+            }
+            if (n) {
+                if (block_submit(dev, lba, seg, n, write) != 0) { rc = -3; goto out; }
+                lba += direct / 512; bytes -= direct; total += direct;
+                continue;
+            }
+
+            /* один сектор через промежуточный буфер */
+            if (!bounce && !(bounce = kmalloc(512))) { rc = -2; goto out; }
+            uint32_t chunk = 512 - sec_off;
+            if (chunk > bytes) chunk = bytes;
+            if ((!write || chunk < 512) && disk_read(drive, lba, 1, bounce) != 0) { rc = -3; goto out; }
+            if (write) {
+                cursor_copy(&cur, bounce + sec_off, chunk, 0);
+                if (disk_write(drive, lba, 1, bounce) != 0) { rc = -3; goto out; }
+            } else {
+                cursor_copy(&cur, bounce + sec_off, chunk, 1);
+            }
+            lba++; bytes -= chunk; total += chunk;
+            sec_off = 0;
+        }
+        within = 0;
+        fc += run;
+    }
+out:
+    kfree(bounce);
+    return rc ? rc : (int)total;
+}
+
+int fat32_readv(uint8_t drive, uint32_t first_cluster, uint32_t offset,
+                const iovec_t* iov, int iovcnt) {
+    fat32_extmap_t map;
+    fat32_extmap_init(&map, drive, first_cluster);
+    int rc = fat_xfer(&map, offset, iov, iovcnt, 0);
+    fat32_extmap_free(&map);
+    return rc;
+}
+
+/* ------------------------ Упреждающее чтение --------------------------*/
+void fat32_ra_init(fat32_ra_t *ra, uint8_t drive, uint32_t first_cluster, uint32_t size) {
+    memset(ra, 0, sizeof(*ra));
+    ra->drive = drive;
+    ra->first_cluster = first_cluster;
+    ra->size = size;
+    fat32_extmap_init(&ra->map, drive, first_cluster);
+}
+
+static void ra_wait(fat32_ra_win_t *w) {
+    if (w->busy) {
+        w->status = bio_wait(&w->bio);
+        w->busy = 0;
+    }
+}
+
+/* Запустить чтение окна с pos (кратно 512) длиной до bytes. Окно — один
+ * непрерывный участок диска, поэтому одна команда; len 0 — конец файла. */
+static void ra_fill(fat32_ra_t *ra, fat32_ra_win_t *w, uint32_t pos, uint32_t bytes) {
+    uint32_t cluster_bytes = fat32_bpb.sectors_per_cluster * 512;
+    ra_wait(w);
+    w->start = pos;
+    w->len = 0;
+    w->status = 0;
+    if (!cluster_bytes || (ra->size && pos >= ra->size)) return;
+    if (!w->data && !(w->data = kmalloc(FAT32_RA_MAX))) { w->status = -2; return; }
+    if (bytes > FAT32_RA_MAX) bytes = FAT32_RA_MAX;
+    if (ra->size && bytes > ra->size - pos) bytes = (ra->size - pos + 511) & ~511u;
+
+    uint32_t within = pos % cluster_bytes, run;
+    if (extmap_extend(&ra->map, (uint32_t)(((uint64_t)pos + bytes + cluster_bytes - 1) / cluster_bytes)) != 0) {
+        w->status = -2;
+        return;
+    }
+    uint32_t first = extmap_lookup(&ra->map, pos / cluster_bytes, &run);
+    if (!first) return;
+    uint64_t span = (uint64_t)run * cluster_bytes - within;
+    uint32_t len = span > bytes ? bytes : (uint32_t)span;
+
+    w->len = len;
+    w->iov.base = w->data;
+    w->iov.len = len;
+    bio_init(&w->bio, block_get(ra->drive), fat32_cluster_to_lba(first) + within / 512, &w->iov, 1, 0);
+    w->busy = 1;
+    block_submit_bio(&w->bio);
+}
+
+static fat32_ra_win_t *ra_find(fat32_ra_t *ra, uint32_t pos) {
+    for (int i = 0; i < 2; i++) {
+        fat32_ra_win_t *w = &ra->win[i];
+        if (w->len && w->start <= pos && pos - w->start < w->len) return w;
+    }
+    return NULL;
+}
+
+int fat32_read_ra(fat32_ra_t *ra, uint32_t offset, const iovec_t *iov, int iovcnt) {
+    if (ra->first_cluster < 2) return -1;
+    uint64_t want = iov_total(iov, iovcnt);
+    if (ra->size) {
+        if (offset >= ra->size) return 0;
+        if (want > ra->size - offset) want = ra->size - offset;
+    }
+    if (want > 0x7FFFFFFF) want = 0x7FFFFFFF;
+
+    /* последовательное чтение удваивает окно, переход на другое место сбрасывает */
+    if (offset == ra->next)
+        ra->window = !ra->window ? FAT32_RA_MIN : ra->window * 2 > FAT32_RA_MAX ? FAT32_RA_MAX : ra->window * 2;
+    else
+        ra->window = 0;
+
+    fat_cursor_t cur = { iov, iovcnt, 0, 0 };
+    uint32_t pos = offset, done = 0;
+    int rc = 0;
+    while (done < want) {
+        fat32_ra_win_t *w = ra_find(ra, pos);
+        if (!w) {
+            /* промах: читаем сами, сколько просили, но не меньше окна */
+            w = ra->win[0].busy && !ra->win[1].busy ? &ra->win[1] : &ra->win[0];
+            uint32_t need = (pos % 512 + (uint32_t)(want - done) + 511) & ~511u;
+            ra_fill(ra, w, pos & ~511u, need > ra->window ? need : ra->window);
+            if (!w->len) { rc = w->status; break; }
+        }
+        ra_wait(w);
+        if (w->status) {
+            w->len = 0;
+            rc = -3;
+            break;
+        }
+        uint32_t n = w->start + w->len - pos;
+        if (n > want - done) n = want - done;
+        cursor_copy(&cur, w->data + (pos - w->start), n, 1);
+        pos += n;
+        done += n;
+
+        /* пока вызывающий работает с этим окном, следующее уже читается */
+        fat32_ra_win_t *o = (w == &ra->win[0]) ? &ra->win[1] : &ra->win[0];
+        uint32_t end = w->start + w->len;
+        if (ra->window && !(o->len && o->start == end))
+            ra_fill(ra, o, end, ra->window);
+    }
+    ra->next = pos;
+    return rc ? rc : (int)done;
+}
+
+void fat32_ra_release(fat32_ra_t *ra) {
+    for (int i = 0; i < 2; i++) {
+        ra_wait(&ra->win[i]);
+        kfree(ra->win[i].data);
+        ra->win[i].data = NULL;
+        ra->win[i].len = 0;
+    }
+    fat32_extmap_free(&ra->map);
+}
+
 /* --------------------- Прочитать файл целиком -------------------------*/
 int fat32_read_file(uint8_t drive, uint32_t first_cluster,
                     uint8_t* buf, uint32_t size) {
-    if (first_cluster<2) return -1;
-    uint32_t cluster = first_cluster;
-    uint32_t total   = 0;
-    uint8_t *sector  = kmalloc(512);
-    if (!sector) return -2;
+    iovec_t iov = { buf, size };
+    return fat32_readv(drive, first_cluster, 0, &iov, 1);
+}
 
-    while (cluster < 0x0FFFFFF8 && total < size) {
-        for (uint8_t s=0; s<fat32_bpb.sectors_per_cluster; s++) {
-            uint32_t lba = fat32_cluster_to_lba(cluster)+s;
-            // if (ata_read_sector(drive, lba, sector)!=0) { kfree(sector); return -3; }
-            ata_read_sector(drive, lba, sector);
-            uint32_t copy = (size-total>512)?512:(size-total);
-            memcpy(buf + total, sector, copy);   /* src = sector, dst = buf+total (src,dst,len) */
-            total += copy;
-            if (total>=size) break;
+/* старый stub fat32_create_file удалён */
+
+/* Удлинить цепочку карты до want кластеров участками подряд за её хвостом;
+ * ещё до extra кластеров сверх того — если есть место (преаллокация).
+ * Пустая карта (файл без кластеров) получает first_cluster. */
+static int extmap_grow(fat32_extmap_t *m, uint32_t want, uint32_t extra){
+    uint32_t target = want + extra;
+    if(extmap_extend(m, target)!=0) return -1;
+    while(m->mapped < target){
+        uint32_t tail = 0;
+        if(m->count){
+            fat32_extent_t *last = &m->ext[m->count-1];
+            tail = last->disk_cluster + last->length - 1;
+        }
+        uint32_t got, cl = find_free_run(m->drive, tail + 1, target - m->mapped, &got);
+        if(!cl) return m->mapped >= want ? 0 : -1;
+        for(uint32_t i=0; i<got; i++){
+            /* сначала конец цепочки на новом кластере, потом ссылка на него:
+             * при ошибке цепочка остаётся целой, кластер — свободным */
+            if(fat_write_fat_entry(m->drive, cl + i, 0x0FFFFFFF)!=0) return -1;
+            if(tail && fat_write_fat_entry(m->drive, tail, cl + i)!=0){
+                fat_write_fat_entry(m->drive, cl + i, 0);
+                return -1;
+            }
+            if(!tail) m->first_cluster = cl + i;
+            tail = cl + i;
+            if(extmap_push(m, cl + i)!=0) return -1;
         }
-        cluster = fat32_get_next_cluster(drive, cluster);
     }
-    kfree(sector);
-    return total;
+    return 0;
 }
 
-/* --------------- Заглушки для записи (пока не реализованы) ------------*/
-int fat32_write_file(uint8_t drive, const char* path, const uint8_t* buf, uint32_t size){ (void)drive; (void)path; (void)buf; (void)size; return -1; }
-/* старый stub fat32_create_file удалён */
-int fat32_write_file_data(uint8_t drive,const char*name,const uint8_t*buf,uint32_t size,uint32_t offset){
-    if(!name||!buf||size==0) return -1;
-
-    /* --- ищем файл в текущем каталоге --- */
-    fat32_entry_t *list = kmalloc(64*sizeof(fat32_entry_t));
-    if (!list) return -1;
-    int n = fat32_list_dir(drive, current_dir_cluster, list, 64);
-    int idx=-1;
-    for(int i=0;i<n;i++) if(!(list[i].attr&0x10))
-        if(strcasecmp_ascii(list[i].name,name)==0){ idx=i; break; }
-
-    if(idx==-1){
-        /* создаём файл */
-        if(offset!=0){ return -1; }
-        if(fat32_create_file(drive,name)!=0) {kfree(list); return -1;}
-        n = fat32_list_dir(drive, current_dir_cluster, list, 64);
-        for(int i=0;i<n;i++) if(!(list[i].attr&0x10))
-            if(strcasecmp_ascii(list[i].name,name)==0){ idx=i; break; }
-        if(idx==-1) {kfree(list); return -1;}
-    }
-
-    fat32_entry_t *ent = &list[idx];
-    uint32_t file_size = ent->size;
-    uint32_t first_cluster = ent->first_cluster;
-    if(first_cluster==0){ /* allocate first cluster */
-        uint32_t cl = find_free_cluster(drive);
-        if(!cl) {kfree(list); return -1;}
-        fat_write_fat_entry(drive, cl, 0x0FFFFFFF);
-        first_cluster = cl;
-        ent->first_cluster = cl;
-    }
-
-    /* --- обеспечиваем достаточно кластеров --- */
-    uint32_t cluster_size = fat32_bpb.sectors_per_cluster * 512;
-    if (cluster_size == 0) cluster_size = 512; /* страховка от деления на ноль */
-    uint32_t need_size = offset + size;
-    uint32_t need_clusters = (need_size + cluster_size -1)/cluster_size;
-
-    uint32_t cl = first_cluster; uint32_t chain_len=1;
-    while(1){
-        uint32_t next = fat32_get_next_cluster(drive, cl);
-        if(next>=0x0FFFFFF8) break;
-        chain_len++; cl=next;
+/* Освободить кластеры цепочки после первых keep; при keep 0 — всю цепочку
+ * (вызывающий тогда обнуляет first_cluster в каталоге) */
+static int chain_truncate(uint8_t drive, uint32_t first_cluster, uint32_t keep){
+    if(first_cluster<2) return 0;
+    uint32_t next = first_cluster;
+    if(keep){
+        uint32_t cl = first_cluster;
+        for(uint32_t i=1; i<keep; i++){
+            cl = fat32_get_next_cluster(drive, cl);
+            if(cl<2 || cl>=0x0FFFFFF7) return 0;
+        }
+        next = fat32_get_next_cluster(drive, cl);
+        if(next<2 || next>=0x0FFFFFF7) return 0;
+        if(fat_write_fat_entry(drive, cl, 0x0FFFFFFF)!=0) return -1;
     }
-    while(chain_len<need_clusters){
-        uint32_t newcl = find_free_cluster(drive);
-        if(!newcl) {kfree(list); return -1;}
-        fat_write_fat_entry(drive, cl, newcl);
-        fat_write_fat_entry(drive, newcl, 0x0FFFFFFF);
-        chain_len++; cl=newcl;
+    for(uint32_t n = total_clusters; next>=2 && next<0x0FFFFFF7 && n; n--){
+        uint32_t after = fat32_get_next_cluster(drive, next);
+        if(fat_write_fat_entry(drive, next, 0)!=0) return -1;
+        next = after;
     }
+    return 0;
+}
 
-    /* --- запись --- */
-    uint32_t pos=0; uint32_t cur_off=offset; cl = first_cluster;
-    uint32_t skip = cur_off/cluster_size;
-    for(uint32_t i=0;i<skip;i++){ cl = fat32_get_next_cluster(drive, cl); }
+/* записать размер и первый кластер в SFN-запись файла по её месту */
+static int dir_update_entry(uint8_t drive, uint32_t dir, const fat32_entry_t *ent){
+    if(!ent->dir_lba) return -1;
+    buf_t *b = bcache_read(block_get(drive), ent->dir_lba);
+    if(!b) return -1;
+    fat32_dir_entry_t *e = (fat32_dir_entry_t*)&b->data[ent->dir_off];
+    e->file_size = ent->size;
+    e->first_cluster_high = (ent->first_cluster>>16)&0xFFFF; /* запись SFN всё ещё содержит high/low */
+    e->first_cluster_low = ent->first_cluster & 0xFFFF;
+    bcache_dirty(b);
+    bcache_release(b);
+    dcache_add(drive, dir, ent);
+    return 0;
+}
 
-    uint8_t *sector = kmalloc(512);
-    if (!sector) {kfree(list); return -1;}
-    while(pos<size){
-        uint32_t within = cur_off % cluster_size;
-        uint32_t sec_in_cluster = within / 512;
-        uint32_t sec_off = within % 512;
-        uint32_t lba = fat32_cluster_to_lba(cl)+sec_in_cluster;
-        if(sec_off==0 && (size-pos)>=512){
-            /* можем писать полный сектор */
-            if(ata_write_sector(drive, lba, (uint8_t*)buf+pos)!=0) { kfree(sector); return -1; }
-            pos+=512; cur_off+=512;
-        } else {
-            /* читаем сектор, модифицируем */
-            if(ata_read_sector(drive, lba, sector)!=0) { kfree(sector); return -1; }
-            uint32_t chunk = 512-sec_off; if(chunk>size-pos) chunk=size-pos;
-            /* копируем данные из пользовательского буфера в считанный сектор */
-            memcpy(sector+sec_off, (uint8_t*)buf+pos, chunk);
-            if(ata_write_sector(drive, lba, sector)!=0) { kfree(sector); return -1; }
-            pos+=chunk; cur_off+=chunk;
-        }
-        if((cur_off % cluster_size)==0 && pos<size){
-            cl = fat32_get_next_cluster(drive, cl);
-        }
+/* ------------------------- Открытые файлы ---------------------------*/
+static fat32_file_t open_files[FAT32_MAX_OPEN];
+
+static uint32_t cluster_bytes_of(void){
+    uint32_t cb = fat32_bpb.sectors_per_cluster * 512;
+    return cb ? cb : 512; /* страховка от деления на ноль */
+}
+
+/* окна упреждения могли захватить перезаписываемые данные */
+static void ra_drop(fat32_ra_t *ra){
+    for(int i=0; i<2; i++){
+        ra_wait(&ra->win[i]);
+        ra->win[i].len = 0;
     }
-    kfree(sector);
-    /* --- обновляем размер, если увеличился --- */
-    if(need_size>file_size){
-        ent->size = need_size;
-        /* найти и обновить запись в каталоге (SFN) */
-        uint8_t *sect = kmalloc(512);
-        if (!sect) {kfree(list); return -1;}
-        for(uint8_t sc=0; sc<fat32_bpb.sectors_per_cluster; sc++){
-            uint32_t lba = fat32_cluster_to_lba(current_dir_cluster)+sc;
-            if(ata_read_sector(drive,lba,sect)!=0) { kfree(sect); return -1; }
-            for(int off=0; off<512; off+=32){
-                fat32_dir_entry_t *e = (fat32_dir_entry_t*)&sect[off];
-                if((e->attr&0x0F)==0x0F) continue;
-                char tmp[64]; shortname_to_string(e->name,tmp);
-                if(strcasecmp_ascii(tmp, ent->name)==0){
-                    e->file_size = need_size;
-                    e->first_cluster_high = (first_cluster>>16)&0xFFFF; /* запись SFN всё ещё содержит high/low */
-                    e->first_cluster_low = first_cluster & 0xFFFF;
-                    if(ata_write_sector(drive,lba,sect)!=0) { kfree(sect); return -1; }
-                    sc=0xFF; break;
-                }
-            }
+}
+
+/* Обрезать файл до size байт, освободив кластеры за ним. У пустого файла
+ * кластеров нет вовсе: first_cluster 0, как ждут chkdsk и fsck; первый
+ * кластер выделит следующая запись. Карта экстентов строится заново. */
+static int file_truncate(fat32_file_t *f, uint32_t size){
+    uint32_t cluster_size = cluster_bytes_of();
+    uint32_t keep = (uint32_t)(((uint64_t)size + cluster_size - 1) / cluster_size);
+    if(chain_truncate(f->drive, f->ent.first_cluster, keep) != 0) return -1;
+    uint32_t first = keep ? f->ent.first_cluster : 0;
+    int changed = size != f->ent.size || first != f->ent.first_cluster;
+    f->ent.size = size;
+    f->ent.first_cluster = first;
+    ra_drop(&f->ra);
+    fat32_extmap_free(&f->ra.map);
+    fat32_extmap_init(&f->ra.map, f->drive, first);
+    f->ra.first_cluster = first;
+    f->ra.size = size;
+    if(changed && dir_update_entry(f->drive, f->dir, &f->ent) != 0) return -1;
+    return 0;
+}
+
+/* Дескрипторы не делят между собой запись, карту и упреждение, поэтому
+ * файл открыт либо сколько угодно раз на чтение, либо один раз на запись.
+ * Файл узнаётся по месту его записи в каталоге. */
+static int file_busy(uint8_t drive, const fat32_entry_t *ent, int flags){
+    for(int i=0; i<FAT32_MAX_OPEN; i++){
+        fat32_file_t *o = &open_files[i];
+        if(o->used && o->drive == drive && o->ent.dir_lba == ent->dir_lba &&
+           o->ent.dir_off == ent->dir_off && ((o->flags | flags) & FAT32_O_WRITE))
+            return 1;
+    }
+    return 0;
+}
+
+/* Открыть path; при FAT32_O_CREAT отсутствующий файл создаётся в каталоге
+ * из пути. -1 — нет файла, -2 — это каталог, -4 — файл уже открыт, и это
+ * или прежнее открытие — на запись. */
+static int file_open(fat32_file_t *f, uint8_t drive, const char *path, int flags){
+    fat32_entry_t *ent = kmalloc(sizeof(fat32_entry_t));
+    if(!ent) return -1;
+    uint32_t dir;
+    int r = fat32_lookup(drive, path, ent, &dir);
+    if(r == -1 && (flags & FAT32_O_CREAT)){
+        /* каталог — всё до последнего разделителя ("0:" тоже каталог) */
+        int last = -1;
+        for(int i=0; path[i]; i++) if(path[i]=='/' || path[i]=='\\') last = i;
+        if(last < 0 && path[0] && path[1]==':') last = 1;
+        const char *base = path + last + 1;
+        char *parent = kmalloc(last + 2);
+        if(!parent){ kfree(ent); return -1; }
+        memcpy(parent, path, last + 1);
+        parent[last + 1] = '\0';
+        r = fat32_lookup(drive, parent, ent, NULL);
+        kfree(parent);
+        if(r == 0 && (!*base || !(ent->attr & 0x10))) r = -1;
+        if(r == 0){
+            dir = ent->first_cluster ? ent->first_cluster : root_dir_first_cluster;
+            r = create_file(drive, dir, base);
+            dcache_remove(drive, dir, base);  /* снимает отрицательную запись */
+            if(r == 0) r = dir_lookup(drive, dir, base, ent);
         }
-        kfree(sect);
     }
-    kfree(list);
+    if(r == 0 && (ent->attr & 0x10)) r = -2;
+    if(r == 0 && file_busy(drive, ent, flags)) r = -4;
+    if(r != 0){ kfree(ent); return r; }
 
-    /* --- операция завершена: сброс кеша FAT, чтобы следующие вызовы
-       (например cd) видели уже записанные изменения --- */
-    cached_fat_sector = 0xFFFFFFFF;
-    next_free_hint    = 2;
+    memset(f, 0, sizeof(*f));
+    f->used = 1;
+    f->flags = flags;
+    f->drive = drive;
+    f->dir = dir;
+    f->ent = *ent;
+    kfree(ent);
+    fat32_ra_init(&f->ra, drive, f->ent.first_cluster, f->ent.size);
+    if((flags & FAT32_O_TRUNC) && (flags & FAT32_O_WRITE) &&
+       (f->ent.size || f->ent.first_cluster) && file_truncate(f, 0) != 0){
+        fat32_ra_release(&f->ra);
+        f->used = 0;
+        return -3;
+    }
+    return 0;
+}
 
-    return size;
+static int file_read(fat32_file_t *f, uint32_t offset, const iovec_t *iov, int iovcnt){
+    if(!(f->flags & FAT32_O_READ)) return -1;
+    if(offset >= f->ent.size || f->ent.first_cluster < 2) return 0;
+    uint64_t total = iov_total(iov, iovcnt);
+    uint32_t want = total > f->ent.size - offset ? f->ent.size - offset : (uint32_t)total;
+    if(offset % 512 || want < FAT32_RA_MAX)
+        return fat32_read_ra(&f->ra, offset, iov, iovcnt);
+
+    /* большое выровненное чтение не стоит копировать через окна:
+     * целые кластеры идут прямо в вектор, хвост обрезается по размеру файла */
+    iovec_t *cut = NULL;
+    if(want < total){
+        if(!(cut = kmalloc(iovcnt * sizeof(iovec_t)))) return -2;
+        uint32_t left = want;
+        int n = 0;
+        while(left){
+            cut[n] = iov[n];
+            if(cut[n].len > left) cut[n].len = left;
+            left -= cut[n].len;
+            n++;
+        }
+        iov = cut;
+        iovcnt = n;
+    }
+    int rc = fat_xfer(&f->ra.map, offset, iov, iovcnt, 0);
+    kfree(cut);
+    if(rc > 0) f->ra.next = offset + rc;
+    return rc;
 }
 
-int fat32_read_file_data(uint8_t d,const char*p,uint8_t*b,uint32_t s,uint32_t o){(void)d;(void)p;(void)b;(void)s;(void)o;return -1;}
+static int file_write(fat32_file_t *f, uint32_t offset, const iovec_t *iov, int iovcnt){
+    if(!(f->flags & FAT32_O_WRITE)) return -1;
+    uint64_t want = iov_total(iov, iovcnt);
+    if(want == 0) return 0;
+    if(want > 0x7FFFFFFF || offset + want > 0xFFFFFFFFull) return -1;
+    uint32_t size = (uint32_t)want;
+    uint32_t cluster_size = cluster_bytes_of();
+    uint32_t end = offset + size;
+    uint32_t need = (uint32_t)(((uint64_t)end + cluster_size - 1) / cluster_size);
+    fat32_extmap_t *map = &f->ra.map;
 
-/* -------------------------------------------------------------
- *          Простейшая реализация разрешения пути
- * -----------------------------------------------------------*/
-int fat32_resolve_path(uint8_t drive, const char* path, uint32_t* target_cluster) {
-    if (!path || !target_cluster) return -1;
+    /* файл дописывается потоком: со второго роста кластеры берутся с запасом,
+     * пропорционально размеру; лишнее снимается при закрытии */
+    uint32_t extra = 0;
+    if(offset >= f->ent.size && f->grown && extmap_extend(map, need) == 0 && map->mapped < need){
+        extra = need;
+        if(extra > FAT32_PREALLOC_MAX / cluster_size) extra = FAT32_PREALLOC_MAX / cluster_size;
+    }
+    uint32_t first = f->ent.first_cluster;
+    if(extmap_grow(map, need, extra) != 0) return -1;
+    if(extra) f->prealloc = 1;
+    ra_drop(&f->ra);
 
-    /* Снимаем возможный префикс "X:\" или "X:/" (номер диска) */
-    if (path[1] == ':' && (path[2] == '\\' || path[2] == '/')) {
-        /* если после префикса ничего нет – это корень */
-        if (path[3] == '\0') {
-            *target_cluster = root_dir_first_cluster;
-            return 0;
+    /* дыр в FAT нет: от старого конца до offset пишутся нули */
+    if(offset > f->ent.size){
+        uint8_t *zero = kmalloc(4096);
+        if(!zero) return -2;
+        memset(zero, 0, 4096);
+        for(uint32_t pos = f->ent.size; pos < offset; ){
+            iovec_t z = { zero, offset - pos < 4096 ? offset - pos : 4096 };
+            if(fat_xfer(map, pos, &z, 1, 1) != (int)z.len){ kfree(zero); return -3; }
+            pos += z.len;
         }
-        /* пропускаем "X:\" */
-        path += 3;
+        kfree(zero);
     }
+    if(fat_xfer(map, offset, iov, iovcnt, 1) != (int)size) return -3;
 
-    /* Абсолютный корень */
-    if ((path[0]=='/' || path[0]=='\\') && path[1]=='\0') {
-        *target_cluster = root_dir_first_cluster;
-        return 0;
+    if(end > f->ent.size || map->first_cluster != first){
+        if(end > f->ent.size){
+            f->ent.size = end;
+            f->grown = 1;
+        }
+        f->ent.first_cluster = map->first_cluster;
+        f->ra.first_cluster = map->first_cluster;
+        f->ra.size = f->ent.size;
+        if(dir_update_entry(f->drive, f->dir, &f->ent) != 0) return -3;
     }
+    return size;
+}
 
-    /* Текущий каталог */
-    if (path[0]=='\0' || (path[0]=='.' && path[1]=='\0')) {
-        *target_cluster = current_dir_cluster;
-        return 0;
+static int file_close(fat32_file_t *f){
+    int rc = 0;
+    if(f->prealloc) rc = file_truncate(f, f->ent.size);
+    fat32_ra_release(&f->ra);
+    f->used = 0;
+    return rc;
+}
+
+static fat32_file_t *file_get(int fd){
+    if(fd < 0 || fd >= FAT32_MAX_OPEN || !open_files[fd].used) return NULL;
+    return &open_files[fd];
+}
+
+/* публичные вызовы, меняющие том, — под заглушкой диска, FAT сбрасывается в конце */
+int fat32_open(uint8_t drive, const char* path, int flags){
+    if(!path || !(flags & FAT32_O_RDWR)) return -1;
+    int fd = 0;
+    while(fd < FAT32_MAX_OPEN && open_files[fd].used) fd++;
+    if(fd == FAT32_MAX_OPEN) return -1;
+    block_device_t *dev = block_get(drive);
+    blk_plug(dev);
+    int rc = file_open(&open_files[fd], drive, path, flags);
+    if (fat_flush(drive) != 0) rc = -3;
+    if (blk_unplug(dev) != 0) rc = -3;
+    if (rc != 0) {
+        if (open_files[fd].used) file_close(&open_files[fd]);
+        return rc;
     }
+    return fd;
+}
 
-    /* Родитель */
-    if (path[0]=='.' && path[1]=='.' && path[2]=='\0') {
-        fat32_entry_t list[2];
-        int n = fat32_list_dir(drive, current_dir_cluster, list, 2);
-        if (n<2) return -1;
-        *target_cluster = list[1].first_cluster;
-        /* если ".." указывает на текущий каталог – считаем, что это корень */
-        if (*target_cluster == current_dir_cluster || *target_cluster == 0)
-            *target_cluster = root_dir_first_cluster;
-        return 0;
+int fat32_preadv(int fd, const iovec_t* iov, int iovcnt, uint32_t offset){
+    fat32_file_t *f = file_get(fd);
+    if(!f || !iov || iovcnt < 0) return -1;
+    return file_read(f, offset, iov, iovcnt);
+}
+
+int fat32_pwritev(int fd, const iovec_t* iov, int iovcnt, uint32_t offset){
+    fat32_file_t *f = file_get(fd);
+    if(!f || !iov || iovcnt < 0) return -1;
+    block_device_t *dev = block_get(f->drive);
+    blk_plug(dev);
+    int rc = file_write(f, offset, iov, iovcnt);
+    if (fat_flush(f->drive) != 0) rc = -3;
+    if (blk_unplug(dev) != 0) return -3;
+    return rc;
+}
+
+int fat32_read(int fd, void* buf, uint32_t size){
+    fat32_file_t *f = file_get(fd);
+    if(!f) return -1;
+    iovec_t iov = { buf, size };
+    int rc = fat32_preadv(fd, &iov, 1, f->pos);
+    if(rc > 0) f->pos += rc;
+    return rc;
+}
+
+int fat32_write(int fd, const void* buf, uint32_t size){
+    fat32_file_t *f = file_get(fd);
+    if(!f) return -1;
+    if(f->flags & FAT32_O_APPEND) f->pos = f->ent.size;
+    iovec_t iov = { (void*)buf, size };
+    int rc = fat32_pwritev(fd, &iov, 1, f->pos);
+    if(rc > 0) f->pos += rc;
+    return rc;
+}
+
+int64_t fat32_seek(int fd, int64_t offset, int whence){
+    fat32_file_t *f = file_get(fd);
+    if(!f) return -1;
+    int64_t base = whence == FAT32_SEEK_SET ? 0 : whence == FAT32_SEEK_CUR ? f->pos :
+                   whence == FAT32_SEEK_END ? f->ent.size : -1;
+    if(base < 0) return -1;
+    int64_t pos = base + offset;
+    if(pos < 0 || pos > 0xFFFFFFFFll) return -1;
+    f->pos = (uint32_t)pos;
+    return pos;
+}
+
+int fat32_close(int fd){
+    fat32_file_t *f = file_get(fd);
+    if(!f) return -1;
+    block_device_t *dev = block_get(f->drive);
+    uint8_t drive = f->drive;
+    blk_plug(dev);
+    int rc = file_close(f);
+    if (fat_flush(drive) != 0) rc = -3;
+    if (blk_unplug(dev) != 0) return -3;
+    return rc;
+}
+
+int fat32_read_file_data(uint8_t drive, const char* path, uint8_t* buf, uint32_t size, uint32_t offset){
+    if(!buf) return -1;
+    int fd = fat32_open(drive, path, FAT32_O_READ);
+    if(fd < 0) return fd;
+    iovec_t iov = { buf, size };
+    int rc = fat32_preadv(fd, &iov, 1, offset);
+    fat32_close(fd);
+    return rc;
+}
+
+/* -------------------------------------------------------------
+ *          Простейшая реализация разрешения пути
+ * -----------------------------------------------------------*/
+/* запись каталога cluster, подставляемая для "." , ".." и корня */
+static void dir_self(fat32_entry_t *out, uint32_t cluster, const char *name){
+    memset(out, 0, sizeof(*out));
+    strncpy(out->name, name, FAT32_MAX_NAME);
+    out->attr = 0x10;
+    out->first_cluster = cluster;
+}
+
+int fat32_lookup(uint8_t drive, const char* path, fat32_entry_t* out, uint32_t* dir_out) {
+    if (!path || !out) return -1;
+    uint32_t dir = current_dir_cluster;
+
+    /* "N:" — от корня тома; смонтирован только один, другой номер — ошибка */
+    if (path[0] >= '0' && path[0] <= '9' && path[1] == ':') {
+        if ((uint8_t)(path[0] - '0') != drive) return -1;
+        path += 2;
+        dir = root_dir_first_cluster;
     }
+    if (path[0] == '/' || path[0] == '\\') dir = root_dir_first_cluster;
+    dir_self(out, dir, dir == root_dir_first_cluster ? "\\" : ".");
+    uint32_t loc = dir;
 
-    /* Ищем директорию/файл в текущем каталоге */
-    fat32_entry_t list[64];
-    int n = fat32_list_dir(drive, current_dir_cluster, list, 64);
-    if (n<0) return -1;
-    for (int i=0;i<n;i++) {
-        if ((list[i].attr & 0x10)==0) continue; /* нужна только DIR */
-        if (strcasecmp_ascii(list[i].name, path)==0) {
-            *target_cluster = list[i].first_cluster;
-            return 0;
+    char comp[FAT32_MAX_NAME + 1];
+    for (;;) {
+        while (*path == '/' || *path == '\\') path++;
+        if (!*path) break;
+        int len = 0;
+        while (path[len] && path[len] != '/' && path[len] != '\\') len++;
+        if (len > FAT32_MAX_NAME) return -1;
+        memcpy(comp, path, len);
+        comp[len] = '\0';
+        path += len;
+
+        /* идти дальше можно только через каталог */
+        if (!(out->attr & 0x10)) return -2;
+        dir = out->first_cluster ? out->first_cluster : root_dir_first_cluster;
+        if (strcmp(comp, ".") == 0) continue;
+        if (strcmp(comp, "..") == 0) {
+            /* в корне ".." нет, выше корня не поднимаемся */
+            if (dir == root_dir_first_cluster) continue;
+            if (dir_lookup(drive, dir, "..", out) != 0) return -1;
+            uint32_t up = out->first_cluster;
+            /* ".." на сам каталог или 0 — это корень */
+            if (up == dir || up == 0) up = root_dir_first_cluster;
+            dir_self(out, up, up == root_dir_first_cluster ? "\\" : "..");
+            loc = up;
+            continue;
         }
+        if (dir_lookup(drive, dir, comp, out) != 0) return -1;
+        loc = dir;
     }
-    return -1; /* не найдено */
+    if (dir_out) *dir_out = loc;
+    return 0;
+}
+
+int fat32_resolve_path(uint8_t drive, const char* path, uint32_t* target_cluster) {
+    if (!path || !target_cluster) return -1;
+    fat32_entry_t *ent = kmalloc(sizeof(fat32_entry_t));
+    if (!ent) return -1;
+    int r = fat32_lookup(drive, path, ent, NULL);
+    if (r == 0 && !(ent->attr & 0x10)) r = -2;  /* не каталог */
+    if (r == 0) *target_cluster = ent->first_cluster ? ent->first_cluster : root_dir_first_cluster;
+    kfree(ent);
+    return r;
 }
 
 int fat32_change_dir(uint8_t d,const char* p){
@@ -512,32 +1197,251 @@ int fat32_change_dir(uint8_t d,const char* p){
     return r;
 }
 
+/* ---------------------- FAT в памяти --------------------------------*/
+static void fat_table_free(void) {
+    kfree(fat_table);
+    kfree(free_map);
+    kfree(fat_dirty);
+    fat_table = NULL;
+    free_map = NULL;
+    fat_dirty = NULL;
+    fat_dirty_lo = 0xFFFFFFFF;
+    fat_dirty_hi = 0;
+}
+
+/* Загрузить первую FAT целиком и построить карту свободных кластеров */
+static void fat_load(uint8_t drive) {
+    fat_table_free();
+    uint64_t bytes = (uint64_t)sectors_per_fat * 512;
+    uint32_t entries = total_clusters + 2;
+    if (bytes > FAT_MEM_MAX || (uint64_t)entries * 4 > bytes) {
+        kdbg(KINFO, "fat32: fat of %u sectors stays on disk\n", sectors_per_fat);
+        return;
+    }
+    fat_table = kmalloc(bytes);
+    free_map  = kmalloc((entries + 31) / 32 * 4);
+    fat_dirty = kmalloc(sectors_per_fat);
+    if (!fat_table || !free_map || !fat_dirty) { fat_table_free(); return; }
+
+    for (uint32_t s = 0; s < sectors_per_fat; s += 128) {
+        uint32_t n = sectors_per_fat - s < 128 ? sectors_per_fat - s : 128;
+        if (disk_read(drive, partition_lba + fat_start + s, n, (uint8_t*)fat_table + s * 512) != 0) {
+            kdbg(KERR, "fat32: fat read failed, using it from disk\n");
+            fat_table_free();
+            return;
+        }
+    }
+    memset(free_map, 0, (entries + 31) / 32 * 4);
+    memset(fat_dirty, 0, sectors_per_fat);
+    uint32_t free = 0;
+    for (uint32_t cl = 2; cl < entries; cl++) {
+        if ((fat_table[cl] & 0x0FFFFFFF) == 0) {
+            free_map[cl / 32] |= 1u << (cl % 32);
+            free++;
+        }
+    }
+    /* посчитанное точнее FSInfo: расхождение исправляем на диске */
+    if (!free_known || free != free_clusters) {
+        if (free_known)
+            kdbg(KWARN, "fat32: fsinfo free count %u, fat says %u\n", free_clusters, free);
+        fsinfo_dirty = 1;
+    }
+    free_clusters = free;
+    free_known = 1;
+    kdbg(KINFO, "fat32: fat in memory, %u of %u clusters free\n", free_clusters, total_clusters);
+}
+
+/* Прочитать и проверить FSInfo. Его значения — только подсказки: счётчик
+ * принимается, если он не больше числа кластеров, подсказка — если
+ * указывает внутрь тома. */
+static void fsinfo_read(uint8_t drive) {
+    fsinfo_lba = 0;
+    fsinfo_dirty = 0;
+    free_known = 0;
+    next_free_hint = 3;
+    uint16_t sec = fat32_bpb.fat_info;
+    if (sec == 0 || sec == 0xFFFF || sec >= fat32_bpb.reserved_sector_count) return;
+    buf_t *b = bcache_read(block_get(drive), partition_lba + sec);
+    if (!b) return;
+    uint8_t *d = b->data;
+    if (*(uint32_t*)&d[0] == FSINFO_LEAD_SIG && *(uint32_t*)&d[484] == FSINFO_STRUCT_SIG &&
+        *(uint32_t*)&d[508] == FSINFO_TRAIL_SIG) {
+        fsinfo_lba = partition_lba + sec;
+        uint32_t free = *(uint32_t*)&d[488];
+        uint32_t next = *(uint32_t*)&d[492];
+        if (free <= total_clusters) { free_clusters = free; free_known = 1; }
+        if (next >= 2 && next < total_clusters + 2) next_free_hint = next;
+    } else {
+        kdbg(KWARN, "fat32: fsinfo sector %u is not valid\n", sec);
+    }
+    bcache_release(b);
+}
+
+static int fsinfo_write(uint8_t drive) {
+    fsinfo_dirty = 0;
+    if (!fsinfo_lba) return 0;
+    buf_t *b = bcache_read(block_get(drive), fsinfo_lba);
+    if (!b) return -1;
+    *(uint32_t*)&b->data[488] = free_known ? free_clusters : 0xFFFFFFFF;
+    *(uint32_t*)&b->data[492] = next_free_hint;
+    bcache_dirty(b);
+    bcache_release(b);
+    return 0;
+}
+
+/* Записать изменённые сектора FAT во все копии; соседние — одной командой */
+static int fat_flush(uint8_t drive) {
+    int rc = 0;
+    if (fsinfo_dirty && fsinfo_write(drive) != 0) rc = -1;
+    if (!fat_table || fat_dirty_lo > fat_dirty_hi) return rc;
+    uint32_t s = fat_dirty_lo;
+    while (s <= fat_dirty_hi) {
+        if (!fat_dirty[s]) { s++; continue; }
+        uint32_t e = s;
+        while (e < fat_dirty_hi && fat_dirty[e + 1]) e++;
+        uint32_t n = e - s + 1;
+        for (uint8_t t = 0; t < fat32_bpb.table_count; t++) {
+            uint32_t lba = partition_lba + fat_start + t * sectors_per_fat + s;
+            if (disk_write(drive, lba, n, (uint8_t*)fat_table + s * 512) != 0) rc = -1;
+        }
+        memset(&fat_dirty[s], 0, n);
+        s = e + 1;
+    }
+    fat_dirty_lo = 0xFFFFFFFF;
+    fat_dirty_hi = 0;
+    if (rc) kdbg(KERR, "fat32: fat write-back failed\n");
+    return rc;
+}
+
+int fat32_statfs(uint32_t *total, uint32_t *free, uint32_t *cluster_bytes) {
+    if (!total_clusters) return -1;
+    if (total) *total = total_clusters;
+    if (free) *free = free_known ? free_clusters : 0xFFFFFFFF;
+    if (cluster_bytes) *cluster_bytes = fat32_bpb.sectors_per_cluster * 512;
+    return 0;
+}
+
 /* Найти свободный кластер (значение 0 в FAT) */
 static uint32_t find_free_cluster(uint8_t drive){
     if(total_clusters==0) return 0;
+    if(free_map){
+        /* слово карты с ненулевым битом — свободный кластер */
+        if(!free_clusters) return 0;
+        uint32_t words = (total_clusters + 2 + 31) / 32;
+        uint32_t w = (next_free_hint / 32) % words;
+        for(uint32_t i=0; i<words; i++, w = (w + 1) % words){
+            if(!free_map[w]) continue;
+            uint32_t cl = w * 32 + __builtin_ctz(free_map[w]);
+            next_free_hint = cl + 1;
+            if(next_free_hint >= 2+total_clusters) next_free_hint = 2;
+            fsinfo_dirty = 1;
+            return cl;
+        }
+        return 0;
+    }
     uint32_t start = next_free_hint;
     for(uint32_t iter=0; iter<total_clusters; iter++){
         uint32_t cl = 2 + ((start -2 + iter) % total_clusters); /* диапазон 2..2+total_clusters-1 */
         if(fat32_get_next_cluster(drive, cl)==0x00000000){
             next_free_hint = cl+1;
             if(next_free_hint >= 2+total_clusters) next_free_hint = 2;
+            fsinfo_dirty = 1;
             return cl;
         }
     }
     return 0; /* нет свободных */
 }
+
+/* длина участка свободных кластеров от cl, не больше max */
+static uint32_t free_run_len(uint32_t cl, uint32_t max, uint32_t end){
+    uint32_t n = 0;
+    while(n < max && cl + n < end){
+        uint32_t c = cl + n;
+        if(!(c % 32) && max - n >= 32 && c + 32 <= end && free_map[c/32] == 0xFFFFFFFF){ n += 32; continue; }
+        if(!(free_map[c/32] & (1u << (c%32)))) break;
+        n++;
+    }
+    return n;
+}
+
+/* Участок до want свободных кластеров подряд; в *got — его длина.
+ * Сначала сразу за goal (продолжение файла), иначе от next_free_hint первый
+ * участок не короче want, а если такого нет — самый длинный. */
+static uint32_t find_free_run(uint8_t drive, uint32_t goal, uint32_t want, uint32_t *got){
+    *got = 0;
+    if(total_clusters==0 || !want) return 0;
+    uint32_t end = total_clusters + 2;
+    uint32_t best = 0, best_len = 0;
+    if(!free_map){
+        /* FAT не в памяти: первый свободный и сколько за ним подряд */
+        best = (goal>=2 && goal<end && fat32_get_next_cluster(drive, goal)==0) ? goal : find_free_cluster(drive);
+        if(!best) return 0;
+        best_len = 1;
+        while(best_len < want && best + best_len < end && fat32_get_next_cluster(drive, best + best_len)==0)
+            best_len++;
+    } else if(goal>=2 && goal<end && (free_map[goal/32] & (1u << (goal%32)))){
+        best = goal;
+        best_len = free_run_len(goal, want, end);
+    } else {
+        if(!free_clusters) return 0;
+        uint32_t span = end - 2;
+        uint32_t start = (next_free_hint>=2 && next_free_hint<end) ? next_free_hint : 2;
+        for(uint32_t pos = 0; pos < span; ){
+            uint32_t cl = 2 + (start - 2 + pos) % span;
+            uint32_t bits = free_map[cl/32] >> (cl%32);
+            if(!bits){
+                /* последнее слово карты неполное: шаг не дальше конца тома,
+                 * чтобы обход продолжился ровно с кластера 2 */
+                uint32_t step = 32 - cl%32;
+                pos += step < end - cl ? step : end - cl;
+                continue;
+            }
+            uint32_t skip = __builtin_ctz(bits);
+            if(skip){ pos += skip; continue; }
+            uint32_t len = free_run_len(cl, want, end);
+            if(len > best_len){ best = cl; best_len = len; }
+            if(len == want) break;
+            pos += len;
+        }
+        if(!best) return 0;
+    }
+    next_free_hint = best + best_len;
+    if(next_free_hint >= end) next_free_hint = 2;
+    fsinfo_dirty = 1;
+    *got = best_len;
+    return best;
+}
 /* Записать значение в FAT для указанного кластера */
 static int fat_write_fat_entry(uint8_t drive, uint32_t cluster, uint32_t value){
+    if(fat_table){
+        if(cluster<2 || cluster>=total_clusters+2) return -1;
+        int was_free = (fat_table[cluster] & 0x0FFFFFFF) == 0;
+        int now_free = (value & 0x0FFFFFFF) == 0;
+        /* старшие 4 бита записи зарезервированы и сохраняются */
+        fat_table[cluster] = (fat_table[cluster] & 0xF0000000) | (value & 0x0FFFFFFF);
+        if(was_free && !now_free){ free_map[cluster/32] &= ~(1u << (cluster%32)); free_clusters--; fsinfo_dirty = 1; }
+        if(!was_free && now_free){ free_map[cluster/32] |= 1u << (cluster%32); free_clusters++; fsinfo_dirty = 1; }
+        uint32_t sec = cluster / 128;
+        fat_dirty[sec] = 1;
+        if(sec < fat_dirty_lo) fat_dirty_lo = sec;
+        if(sec > fat_dirty_hi) fat_dirty_hi = sec;
+        return 0;
+    }
     uint32_t fat_offset = cluster*4;
     for(uint8_t t=0;t<fat32_bpb.table_count;t++){
-        uint32_t fat_sector = fat_start + t*sectors_per_fat + fat_offset/512;
+        uint32_t fat_sector = partition_lba + fat_start + t*sectors_per_fat + fat_offset/512;
         uint32_t ent_off    = fat_offset%512;
-        uint8_t sector[512];
-        if(ata_read_sector(drive,fat_sector,sector)!=0) return -1;
-        *(uint32_t*)&sector[ent_off] = value & 0x0FFFFFFF;
-        if(ata_write_sector(drive,fat_sector,sector)!=0) return -1;
+        buf_t *b = bcache_read(block_get(drive), fat_sector);
+        if(!b) return -1;
+        uint32_t *ent = (uint32_t*)&b->data[ent_off];
+        if(t==0 && free_known){ /* счётчик ведём по первой копии */
+            int was_free = (*ent & 0x0FFFFFFF) == 0, now_free = (value & 0x0FFFFFFF) == 0;
+            if(was_free != now_free){ free_clusters += now_free ? 1 : -1; fsinfo_dirty = 1; }
+        }
+        *ent = (*ent & 0xF0000000) | (value & 0x0FFFFFFF);
+        bcache_dirty(b);
+        bcache_release(b);
     }
-    cached_fat_sector = 0xFFFFFFFF;
     return 0;
 }
 /* Подготовить SFN из long_name (упрощённо) */
@@ -555,16 +1459,37 @@ static void make_sfn(const char *longname, char sfn[11]){
 /* Записать последовательность LFN+SFN в каталог (один сектор, без расширения) */
 static int dir_write_entries(uint8_t drive, uint32_t lba, int offset, const uint8_t *entries, int count){
     uint8_t sector[512];
-    if(ata_read_sector(drive,lba,sector)!=0) return -1;
+    if(disk_read(drive, lba, 1, sector)!=0) return -1;
     /* копируем записи по байтам во внутренний буфер сектора */
     for(int i=0;i<count*32;i++)
         sector[offset+i] = entries[i];
-    if(ata_write_sector(drive,lba,sector)!=0) return -1;
+    if(disk_write(drive, lba, 1, sector)!=0) return -1;
     return 0;
 }
 
+/* Дописать к каталогу кластер за его последним cl: обнулённый, затем
+ * связанный. Возвращает новый кластер или 0; при ошибке цепочка каталога
+ * не меняется. */
+static uint32_t dir_extend(uint8_t drive, uint32_t cl){
+    uint32_t newcl = find_free_cluster(drive);
+    if(!newcl) return 0;
+    if(fat_write_fat_entry(drive, newcl, 0x0FFFFFFF)!=0) return 0;
+    uint8_t zero[512]; memset(zero,0,512);
+    for(uint8_t sct=0; sct<fat32_bpb.sectors_per_cluster; sct++){
+        if(disk_write(drive, fat32_cluster_to_lba(newcl)+sct, 1, zero)!=0){
+            fat_write_fat_entry(drive, newcl, 0);
+            return 0;
+        }
+    }
+    if(fat_write_fat_entry(drive, cl, newcl)!=0){
+        fat_write_fat_entry(drive, newcl, 0);
+        return 0;
+    }
+    return newcl;
+}
+
 /* Создать файл (пустой) с длинным именем в текущем каталоге */
-int fat32_create_file(uint8_t drive, const char* name){
+static int create_file(uint8_t drive, uint32_t dir, const char* name){
     /* Подготовка SFN */
     char sfn[11]; make_sfn(name,sfn);
     uint8_t checksum = shortname_checksum(sfn);
@@ -597,13 +1522,13 @@ int fat32_create_file(uint8_t drive, const char* name){
     s->attr = 0x20; /* file */
     s->file_size=0; s->first_cluster_high=0; s->first_cluster_low=0;
 
-    /* Найти место в текущем каталоге */
-    uint32_t cl=current_dir_cluster;
+    /* Найти место в каталоге dir */
+    uint32_t cl=dir;
     uint8_t sector[512];
     while(1){
         for(uint8_t sec=0;sec<fat32_bpb.sectors_per_cluster;sec++){
             uint32_t lba=fat32_cluster_to_lba(cl)+sec;
-            if(ata_read_sector(drive,lba,sector)!=0){kfree(buf);return -1;}
+            if(disk_read(drive, lba, 1, sector)!=0){kfree(buf);return -1;}
             for(int off=0;off<=512-32*total_entries;off+=32){
                 int free_ok=1;
                 for(int e=0;e<total_entries;e++) if(sector[off+e*32]!=0x00 && sector[off+e*32]!=0xE5){free_ok=0;break;}
@@ -613,7 +1538,7 @@ int fat32_create_file(uint8_t drive, const char* name){
                         sector[off+i] = buf[i];
                     int end=off+total_entries*32;
                     if(end<512) sector[end]=0x00;
-                    if(ata_write_sector(drive,lba,sector)!=0){kfree(buf);return -1;}
+                    if(disk_write(drive, lba, 1, sector)!=0){kfree(buf);return -1;}
                     kfree(buf); return 0;
                 }
                 /* конец каталога метка 0x00 */
@@ -624,7 +1549,7 @@ int fat32_create_file(uint8_t drive, const char* name){
                         sector[off+i] = buf[i];
                     int end=off+total_entries*32;
                     if(end<512) sector[end]=0x00;
-                    if(ata_write_sector(drive,lba,sector)!=0){kfree(buf);return -1;}
+                    if(disk_write(drive, lba, 1, sector)!=0){kfree(buf);return -1;}
                     kfree(buf); return 0;
                 }
             }
@@ -632,18 +1557,13 @@ int fat32_create_file(uint8_t drive, const char* name){
         /* нет места, нужно расширить каталог */
         uint32_t next = fat32_get_next_cluster(drive, cl);
         if(next>=0x0FFFFFF8){ /* allocate new */
-            uint32_t newcl = find_free_cluster(drive); if(!newcl){kfree(buf);return -1;}
-            fat_write_fat_entry(drive, cl, newcl);
-            fat_write_fat_entry(drive, newcl, 0x0FFFFFFF);
-            /* zero new cluster */
-            uint8_t zero[512]; memset(zero,0,512);
-            for(uint8_t sct=0;sct<fat32_bpb.sectors_per_cluster;sct++) ata_write_sector(drive,fat32_cluster_to_lba(newcl)+sct,zero);
+            uint32_t newcl = dir_extend(drive, cl); if(!newcl){kfree(buf);return -1;}
             cl=newcl;
         } else cl=next;
     }
 }
 
-int fat32_create_dir(uint8_t drive, const char* name){
+static int create_dir(uint8_t drive, const char* name){
     /* create directory entry first (similar to file) */
     char sfn[11]; make_sfn(name,sfn); uint8_t checksum=shortname_checksum(sfn);
     int namelen=strlen(name); int lcnt=(namelen+12)/13; int total=lcnt+1;
@@ -667,14 +1587,14 @@ int fat32_create_dir(uint8_t drive, const char* name){
     uint32_t newcl=find_free_cluster(drive); if(!newcl){kfree(buf);return -1;}
     d->first_cluster_high=newcl>>16; d->first_cluster_low=newcl&0xFFFF; d->file_size=0;
     /* mark cluster as end */
-    fat_write_fat_entry(drive, newcl, 0x0FFFFFFF);
+    if(fat_write_fat_entry(drive, newcl, 0x0FFFFFFF)!=0){kfree(buf);return -1;}
 
     /* write dir entry into current directory */
     uint32_t cl=current_dir_cluster; uint8_t sector[512];
     while(1){
         for(uint8_t sct=0;sct<fat32_bpb.sectors_per_cluster;sct++){
             uint32_t lba=fat32_cluster_to_lba(cl)+sct;
-            if(ata_read_sector(drive,lba,sector)!=0){kfree(buf);return -1;}
+            if(disk_read(drive, lba, 1, sector)!=0){kfree(buf);return -1;}
             for(int off=0;off<=512-32*total;off+=32){
                 int free_ok=1; for(int e=0;e<total;e++) if(sector[off+32*e]!=0x00 && sector[off+32*e]!=0xE5){free_ok=0;break;}
                 if(free_ok){
@@ -682,7 +1602,7 @@ int fat32_create_dir(uint8_t drive, const char* name){
                         sector[off+i] = buf[i];
                     int end=off+total*32;
                     if(end<512) sector[end]=0x00;
-                    if(ata_write_sector(drive,lba,sector)!=0){kfree(buf);return -1;}
+                    if(disk_write(drive, lba, 1, sector)!=0){kfree(buf);return -1;}
                     kfree(buf);
                     /* init new directory cluster with '.' and '..' */
                     uint8_t dirsec[512]; memset(dirsec,0,512);
@@ -692,7 +1612,7 @@ int fat32_create_dir(uint8_t drive, const char* name){
                     /* .. */
                     memset(&dirsec[32],' ',11); dirsec[32]='.'; dirsec[33]='.'; dirsec[43]=0x10;
                     *(uint16_t*)(&dirsec[52])=(current_dir_cluster>>16)&0xFFFF; *(uint16_t*)(&dirsec[58])=current_dir_cluster&0xFFFF;
-                    for(uint8_t sc=0;sc<fat32_bpb.sectors_per_cluster;sc++) ata_write_sector(drive,fat32_cluster_to_lba(newcl)+sc,dirsec);
+                    for(uint8_t sc=0;sc<fat32_bpb.sectors_per_cluster;sc++) disk_write(drive, fat32_cluster_to_lba(newcl)+sc, 1, dirsec);
                 return 0;
                 }
                 if(sector[off]==0x00){
@@ -701,7 +1621,7 @@ int fat32_create_dir(uint8_t drive, const char* name){
                         sector[off+i] = buf[i];
                     int end=off+total*32;
                     if(end<512) sector[end]=0x00;
-                    if(ata_write_sector(drive,lba,sector)!=0){kfree(buf);return -1;}
+                    if(disk_write(drive, lba, 1, sector)!=0){kfree(buf);return -1;}
                     kfree(buf);
                     /* init new dir cluster same as above */
                     uint8_t dirsec[512]; memset(dirsec,0,512);
@@ -709,18 +1629,18 @@ int fat32_create_dir(uint8_t drive, const char* name){
                     *(uint16_t*)(&dirsec[20])=(newcl>>16)&0xFFFF; *(uint16_t*)(&dirsec[26])=newcl&0xFFFF;
                     memset(&dirsec[32],' ',11); dirsec[32]='.'; dirsec[33]='.'; dirsec[43]=0x10;
                     *(uint16_t*)(&dirsec[52])=(current_dir_cluster>>16)&0xFFFF; *(uint16_t*)(&dirsec[58])=current_dir_cluster&0xFFFF;
-                    for(uint8_t sc=0;sc<fat32_bpb.sectors_per_cluster;sc++) ata_write_sector(drive,fat32_cluster_to_lba(newcl)+sc,dirsec);
+                    for(uint8_t sc=0;sc<fat32_bpb.sectors_per_cluster;sc++) disk_write(drive, fat32_cluster_to_lba(newcl)+sc, 1, dirsec);
                     return 0;
                 }
             }
         }
         uint32_t next=fat32_get_next_cluster(drive,cl);
-        if(next>=0x0FFFFFF8){uint32_t newc=find_free_cluster(drive); if(!newc){kfree(buf);return -1;} fat_write_fat_entry(drive,cl,newc); fat_write_fat_entry(drive,newc,0x0FFFFFFF); uint8_t zero[512]; memset(zero,0,512); for(uint8_t s=0;s<fat32_bpb.sectors_per_cluster;s++) ata_write_sector(drive,fat32_cluster_to_lba(newc)+s,zero); cl=newc;}
+        if(next>=0x0FFFFFF8){uint32_t newc=dir_extend(drive,cl); if(!newc){fat_write_fat_entry(drive,newcl,0);kfree(buf);return -1;} cl=newc;}
         else cl=next;
     }
 }
 
-void fat32_create_fs(uint8_t drive) {
+static void create_fs(uint8_t drive) {
     uint8_t bootloader_bin_[62] = {
                 0xEB, 0x21, 0x90,             /* jmp short start (to 0x21) */
                 /* BPB (заполняется ниже) */
@@ -787,28 +1707,155 @@ void fat32_create_fs(uint8_t drive) {
                 sector[0x4E + i] = bootmsg[i];
             sector[510] = 0x55; sector[511] = 0xAA;
             // Write Boot Sector
-            if (ata_write_sector(drive, 0, sector) != 0) {
+            if (disk_write(drive, 0, 1, sector) != 0) {
                 kdbg(KERR, "fat32_createfs: error writing boot sector\n");
                 return;
             }
             // FSInfo
             memset(sector, 0, 512);
-            *(uint32_t*)&sector[0] = 0x41615252;
-            *(uint32_t*)&sector[484] = 0x61417272;
-            *(uint32_t*)&sector[488] = 0xFFFFFFFF;
-            *(uint32_t*)&sector[492] = 0xFFFFFFFF;
+            /* все кластеры, что помещаются в FAT, кроме корневого (2) */
+            uint32_t clusters = 65536 - 32 - 2 * 123;
+            if (clusters > 123 * 128 - 2) clusters = 123 * 128 - 2;
+            *(uint32_t*)&sector[0] = FSINFO_LEAD_SIG;
+            *(uint32_t*)&sector[484] = FSINFO_STRUCT_SIG;
+            *(uint32_t*)&sector[488] = clusters - 1;
+            *(uint32_t*)&sector[492] = 3;
             sector[510] = 0x55; sector[511] = 0xAA;
-            if (ata_write_sector(drive, 1, sector) != 0) {
+            if (disk_write(drive, 1, 1, sector) != 0) {
                 kdbg(KERR, "fat32_createfs: error writing fsinfo\n");
                 return;
             }
             // Clear FAT and root cluster
             memset(sector, 0, 512);
             for (int i = 0; i < 32; i++) {
-                ata_write_sector(drive, 32 + i, sector); // root directory
+                disk_write(drive, 32 + i, 1, sector); // root directory
             }
             for (int i = 0; i < 123 * 2; i++) {
-                ata_write_sector(drive, 32 + 32 + i, sector); // FAT
+                disk_write(drive, 32 + 32 + i, 1, sector); // FAT
             }
+            // FAT[0] — media, FAT[1] — конец цепочки, FAT[2] — корневой каталог
+            *(uint32_t*)&sector[0] = 0x0FFFFFF8;
+            *(uint32_t*)&sector[4] = 0x0FFFFFFF;
+            *(uint32_t*)&sector[8] = 0x0FFFFFFF;
+            disk_write(drive, 32, 1, sector);
+            disk_write(drive, 32 + 123, 1, sector);
             kdbg(KINFO, "fat32_createfs: fat32 created\n");
-}
\ No newline at end of file
+}
+/* Операции ниже пишут много мелких секторов (FAT, каталог, данные):
+ * под заглушкой очереди они сливаются и уходят на диск отсортированными.
+ * Изменённая FAT в памяти сбрасывается в конце каждой операции. */
+/* разовая запись по пути через временный дескриптор */
+static int write_path(uint8_t drive, const char* path, int flags, const iovec_t* iov, int iovcnt, uint32_t offset){
+    if(!path || !iov || iovcnt <= 0) return -1;
+    fat32_file_t *f = kmalloc(sizeof(fat32_file_t));
+    if(!f) return -1;
+    block_device_t *dev = block_get(drive);
+    blk_plug(dev);
+    int rc = file_open(f, drive, path, FAT32_O_WRITE | flags);
+    if (rc == 0) {
+        rc = file_write(f, offset, iov, iovcnt);
+        if (file_close(f) != 0) rc = -3;
+    }
+    if (fat_flush(drive) != 0) rc = -3;
+    if (blk_unplug(dev) != 0) rc = -3;
+    kfree(f);
+    return rc;
+}
+
+int fat32_writev(uint8_t drive, const char* name, const iovec_t* iov, int iovcnt, uint32_t offset){
+    return write_path(drive, name, offset == 0 ? FAT32_O_CREAT : 0, iov, iovcnt, offset);
+}
+
+int fat32_write_file(uint8_t drive, const char* path, const uint8_t* buf, uint32_t size){
+    if(!buf) return -1;
+    iovec_t iov = { (void*)buf, size };
+    return write_path(drive, path, FAT32_O_CREAT | FAT32_O_TRUNC, &iov, 1, 0);
+}
+
+/* кластеры под [0, length) файла без изменения размера; создаёт файл */
+static int fallocate_file(uint8_t drive, const char *name, uint32_t length){
+    if(!name) return -1;
+    fat32_file_t *f = kmalloc(sizeof(fat32_file_t));
+    if(!f) return -1;
+    int rc = file_open(f, drive, name, FAT32_O_WRITE | FAT32_O_CREAT);
+    if(rc != 0){ kfree(f); return rc; }
+    uint32_t cluster_size = cluster_bytes_of();
+    rc = extmap_grow(&f->ra.map, (uint32_t)(((uint64_t)length + cluster_size - 1) / cluster_size), 0);
+    if(f->ra.map.first_cluster != f->ent.first_cluster){
+        f->ent.first_cluster = f->ra.map.first_cluster;
+        if(dir_update_entry(drive, f->dir, &f->ent)!=0) rc = -1;
+    }
+    /* prealloc не выставлен: закрытие зарезервированное не снимает */
+    file_close(f);
+    kfree(f);
+    return rc;
+}
+
+int fat32_fallocate(uint8_t drive, const char* name, uint32_t length){
+    block_device_t *dev = block_get(drive);
+    blk_plug(dev);
+    int rc = fallocate_file(drive, name, length);
+    if (fat_flush(drive) != 0) rc = -1;
+    if (blk_unplug(dev) != 0) return -1;
+    return rc;
+}
+
+/* лишнее за размером из записи каталога; сам размер не меняется */
+static int trim_file(uint8_t drive, const char *name){
+    if(!name) return -1;
+    fat32_file_t *f = kmalloc(sizeof(fat32_file_t));
+    if(!f) return -1;
+    int rc = file_open(f, drive, name, FAT32_O_WRITE);
+    if(rc != 0){ kfree(f); return rc; }
+    rc = file_truncate(f, f->ent.size);
+    file_close(f);
+    kfree(f);
+    return rc;
+}
+
+int fat32_trim(uint8_t drive, const char* name){
+    block_device_t *dev = block_get(drive);
+    blk_plug(dev);
+    int rc = trim_file(drive, name);
+    if (fat_flush(drive) != 0) rc = -1;
+    if (blk_unplug(dev) != 0) return -1;
+    return rc;
+}
+
+int fat32_write_file_data(uint8_t drive,const char*name,const uint8_t*buf,uint32_t size,uint32_t offset){
+    if(!buf) return -1;
+    iovec_t iov = { (void*)buf, size };
+    return fat32_writev(drive, name, &iov, 1, offset);
+}
+
+int fat32_create_file(uint8_t drive, const char* name){
+    block_device_t *dev = block_get(drive);
+    blk_plug(dev);
+    int rc = create_file(drive, current_dir_cluster, name);
+    if (name) dcache_remove(drive, current_dir_cluster, name);  /* снимает отрицательную запись */
+    if (fat_flush(drive) != 0) rc = -1;
+    if (blk_unplug(dev) != 0) return -1;
+    return rc;
+}
+
+int fat32_create_dir(uint8_t drive, const char* name){
+    block_device_t *dev = block_get(drive);
+    blk_plug(dev);
+    int rc = create_dir(drive, name);
+    if (name) dcache_remove(drive, current_dir_cluster, name);
+    if (fat_flush(drive) != 0) rc = -1;
+    if (blk_unplug(dev) != 0) return -1;
+    return rc;
+}
+
+void fat32_create_fs(uint8_t drive) {
+    block_device_t *dev = block_get(drive);
+    blk_plug(dev);
+    create_fs(drive);
+    dcache_invalidate(drive);
+    /* таблица в памяти и FSInfo устарели до следующего монтирования */
+    fat_table_free();
+    free_known = 0;
+    fsinfo_lba = 0;
+    if (blk_unplug(dev) != 0) kdbg(KERR, "fat32_createfs: deferred writes failed\n");
+}
@@ -1,7 +1,7 @@
 #include <ps2.h>
 #include <cpu.h>
 #include <port_based.h>
-#include <idt.h>
+#include <irq.h>
 #include <thread.h>
 #include <vga.h>
 
@@ -58,21 +58,21 @@ int keyboard_buffer_pop(char *c)
 
 static int key_end = 0;
 
-static void keyboard_handler(cpu_registers_t* regs)
+static irqreturn_t keyboard_handler(cpu_registers_t* regs, void* cookie)
 {
     //kprintf("scancode: %d\n");
     unsigned char scancode = inb(0x60);
     if (scancode == 42 || scancode == 54) {
         shift_pressed = 1;
-        return;
+        return IRQ_HANDLED;
     }
     if (scancode == (42 | 0x80) || scancode == (54 | 0x80)) {
         shift_pressed = 0;
-        return;
+        return IRQ_HANDLED;
     }
     if (scancode == 58) {
         caps_lock = !caps_lock;
-        return;
+        return IRQ_HANDLED;
     }
     if (scancode < 128) {
         char c = scancode_ascii[scancode];
@@ -92,15 +92,15 @@ static void keyboard_handler(cpu_registers_t* regs)
             keyboard_buffer_push(c);
         }
     }
+    return IRQ_HANDLED;
 }
 
 void ps2_init(void) {
-    
+    irq_request(33, keyboard_handler, 0, "ps2kbd", NULL);
 }
 char kgetch(void)
 {
     char c;
-    idt_register_handler(33, keyboard_handler);
     while (!keyboard_buffer_pop(&c)) thread_yield();
     key_end = 0;
     return c;
@@ -0,0 +1,205 @@
+#include <pci.h>
+#include <irq.h>
+#include <lapic.h>
+#include <irqflags.h>
+#include <debug.h>
+
+// MSI capability layout (offsets from the capability)
+#define MSI_CTRL          0x02
+#define MSI_ADDR_LO       0x04
+#define MSI_ADDR_HI       0x08
+#define MSI_CTRL_ENABLE   0x0001
+#define MSI_CTRL_MMC(c)   (((c) >> 1) & 0x7)   // log2 of vectors the device can request
+#define MSI_CTRL_MME_SHIFT 4
+#define MSI_CTRL_64BIT    0x0080
+#define MSI_CTRL_MASKBIT  0x0100
+
+// MSI-X capability and table
+#define MSIX_CTRL         0x02
+#define MSIX_TABLE        0x04
+#define MSIX_CTRL_SIZE(c) (((c) & 0x7FF) + 1)
+#define MSIX_CTRL_FMASK   0x4000
+#define MSIX_CTRL_ENABLE  0x8000
+#define MSIX_ENTRY_SIZE   16                   // bytes: addr lo, addr hi, data, vector control
+#define MSIX_ENTRY_CTRL_MASK 0x1
+
+static uint32_t msi_address(void) {
+    return LAPIC_MSI_ADDRESS | ((uint32_t)lapic_id() << 12);
+}
+
+// fixed delivery, edge triggered
+static uint32_t msi_data(uint8_t vector) {
+    return vector;
+}
+
+static void pci_intx_disable(struct pci_device* dev, int disable) {
+    uint16_t cmd = pci_dev_read16(dev, PCI_COMMAND);
+    if (disable) cmd |= PCI_COMMAND_INTX_DISABLE;
+    else cmd &= ~PCI_COMMAND_INTX_DISABLE;
+    pci_dev_write16(dev, PCI_COMMAND, cmd);
+}
+
+static uint8_t msi_data_offset(uint16_t ctrl) {
+    return (ctrl & MSI_CTRL_64BIT) ? 0x0C : 0x08;
+}
+
+static uint8_t msi_mask_offset(uint16_t ctrl) {
+    return (ctrl & MSI_CTRL_64BIT) ? 0x10 : 0x0C;
+}
+
+int pci_enable_msi(struct pci_device* dev, int nvec) {
+    if (!lapic_enabled()) return -1;
+    if (dev->msi_enabled || dev->msix_enabled) return -2;
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSI, 0);
+    if (!cap) return -3;
+
+    uint16_t ctrl = pci_dev_read16(dev, cap + MSI_CTRL);
+    int max = 1 << MSI_CTRL_MMC(ctrl);
+    if (nvec < 1) nvec = 1;
+    if (nvec > max) nvec = max;
+    // multiple-message MSI varies the low data bits, so the block must be a power of two
+    int log2 = 0;
+    while ((1 << log2) < nvec) log2++;
+    nvec = 1 << log2;
+
+    int vector = irq_alloc_vectors(nvec, nvec);
+    if (vector < 0) {
+        kdbg(KERR, "pci_enable_msi: no free vectors for %d messages\n", nvec);
+        return -4;
+    }
+
+    pci_dev_write32(dev, cap + MSI_ADDR_LO, msi_address());
+    if (ctrl & MSI_CTRL_64BIT)
+        pci_dev_write32(dev, cap + MSI_ADDR_HI, 0);
+    pci_dev_write16(dev, cap + msi_data_offset(ctrl), msi_data(vector));
+    if (ctrl & MSI_CTRL_MASKBIT)
+        pci_dev_write32(dev, cap + msi_mask_offset(ctrl), 0);
+
+    ctrl &= ~(0x7 << MSI_CTRL_MME_SHIFT);
+    ctrl |= (log2 << MSI_CTRL_MME_SHIFT) | MSI_CTRL_ENABLE;
+    pci_dev_write16(dev, cap + MSI_CTRL, ctrl);
+    pci_intx_disable(dev, 1);
+
+    dev->msi_cap = cap;
+    dev->msi_enabled = 1;
+    dev->msi_nvec = nvec;
+    dev->msi_vector = vector;
+    kdbg(KINFO, "pci_enable_msi: %02x:%02x.%d -> vectors %d..%d\n", dev->bus, dev->device,
+         dev->function, vector, vector + nvec - 1);
+    return vector;
+}
+
+void pci_disable_msi(struct pci_device* dev) {
+    if (!dev->msi_enabled) return;
+    uint16_t ctrl = pci_dev_read16(dev, dev->msi_cap + MSI_CTRL);
+    pci_dev_write16(dev, dev->msi_cap + MSI_CTRL, ctrl & ~MSI_CTRL_ENABLE);
+    pci_intx_disable(dev, 0);
+    irq_free_vectors(dev->msi_vector, dev->msi_nvec);
+    dev->msi_enabled = 0;
+    dev->msi_nvec = 0;
+}
+
+void pci_msi_mask(struct pci_device* dev, int index, int masked) {
+    if (!dev->msi_enabled || index < 0 || index >= dev->msi_nvec) return;
+    uint16_t ctrl = pci_dev_read16(dev, dev->msi_cap + MSI_CTRL);
+    if (!(ctrl & MSI_CTRL_MASKBIT)) return; // per-vector masking is optional
+    uint8_t off = dev->msi_cap + msi_mask_offset(ctrl);
+    uint64_t irqf = local_irq_save();
+    uint32_t bits = pci_dev_read32(dev, off);
+    if (masked) bits |= 1u << index;
+    else bits &= ~(1u << index);
+    pci_dev_write32(dev, off, bits);
+    local_irq_restore(irqf);
+}
+
+static volatile uint32_t* msix_entry(struct pci_device* dev, int entry) {
+    return dev->msix_table + entry * (MSIX_ENTRY_SIZE / 4);
+}
+
+int pci_enable_msix(struct pci_device* dev, int nvec) {
+    if (!lapic_enabled()) return -1;
+    if (dev->msi_enabled || dev->msix_enabled) return -2;
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSIX, 0);
+    if (!cap) return -3;
+
+    uint16_t ctrl = pci_dev_read16(dev, cap + MSIX_CTRL);
+    int size = MSIX_CTRL_SIZE(ctrl);
+    if (nvec < 1) nvec = 1;
+    if (nvec > size) nvec = size;
+    if (nvec > PCI_MSI_MAX_VECTORS) nvec = PCI_MSI_MAX_VECTORS;
+
+    uint32_t table = pci_dev_read32(dev, cap + MSIX_TABLE);
+    int bir = table & 0x7;
+    uint64_t base = pci_bar_address(dev, bir);
+    // only 0-4GB is mapped; a 64-bit BAR placed above it is left to MSI or INTx
+    if (!base || pci_bar_is_io(dev, bir) || base >= 0x100000000ULL) {
+        kdbg(KERR, "pci_enable_msix: table BAR%d unusable\n", bir);
+        return -5;
+    }
+    dev->msix_table = (volatile uint32_t*)(uintptr_t)(base + (table & ~0x7u));
+
+    // mask the whole function while the table is being programmed
+    pci_dev_write16(dev, cap + MSIX_CTRL, ctrl | MSIX_CTRL_ENABLE | MSIX_CTRL_FMASK);
+    uint16_t cmd = pci_dev_read16(dev, PCI_COMMAND);
+    pci_dev_write16(dev, PCI_COMMAND, cmd | PCI_COMMAND_MEMORY);
+
+    int i;
+    for (i = 0; i < nvec; i++) {
+        int vector = irq_alloc_vectors(1, 1);
+        if (vector < 0) break;
+        volatile uint32_t* e = msix_entry(dev, i);
+        e[3] |= MSIX_ENTRY_CTRL_MASK;
+        e[0] = msi_address();
+        e[1] = 0;
+        e[2] = msi_data(vector);
+        e[3] &= ~MSIX_ENTRY_CTRL_MASK;
+        dev->msix_vectors[i] = vector;
+    }
+    if (i == 0) {
+        pci_dev_write16(dev, cap + MSIX_CTRL, ctrl & ~(MSIX_CTRL_ENABLE | MSIX_CTRL_FMASK));
+        kdbg(KERR, "pci_enable_msix: no free vectors\n");
+        return -4;
+    }
+    // entries past nvec stay masked (reset default)
+    for (int j = i; j < size; j++)
+        msix_entry(dev, j)[3] |= MSIX_ENTRY_CTRL_MASK;
+
+    pci_intx_disable(dev, 1);
+    pci_dev_write16(dev, cap + MSIX_CTRL, (ctrl | MSIX_CTRL_ENABLE) & ~MSIX_CTRL_FMASK);
+
+    dev->msix_cap = cap;
+    dev->msix_enabled = 1;
+    dev->msix_nvec = i;
+    kdbg(KINFO, "pci_enable_msix: %02x:%02x.%d -> %d vectors from %d\n", dev->bus, dev->device,
+         dev->function, i, dev->msix_vectors[0]);
+    return i;
+}
+
+void pci_disable_msix(struct pci_device* dev) {
+    if (!dev->msix_enabled) return;
+    for (int i = 0; i < dev->msix_nvec; i++) {
+        msix_entry(dev, i)[3] |= MSIX_ENTRY_CTRL_MASK;
+        irq_free_vectors(dev->msix_vectors[i], 1);
+    }
+    uint16_t ctrl = pci_dev_read16(dev, dev->msix_cap + MSIX_CTRL);
+    pci_dev_write16(dev, dev->msix_cap + MSIX_CTRL, ctrl & ~MSIX_CTRL_ENABLE);
+    pci_intx_disable(dev, 0);
+    dev->msix_enabled = 0;
+    dev->msix_nvec = 0;
+}
+
+void pci_msix_mask(struct pci_device* dev, int entry, int masked) {
+    if (!dev->msix_enabled || entry < 0 || entry >= dev->msix_nvec) return;
+    volatile uint32_t* e = msix_entry(dev, entry);
+    if (masked) e[3] |= MSIX_ENTRY_CTRL_MASK;
+    else e[3] &= ~MSIX_ENTRY_CTRL_MASK;
+    (void)e[3]; // flush the posted write
+}
+
+int pci_irq_vector(struct pci_device* dev, int index) {
+    if (dev->msix_enabled)
+        return index >= 0 && index < dev->msix_nvec ? dev->msix_vectors[index] : -1;
+    if (dev->msi_enabled)
+        return index >= 0 && index < dev->msi_nvec ? dev->msi_vector + index : -1;
+    return -1;
+}
@@ -3,14 +3,21 @@
 #include <vga.h>
 #include <debug.h>
 #include <usb.h>
+#include <string.h>
 
-uint32_t pci_config_read32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
-    uint32_t address = (1U << 31)
+static struct pci_device pci_devices[PCI_MAX_DEVICES];
+static int pci_count = 0;
+
+static uint32_t pci_config_address(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
+    return (1U << 31)
         | ((uint32_t)bus << 16)
         | ((uint32_t)device << 11)
         | ((uint32_t)function << 8)
         | (offset & 0xFC);
-    outl(PCI_CONFIG_ADDRESS, address);
+}
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(bus, device, function, offset));
     return inl(PCI_CONFIG_DATA);
 }
 
@@ -24,6 +31,120 @@ uint8_t pci_config_read8(uint8_t bus, uint8_t device, uint8_t function, uint8_t
     return (value >> ((offset & 3) * 8)) & 0xFF;
 }
 
+void pci_config_write32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value) {
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(bus, device, function, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+void pci_config_write16(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint16_t value) {
+    uint32_t old = pci_config_read32(bus, device, function, offset);
+    int shift = (offset & 2) * 8;
+    old = (old & ~(0xFFFFu << shift)) | ((uint32_t)value << shift);
+    pci_config_write32(bus, device, function, offset, old);
+}
+
+void pci_config_write8(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint8_t value) {
+    uint32_t old = pci_config_read32(bus, device, function, offset);
+    int shift = (offset & 3) * 8;
+    old = (old & ~(0xFFu << shift)) | ((uint32_t)value << shift);
+    pci_config_write32(bus, device, function, offset, old);
+}
+
+uint32_t pci_dev_read32(struct pci_device* dev, uint8_t offset) {
+    return pci_config_read32(dev->bus, dev->device, dev->function, offset);
+}
+
+uint16_t pci_dev_read16(struct pci_device* dev, uint8_t offset) {
+    return pci_config_read16(dev->bus, dev->device, dev->function, offset);
+}
+
+uint8_t pci_dev_read8(struct pci_device* dev, uint8_t offset) {
+    return pci_config_read8(dev->bus, dev->device, dev->function, offset);
+}
+
+void pci_dev_write32(struct pci_device* dev, uint8_t offset, uint32_t value) {
+    pci_config_write32(dev->bus, dev->device, dev->function, offset, value);
+}
+
+void pci_dev_write16(struct pci_device* dev, uint8_t offset, uint16_t value) {
+    pci_config_write16(dev->bus, dev->device, dev->function, offset, value);
+}
+
+int pci_bar_is_io(struct pci_device* dev, int bar) {
+    return pci_dev_read32(dev, PCI_BAR0 + bar * 4) & 0x1;
+}
+
+uint64_t pci_bar_address(struct pci_device* dev, int bar) {
+    if (bar < 0 || bar > 5) return 0;
+    uint32_t lo = pci_dev_read32(dev, PCI_BAR0 + bar * 4);
+    if (lo & 0x1) return lo & ~0x3u;
+    uint64_t addr = lo & ~0xFu;
+    if (((lo >> 1) & 0x3) == 0x2 && bar < 5) // 64-bit memory BAR
+        addr |= (uint64_t)pci_dev_read32(dev, PCI_BAR0 + (bar + 1) * 4) << 32;
+    return addr;
+}
+
+void pci_enable_bus_master(struct pci_device* dev) {
+    uint16_t cmd = pci_dev_read16(dev, PCI_COMMAND);
+    pci_dev_write16(dev, PCI_COMMAND, cmd | PCI_COMMAND_MASTER | PCI_COMMAND_MEMORY | PCI_COMMAND_IO);
+}
+
+uint8_t pci_find_capability(struct pci_device* dev, uint8_t cap_id, uint8_t start) {
+    if (!(pci_dev_read16(dev, PCI_STATUS) & PCI_STATUS_CAP_LIST)) return 0;
+    uint8_t ptr = start ? pci_dev_read8(dev, start + 1) : pci_dev_read8(dev, PCI_CAP_PTR);
+    // a well-formed list has at most 48 entries; the bound stops broken loops
+    for (int guard = 0; ptr >= 0x40 && guard < 48; guard++) {
+        ptr &= 0xFC;
+        if (pci_dev_read8(dev, ptr) == cap_id) return ptr;
+        ptr = pci_dev_read8(dev, ptr + 1);
+    }
+    return 0;
+}
+
+int pci_device_count(void) {
+    return pci_count;
+}
+
+struct pci_device* pci_get_device(int index) {
+    if (index < 0 || index >= pci_count) return 0;
+    return &pci_devices[index];
+}
+
+struct pci_device* pci_find_device(uint16_t vendor_id, uint16_t device_id, int nth) {
+    for (int i = 0; i < pci_count; i++) {
+        if (pci_devices[i].vendor_id == vendor_id && pci_devices[i].device_id == device_id && nth-- == 0)
+            return &pci_devices[i];
+    }
+    return 0;
+}
+
+struct pci_device* pci_find_class(uint8_t class_code, uint8_t subclass, int nth) {
+    for (int i = 0; i < pci_count; i++) {
+        if (pci_devices[i].class_code == class_code && pci_devices[i].subclass == subclass && nth-- == 0)
+            return &pci_devices[i];
+    }
+    return 0;
+}
+
+static void pci_add_device(uint8_t bus, uint8_t device, uint8_t function, uint16_t vendor_id, uint16_t device_id,
+                           uint8_t class_code, uint8_t subclass, uint8_t prog_if, uint8_t revision_id) {
+    if (pci_count >= PCI_MAX_DEVICES) return;
+    struct pci_device* dev = &pci_devices[pci_count++];
+    memset(dev, 0, sizeof(*dev));
+    dev->bus = bus;
+    dev->device = device;
+    dev->function = function;
+    dev->vendor_id = vendor_id;
+    dev->device_id = device_id;
+    dev->class_code = class_code;
+    dev->subclass = subclass;
+    dev->prog_if = prog_if;
+    dev->revision_id = revision_id;
+    dev->irq_line = pci_config_read8(bus, device, function, PCI_INTERRUPT_LINE);
+    dev->msi_cap = pci_find_capability(dev, PCI_CAP_ID_MSI, 0);
+    dev->msix_cap = pci_find_capability(dev, PCI_CAP_ID_MSIX, 0);
+}
+
 static void pci_print_device(uint8_t bus, uint8_t device, uint8_t function) {
     uint16_t vendor_id = pci_config_read16(bus, device, function, 0x00);
     if (vendor_id == 0xFFFF) return;
@@ -33,6 +154,7 @@ static void pci_print_device(uint8_t bus, uint8_t device, uint8_t function) {
     uint8_t prog_if = pci_config_read8(bus, device, function, 0x09);
     uint8_t revision_id = pci_config_read8(bus, device, function, 0x08);
     kdbg(KINFO, "pci: %04x:%04x bus=%04x func=%04x cl=%04x subcl=%04x\n", vendor_id, device_id, bus, function, class_code, subclass);
+    pci_add_device(bus, device, function, vendor_id, device_id, class_code, subclass, prog_if, revision_id);
 
     // Handle USB Host Controllers
     if (class_code == 0x0C && subclass == 0x03) { // Serial Bus Controller -> USB
@@ -43,6 +165,7 @@ static void pci_print_device(uint8_t bus, uint8_t device, uint8_t function) {
 }
 
 void pci_init() {
+    pci_count = 0;
     for (uint8_t bus = 0; bus < 2; ++bus) {
         for (uint8_t device = 0; device < 32; ++device) {
             uint16_t vendor_id = pci_config_read16(bus, device, 0, 0x00);
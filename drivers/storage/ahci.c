@@ -0,0 +1,418 @@
+#include <ahci.h>
+#include <ata.h>
+#include <block.h>
+#include <pci.h>
+#include <irq.h>
+#include <irqflags.h>
+#include <heap.h>
+#include <string.h>
+#include <debug.h>
+#include <vga.h>
+#include <waitqueue.h>
+#include <stddef.h>
+
+#define AHCI_TIMEOUT_MS   5000
+#define AHCI_SPIN         1000000
+#define AHCI_MAX_SECTORS  65536 // 16-bit count, 0 means 65536
+#define AHCI_MAX_BYTES    (AHCI_MAX_SECTORS * 512u)
+
+typedef struct {
+    int num;
+    volatile uint8_t* regs;
+    ahci_cmd_header_t* clb;
+    uint8_t* fb;
+    ahci_cmd_table_t* tables;
+    int ncq;                    // READ/WRITE FPDMA QUEUED usable
+    int depth;                  // command slots in use at most
+    uint32_t slots_busy;        // allocated to a request
+    uint32_t active;            // issued to the HBA, not completed yet
+    volatile int done[AHCI_MAX_SLOTS];
+    volatile int error[AHCI_MAX_SLOTS];
+    volatile int slot_free;
+    waitqueue_t slot_wq;        // requests waiting for a free slot
+    waitqueue_t done_wq;        // requests waiting for their slot to complete
+    uint64_t sectors;
+    char model[41];
+    block_device_t blk;
+} ahci_port_t;
+
+typedef struct {
+    struct pci_device* pci;
+    volatile uint8_t* abar;
+    uint32_t cap;
+    int irq;                    // completion interrupt installed
+    ahci_port_t* ports[AHCI_MAX_PORTS];
+} ahci_hba_t;
+
+static ahci_hba_t hba;
+
+static inline uint32_t hba_read(uint32_t reg) {
+    return *(volatile uint32_t*)(hba.abar + reg);
+}
+
+static inline void hba_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(hba.abar + reg) = value;
+}
+
+static inline uint32_t port_read(ahci_port_t* p, uint32_t reg) {
+    return *(volatile uint32_t*)(p->regs + reg);
+}
+
+static inline void port_write(ahci_port_t* p, uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(p->regs + reg) = value;
+}
+
+static void ahci_port_stop(ahci_port_t* p) {
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+    for (int i = 0; i < AHCI_SPIN && (port_read(p, AHCI_PxCMD) & AHCI_PxCMD_CR); i++) { }
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+    for (int i = 0; i < AHCI_SPIN && (port_read(p, AHCI_PxCMD) & AHCI_PxCMD_FR); i++) { }
+}
+
+static void ahci_port_start(ahci_port_t* p) {
+    for (int i = 0; i < AHCI_SPIN && (port_read(p, AHCI_PxTFD) & (ATA_SR_BSY | ATA_SR_DRQ)); i++) { }
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) | AHCI_PxCMD_FRE);
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) | AHCI_PxCMD_ST);
+}
+
+// an error or timeout aborts the whole NCQ queue: fail everything in flight
+// and restart the command engine. Interrupts must be off.
+static void ahci_port_fail_all(ahci_port_t* p) {
+    kdbg(KERR, "ahci: port %d: error, tfd 0x%x serr 0x%x, failing 0x%x\n", p->num,
+         port_read(p, AHCI_PxTFD), port_read(p, AHCI_PxSERR), p->active);
+    ahci_port_stop(p);
+    port_write(p, AHCI_PxSERR, 0xFFFFFFFF);
+    port_write(p, AHCI_PxIS, 0xFFFFFFFF);
+    ahci_port_start(p);
+    for (int s = 0; s < AHCI_MAX_SLOTS; s++) {
+        if (!(p->active & (1u << s))) continue;
+        p->error[s] = 1;
+        p->done[s] = 1;
+    }
+    p->active = 0;
+    waitqueue_wake_all(&p->done_wq);
+}
+
+// reap finished slots; called from the interrupt handler or when polling
+static void ahci_port_complete(ahci_port_t* p) {
+    uint32_t is = port_read(p, AHCI_PxIS);
+    port_write(p, AHCI_PxIS, is);
+    if (is & AHCI_PxIS_ERROR) {
+        ahci_port_fail_all(p);
+        return;
+    }
+    uint32_t finished = p->active & ~(port_read(p, AHCI_PxSACT) | port_read(p, AHCI_PxCI));
+    if (!finished) return;
+    p->active &= ~finished;
+    for (int s = 0; s < AHCI_MAX_SLOTS; s++)
+        if (finished & (1u << s)) p->done[s] = 1;
+    waitqueue_wake_all(&p->done_wq);
+}
+
+static irqreturn_t ahci_irq_handler(cpu_registers_t* regs, void* cookie) {
+    uint32_t is = hba_read(AHCI_IS);
+    if (!is) return IRQ_NONE;
+    for (int i = 0; i < AHCI_MAX_PORTS; i++)
+        if ((is & (1u << i)) && hba.ports[i]) ahci_port_complete(hba.ports[i]);
+    hba_write(AHCI_IS, is); // port status first, then the summary bit
+    return IRQ_HANDLED;
+}
+
+static int ahci_get_slot(ahci_port_t* p) {
+    uint32_t usable = p->depth >= 32 ? 0xFFFFFFFF : (1u << p->depth) - 1;
+    for (;;) {
+        uint64_t irqf = local_irq_save();
+        uint32_t free = usable & ~p->slots_busy;
+        if (free) {
+            int slot = __builtin_ctz(free);
+            p->slots_busy |= 1u << slot;
+            local_irq_restore(irqf);
+            return slot;
+        }
+        p->slot_free = 0;
+        local_irq_restore(irqf);
+        // the slots' holders cannot run while this caller spins
+        if (!waitqueue_can_sleep()) {
+            kdbg(KERR, "ahci: port %d: no free slot and cannot sleep\n", p->num);
+            return -1;
+        }
+        waitqueue_wait(&p->slot_wq, &p->slot_free, 0);
+    }
+}
+
+static void ahci_put_slot(ahci_port_t* p, int slot) {
+    uint64_t irqf = local_irq_save();
+    p->slots_busy &= ~(1u << slot);
+    p->slot_free = 1;
+    waitqueue_wake_all(&p->slot_wq);
+    local_irq_restore(irqf);
+}
+
+static int ahci_build(ahci_port_t* p, int slot, uint8_t cmd, uint64_t lba, uint32_t count,
+                      const iovec_t* iov, int iovcnt, int write, int ncq) {
+    ahci_cmd_table_t* t = &p->tables[slot];
+    memset(t, 0, offsetof(ahci_cmd_table_t, prdt));
+    if (iovcnt > AHCI_PRDT_ENTRIES) return -1;
+    for (int i = 0; i < iovcnt; i++) {
+        uint64_t addr = (uintptr_t)iov[i].base;
+        if ((addr & 1) || !iov[i].len || iov[i].len > AHCI_PRD_MAX_BYTES) return -1;
+        t->prdt[i].dba = (uint32_t)addr;
+        t->prdt[i].dbau = (uint32_t)(addr >> 32);
+        t->prdt[i].reserved = 0;
+        t->prdt[i].dbc = iov[i].len - 1;
+    }
+
+    uint8_t* fis = t->cfis;
+    fis[0] = FIS_TYPE_REG_H2D;
+    fis[1] = 0x80; // command, not control
+    fis[2] = cmd;
+    fis[4] = lba & 0xFF;
+    fis[5] = (lba >> 8) & 0xFF;
+    fis[6] = (lba >> 16) & 0xFF;
+    fis[7] = cmd == ATA_CMD_IDENTIFY ? 0 : 0x40; // LBA mode
+    fis[8] = (lba >> 24) & 0xFF;
+    fis[9] = (lba >> 32) & 0xFF;
+    fis[10] = (lba >> 40) & 0xFF;
+    if (ncq) {
+        // FPDMA: the sector count moves to the features field, the tag into count
+        fis[3] = count & 0xFF;
+        fis[11] = (count >> 8) & 0xFF;
+        fis[12] = slot << 3;
+    } else {
+        fis[12] = count & 0xFF;
+        fis[13] = (count >> 8) & 0xFF;
+    }
+
+    ahci_cmd_header_t* h = &p->clb[slot];
+    h->flags = AHCI_H2D_FIS_DWORDS | (write ? AHCI_CMD_WRITE : 0);
+    h->prdtl = iovcnt;
+    h->prdbc = 0;
+    return 0;
+}
+
+static int ahci_exec(ahci_port_t* p, int slot, int ncq) {
+    uint64_t irqf = local_irq_save();
+    p->done[slot] = 0;
+    p->error[slot] = 0;
+    p->active |= 1u << slot;
+    if (ncq) port_write(p, AHCI_PxSACT, 1u << slot);
+    port_write(p, AHCI_PxCI, 1u << slot);
+    local_irq_restore(irqf);
+
+    if (hba.irq && waitqueue_can_sleep()) {
+        if (waitqueue_wait(&p->done_wq, &p->done[slot], AHCI_TIMEOUT_MS) != 0) {
+            irqf = local_irq_save();
+            if (!p->done[slot]) ahci_port_fail_all(p);
+            local_irq_restore(irqf);
+        }
+    } else {
+        // boot and mount run with interrupts off: reap completions by hand
+        for (uint32_t spin = 0; !p->done[slot]; spin++) {
+            irqf = local_irq_save();
+            ahci_port_complete(p);
+            if (!p->done[slot] && spin > AHCI_SPIN * 10) ahci_port_fail_all(p);
+            local_irq_restore(irqf);
+        }
+    }
+    return p->error[slot] ? -1 : 0;
+}
+
+static int ahci_rw(ahci_port_t* p, uint64_t lba, uint32_t count, const iovec_t* iov, int iovcnt, int write) {
+    uint8_t cmd;
+    if (p->ncq) cmd = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+    else cmd = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+
+    int slot = ahci_get_slot(p);
+    if (slot < 0) return -1;
+    int rc = ahci_build(p, slot, cmd, lba, count, iov, iovcnt, write, p->ncq);
+    if (rc == 0) rc = ahci_exec(p, slot, p->ncq);
+    ahci_put_slot(p, slot);
+    return rc;
+}
+
+// split the request into commands of at most AHCI_PRDT_ENTRIES regions and 65536 sectors
+static int ahci_transfer(block_device_t* dev, uint64_t lba, const iovec_t* iov, int iovcnt, int write) {
+    ahci_port_t* p = dev->priv;
+    int idx = 0;
+    uint32_t off = 0;
+    while (idx < iovcnt) {
+        iovec_t part[AHCI_PRDT_ENTRIES];
+        int n = 0;
+        uint32_t bytes = 0;
+        while (idx < iovcnt && n < AHCI_PRDT_ENTRIES && bytes < AHCI_MAX_BYTES) {
+            uint32_t len = iov[idx].len - off;
+            if (len > AHCI_PRD_MAX_BYTES) len = AHCI_PRD_MAX_BYTES;
+            if (len > AHCI_MAX_BYTES - bytes) len = AHCI_MAX_BYTES - bytes;
+            part[n].base = (uint8_t*)iov[idx].base + off;
+            part[n].len = len;
+            n++;
+            bytes += len;
+            off += len;
+            if (off == iov[idx].len) { idx++; off = 0; }
+        }
+        if (!bytes) continue;
+        if (ahci_rw(p, lba, bytes / 512, part, n, write)) return -1;
+        lba += bytes / 512;
+    }
+    return 0;
+}
+
+static int ahci_flush(block_device_t* dev) {
+    ahci_port_t* p = dev->priv;
+    int slot = ahci_get_slot(p);
+    if (slot < 0) return -1;
+    int rc = ahci_build(p, slot, ATA_CMD_FLUSH_CACHE_EXT, 0, 0, NULL, 0, 0, 0);
+    if (rc == 0) rc = ahci_exec(p, slot, 0);
+    ahci_put_slot(p, slot);
+    return rc;
+}
+
+static const block_ops_t ahci_ops = {
+    .submit = ahci_transfer,
+    .flush = ahci_flush,
+};
+
+static int ahci_identify(ahci_port_t* p, uint16_t* id) {
+    iovec_t iov = { id, 512 };
+    int slot = ahci_get_slot(p);
+    if (slot < 0) return -1;
+    int rc = ahci_build(p, slot, ATA_CMD_IDENTIFY, 0, 0, &iov, 1, 0, 0);
+    if (rc == 0) rc = ahci_exec(p, slot, 0);
+    ahci_put_slot(p, slot);
+    return rc;
+}
+
+// undo a failed ahci_port_init: quiesce the port, then free it
+static void ahci_port_release(int n, ahci_port_t* p, uint16_t* id) {
+    port_write(p, AHCI_PxIE, 0);
+    ahci_port_stop(p);
+    uint64_t irqf = local_irq_save();
+    port_write(p, AHCI_PxIS, 0xFFFFFFFF);
+    hba_write(AHCI_IS, 1u << n);
+    hba.ports[n] = NULL;
+    local_irq_restore(irqf);
+    kfree_aligned(p->clb);
+    kfree_aligned(p->fb);
+    kfree_aligned(p->tables);
+    kfree(id);
+    kfree(p);
+}
+
+static void ahci_port_init(int n) {
+    volatile uint8_t* regs = hba.abar + AHCI_PORT(n);
+    uint32_t ssts = *(volatile uint32_t*)(regs + AHCI_PxSSTS);
+    uint32_t sig = *(volatile uint32_t*)(regs + AHCI_PxSIG);
+    if ((ssts & 0xF) != AHCI_SSTS_DET_PRESENT) return;
+    if (sig != AHCI_SIG_ATA) {
+        kdbg(KINFO, "ahci: port %d: signature 0x%08x, not a disk\n", n, sig);
+        return;
+    }
+
+    ahci_port_t* p = kmalloc(sizeof(ahci_port_t));
+    uint16_t* id = kmalloc(512);
+    if (!p || !id) { kfree(p); kfree(id); return; }
+    memset(p, 0, sizeof(*p));
+    p->num = n;
+    p->regs = regs;
+    p->depth = AHCI_CAP_NCS(hba.cap);
+    waitqueue_init(&p->slot_wq);
+    waitqueue_init(&p->done_wq);
+
+    ahci_port_stop(p);
+    p->clb = kmalloc_aligned(sizeof(ahci_cmd_header_t) * AHCI_MAX_SLOTS, 1024);
+    p->fb = kmalloc_aligned(256, 256);
+    p->tables = kmalloc_aligned(sizeof(ahci_cmd_table_t) * AHCI_MAX_SLOTS, 128);
+    if (!p->clb || !p->fb || !p->tables) {
+        kdbg(KERR, "ahci: port %d: out of memory\n", n);
+        ahci_port_release(n, p, id);
+        return;
+    }
+    memset(p->clb, 0, sizeof(ahci_cmd_header_t) * AHCI_MAX_SLOTS);
+    memset(p->fb, 0, 256);
+    memset(p->tables, 0, sizeof(ahci_cmd_table_t) * AHCI_MAX_SLOTS);
+    for (int s = 0; s < AHCI_MAX_SLOTS; s++) {
+        uint64_t ct = (uintptr_t)&p->tables[s];
+        p->clb[s].ctba = (uint32_t)ct;
+        p->clb[s].ctbau = (uint32_t)(ct >> 32);
+    }
+    port_write(p, AHCI_PxCLB, (uint32_t)(uintptr_t)p->clb);
+    port_write(p, AHCI_PxCLBU, (uint32_t)((uint64_t)(uintptr_t)p->clb >> 32));
+    port_write(p, AHCI_PxFB, (uint32_t)(uintptr_t)p->fb);
+    port_write(p, AHCI_PxFBU, (uint32_t)((uint64_t)(uintptr_t)p->fb >> 32));
+    port_write(p, AHCI_PxSERR, 0xFFFFFFFF);
+    port_write(p, AHCI_PxIS, 0xFFFFFFFF);
+    port_write(p, AHCI_PxIE, AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_SDBS | AHCI_PxIS_ERROR);
+    hba.ports[n] = p;
+    ahci_port_start(p);
+
+    if (ahci_identify(p, id) != 0) {
+        kdbg(KERR, "ahci: port %d: identify failed\n", n);
+        ahci_port_release(n, p, id);
+        return;
+    }
+    if ((id[83] >> 10) & 1)
+        p->sectors = *(uint64_t*)&id[100];
+    else
+        p->sectors = *(uint32_t*)&id[60];
+    // NCQ: IDENTIFY word 76 bit 8, queue depth - 1 in word 75
+    p->ncq = (hba.cap & AHCI_CAP_SNCQ) && ((id[76] >> 8) & 1);
+    if (p->ncq && (id[75] & 0x1F) + 1 < p->depth)
+        p->depth = (id[75] & 0x1F) + 1;
+    for (int i = 0; i < 20; i++) {
+        p->model[i * 2] = id[27 + i] >> 8;
+        p->model[i * 2 + 1] = id[27 + i] & 0xFF;
+    }
+    p->model[40] = 0;
+    trim(p->model);
+    kfree(id);
+
+    snprintf(p->blk.name, sizeof(p->blk.name), "ahci%d", n);
+    memcpy(p->blk.model, p->model, sizeof(p->blk.model));
+    p->blk.sector_size = 512;
+    p->blk.sectors = p->sectors;
+    p->blk.limits.max_sectors = AHCI_MAX_SECTORS;
+    p->blk.limits.max_segments = AHCI_PRDT_ENTRIES;
+    p->blk.limits.queue_depth = p->depth;
+    p->blk.ops = &ahci_ops;
+    p->blk.priv = p;
+    int drive = block_register(&p->blk);
+    kdbg(KINFO, "ahci: port %d: %s, %s depth %d -> disk %d\n", n, p->model,
+         p->ncq ? "ncq" : "dma", p->depth, drive);
+}
+
+void ahci_init(void) {
+    struct pci_device* dev = pci_find_class(0x01, 0x06, 0);
+    if (!dev) return;
+    uint64_t bar = pci_bar_address(dev, 5);
+    if (!bar || pci_bar_is_io(dev, 5)) {
+        kdbg(KWARN, "ahci: controller without ABAR\n");
+        return;
+    }
+    memset(&hba, 0, sizeof(hba));
+    hba.pci = dev;
+    hba.abar = (volatile uint8_t*)(uintptr_t)bar; // below 4GB, identity mapped
+    pci_enable_bus_master(dev);
+
+    hba_write(AHCI_GHC, hba_read(AHCI_GHC) | AHCI_GHC_AE);
+    hba.cap = hba_read(AHCI_CAP);
+    uint32_t pi = hba_read(AHCI_PI);
+    uint32_t vs = hba_read(AHCI_VS);
+    kdbg(KINFO, "ahci: version %d.%d, %d ports, %d slots%s\n", vs >> 16, (vs >> 8) & 0xFF,
+         AHCI_CAP_NP(hba.cap) + 1, AHCI_CAP_NCS(hba.cap), (hba.cap & AHCI_CAP_SNCQ) ? ", ncq" : "");
+
+    // MSI when the LAPIC is up, the shared legacy line otherwise
+    int vector = pci_enable_msi(dev, 1);
+    uint32_t flags = 0;
+    if (vector < 0 && dev->irq_line < 16) {
+        vector = 32 + dev->irq_line;
+        flags = IRQF_SHARED;
+    }
+    if (vector >= 0 && irq_request(vector, ahci_irq_handler, flags, "ahci", &hba) == 0)
+        hba.irq = 1;
+
+    for (int i = 0; i < AHCI_MAX_PORTS; i++)
+        if (pi & (1u << i)) ahci_port_init(i);
+
+    hba_write(AHCI_IS, 0xFFFFFFFF);
+    if (hba.irq) hba_write(AHCI_GHC, hba_read(AHCI_GHC) | AHCI_GHC_IE);
+}
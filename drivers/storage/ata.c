@@ -3,8 +3,41 @@
 #include <string.h>
 #include <debug.h>
 #include <vga.h>
-
-static ata_drive_t drives[4];
+#include <pci.h>
+#include <irq.h>
+#include <heap.h>
+#include <cpu.h>
+#include <waitqueue.h>
+#include <mutex.h>
+#include <block.h>
+
+#define ATA_TIMEOUT_MS 5000
+
+enum { ATA_MODE_IDLE, ATA_MODE_PIO, ATA_MODE_DMA };
+
+typedef struct {
+    uint16_t base;
+    uint16_t ctrl;
+    uint16_t bmide;           // bus-master registers, 0 without a controller
+    uint8_t vector;           // legacy IRQ14/15 in compatibility mode
+    uint8_t irq_ready;        // handler installed, commands may sleep
+    volatile uint8_t mode;    // what the command in flight expects from INTRQ
+    ata_prd_t* prd;
+    volatile int irq_done;
+    volatile uint8_t bm_status;
+    waitqueue_t wq;           // the thread waiting for this channel's interrupt
+    mutex_t lock;             // one command per channel, channels run in parallel
+} ata_channel_t;
+
+static irqreturn_t ata_irq_handler(cpu_registers_t* regs, void* cookie);
+static void ata_register_block(uint8_t drive);
+
+static ata_drive_t drives[ATA_MAX_DRIVES];
+static block_device_t ata_blk[ATA_MAX_DRIVES];
+static ata_channel_t channels[2] = {
+    { .base = ATA_PRIMARY_BASE,   .ctrl = ATA_CONTROL_BASE,      .vector = 46 },
+    { .base = ATA_SECONDARY_BASE, .ctrl = ATA_SECONDARY_CONTROL, .vector = 47 },
+};
 
 static void ata_wait(uint16_t base) {
     uint8_t status; uint32_t timeout=1000000;
@@ -28,7 +61,55 @@ static void ata_select_drive(uint16_t base, uint8_t drive) {
     ata_wait(base);
 }
 
-static int ata_init_drive(uint16_t base, uint8_t drive) {
+static uint16_t ata_control_port(uint16_t base) {
+    return base == ATA_PRIMARY_BASE ? ATA_CONTROL_BASE : ATA_SECONDARY_CONTROL;
+}
+
+// reading alternate status four times gives the drive its 400ns to update status
+static void ata_delay400(uint16_t base) {
+    uint16_t ctrl = ata_control_port(base);
+    for (int i = 0; i < 4; i++) inb(ctrl);
+}
+
+// wait for a data block: 0 when DRQ is up, -1 on error, fault or timeout
+static int ata_wait_drq(uint16_t base) {
+    uint32_t timeout = 1000000;
+    uint8_t status;
+    do {
+        status = inb(base + ATA_STATUS);
+        if (!(status & ATA_SR_BSY)) {
+            if (status & (ATA_SR_ERR | ATA_SR_DF)) return -1;
+            if (status & ATA_SR_DRQ) return 0;
+        }
+    } while (--timeout);
+    return -1;
+}
+
+static int ata_wait_idle(uint16_t base) {
+    uint32_t timeout = 1000000;
+    uint8_t status;
+    do {
+        status = inb(base + ATA_STATUS);
+    } while ((status & ATA_SR_BSY) && --timeout);
+    if (!timeout || (status & (ATA_SR_ERR | ATA_SR_DF))) return -1;
+    return 0;
+}
+
+static void ata_set_multiple(uint16_t base, uint8_t index, const uint16_t* id) {
+    uint8_t max = id[47] & 0xFF; // largest DRQ block READ/WRITE MULTIPLE accepts
+    drives[index].multiple = 1;
+    if (max < 2) return;
+
+    ata_select_drive(base, index % 2);
+    outb(base + ATA_SECTOR_COUNT, max);
+    outb(base + ATA_COMMAND, ATA_CMD_SET_MULTIPLE);
+    ata_delay400(base);
+    if (ata_wait_idle(base) == 0)
+        drives[index].multiple = max;
+}
+
+static int ata_init_drive(uint16_t base, uint8_t index) {
+    uint8_t drive = index % 2;
     ata_select_drive(base, drive);
     
     outb(base + ATA_COMMAND, ATA_CMD_IDENTIFY);
@@ -55,9 +136,15 @@ static int ata_init_drive(uint16_t base, uint8_t drive) {
         buffer[i] = inw(base + ATA_DATA);
     }
 
+    drive = index;
     drives[drive].present = 1;
     drives[drive].type = 1; // ATA
-    drives[drive].sectors = *(uint32_t*)&buffer[60];
+    drives[drive].lba48 = (buffer[83] >> 10) & 1;
+    drives[drive].dma = (buffer[49] >> 8) & 1; // cleared again if no bus-master controller
+    if (drives[drive].lba48)
+        drives[drive].sectors = *(uint64_t*)&buffer[100];
+    else
+        drives[drive].sectors = *(uint32_t*)&buffer[60];
     drives[drive].size = drives[drive].sectors * 512;
 
     char model[41] = {0};
@@ -94,6 +181,7 @@ static int ata_init_drive(uint16_t base, uint8_t drive) {
     strncpy(drives[drive].vendor, vendor_name, 40);
     drives[drive].vendor[40] = 0;
 
+    ata_set_multiple(base, index, buffer);
     return 0;
 }
 
@@ -152,90 +240,395 @@ static int ata_identify_device(uint16_t base, uint8_t drive, char* model) {
     return 0;
 }
 
+// PIIX-style controller in compatibility mode: legacy ports and IRQ14/15, bus master at BAR4
+static void ata_channel_init(void) {
+    struct pci_device* dev = pci_find_class(0x01, 0x01, 0);
+    int usable = dev && (dev->prog_if & 0x80) && pci_bar_is_io(dev, 4);
+    uint16_t bm = usable ? (uint16_t)pci_bar_address(dev, 4) : 0;
+    if (usable) pci_enable_bus_master(dev);
+
+    for (int c = 0; c < 2; c++) {
+        ata_channel_t* ch = &channels[c];
+        waitqueue_init(&ch->wq);
+        mutex_init(&ch->lock);
+        if (!drives[c * 2].present && !drives[c * 2 + 1].present) continue;
+        outb(ch->ctrl, 0); // nIEN clear: the drive interrupts on completion
+        ch->irq_ready = irq_request(ch->vector, ata_irq_handler, 0, c ? "ata1" : "ata0", ch) == 0;
+
+        int native = dev && (dev->prog_if & (1 << (c * 2)));
+        if (usable && !native) {
+            // 2K table, aligned to its size so it never crosses a 64K boundary
+            ch->prd = kmalloc_aligned(sizeof(ata_prd_t) * ATA_PRD_ENTRIES, sizeof(ata_prd_t) * ATA_PRD_ENTRIES);
+            if (ch->prd) ch->bmide = bm + c * 8;
+        }
+        for (int d = c * 2; d < c * 2 + 2; d++) {
+            if (!ch->bmide) drives[d].dma = 0;
+            if (drives[d].present)
+                kdbg(KINFO, "ata %d: %s\n", d, drives[d].dma ? "bus-master dma" : "pio");
+        }
+    }
+}
+
 void ata_init() {
     memset(drives, 0, sizeof(drives));
     if (ata_init_drive(ATA_PRIMARY_BASE, 0) == 0) {
-        kdbg(KINFO, "ata 0: %s, ven: %s, ser: %s, sec: %u\n", 
-            drives[0].name, drives[0].vendor, drives[0].serial, drives[0].sectors);
+        kdbg(KINFO, "ata 0: %s, ven: %s, ser: %s, sec: %llu, mult: %u%s\n", 
+            drives[0].name, drives[0].vendor, drives[0].serial, drives[0].sectors,
+            drives[0].multiple, drives[0].lba48 ? ", lba48" : "");
     }
     
     if (ata_init_drive(ATA_PRIMARY_BASE, 1) == 0) {
-        kdbg(KINFO, "ata 1: %s, ven: %s, ser: %s, sec: %u\n", 
-            drives[1].name, drives[1].vendor, drives[1].serial, drives[1].sectors);
+        kdbg(KINFO, "ata 1: %s, ven: %s, ser: %s, sec: %llu, mult: %u%s\n", 
+            drives[1].name, drives[1].vendor, drives[1].serial, drives[1].sectors,
+            drives[1].multiple, drives[1].lba48 ? ", lba48" : "");
     }
     
-    if (ata_init_drive(ATA_SECONDARY_BASE, 0) == 0) {
-        kdbg(KINFO, "ata 2: %s, ven: %s, ser: %s, sec: %u\n", 
-            drives[2].name, drives[2].vendor, drives[2].serial, drives[2].sectors);
+    if (ata_init_drive(ATA_SECONDARY_BASE, 2) == 0) {
+        kdbg(KINFO, "ata 2: %s, ven: %s, ser: %s, sec: %llu, mult: %u%s\n", 
+            drives[2].name, drives[2].vendor, drives[2].serial, drives[2].sectors,
+            drives[2].multiple, drives[2].lba48 ? ", lba48" : "");
     }
     
-    if (ata_init_drive(ATA_SECONDARY_BASE, 1) == 0) {
-        kdbg(KINFO, "ata 3: %s, ven: %s, ser: %s, sec: %u\n", 
-            drives[3].name, drives[3].vendor, drives[3].serial, drives[3].sectors);
+    if (ata_init_drive(ATA_SECONDARY_BASE, 3) == 0) {
+        kdbg(KINFO, "ata 3: %s, ven: %s, ser: %s, sec: %llu, mult: %u%s\n", 
+            drives[3].name, drives[3].vendor, drives[3].serial, drives[3].sectors,
+            drives[3].multiple, drives[3].lba48 ? ", lba48" : "");
     }
+
+    ata_channel_init();
+    for (int i = 0; i < ATA_MAX_DRIVES; i++)
+        if (drives[i].present) ata_register_block(i);
 }
 
-int ata_read_sector(uint8_t drive, uint32_t lba, uint8_t* buffer) {
-    if (drive >= 4 || !drives[drive].present) return -1;
-    uint16_t base = (drive < 2) ? ATA_PRIMARY_BASE : ATA_SECONDARY_BASE;
-    drive = drive % 2;
+// sleep until the channel interrupts. Status is still checked by the caller
+// afterwards, so a lost interrupt costs the timeout, not the command.
+// Interrupts are off during boot and mount; the caller then just polls.
+static void ata_wait_irq(ata_channel_t* ch) {
+    if (!ch->irq_ready || !waitqueue_can_sleep()) return;
+    waitqueue_wait(&ch->wq, &ch->irq_done, ATA_TIMEOUT_MS);
+    ch->irq_done = 0;
+}
 
+static void ata_issue(uint16_t base, uint8_t drive, uint64_t lba, uint32_t count, int ext, uint8_t cmd) {
     ata_select_drive(base, drive);
+    if (ext) {
+        // high-order bytes first, each register is a two-deep FIFO
+        outb(base + ATA_DRIVE, 0x40 | (drive << 4));
+        outb(base + ATA_SECTOR_COUNT, (count >> 8) & 0xFF);
+        outb(base + ATA_SECTOR_NUM, (lba >> 24) & 0xFF);
+        outb(base + ATA_CYL_LOW, (lba >> 32) & 0xFF);
+        outb(base + ATA_CYL_HIGH, (lba >> 40) & 0xFF);
+        outb(base + ATA_SECTOR_COUNT, count & 0xFF);
+        outb(base + ATA_SECTOR_NUM, lba & 0xFF);
+        outb(base + ATA_CYL_LOW, (lba >> 8) & 0xFF);
+        outb(base + ATA_CYL_HIGH, (lba >> 16) & 0xFF);
+    } else {
+        outb(base + ATA_SECTOR_COUNT, count & 0xFF);
+        outb(base + ATA_SECTOR_NUM, lba & 0xFF);
+        outb(base + ATA_CYL_LOW, (lba >> 8) & 0xFF);
+        outb(base + ATA_CYL_HIGH, (lba >> 16) & 0xFF);
+        outb(base + ATA_DRIVE, 0xE0 | (drive << 4) | ((lba >> 24) & 0x0F));
+    }
+    outb(base + ATA_COMMAND, cmd);
+    ata_delay400(base);
+}
 
-    outb(base + ATA_SECTOR_COUNT, 1);
-    outb(base + ATA_SECTOR_NUM, lba & 0xFF);
-    outb(base + ATA_CYL_LOW, (lba >> 8) & 0xFF);
-    outb(base + ATA_CYL_HIGH, (lba >> 16) & 0xFF);
-    outb(base + ATA_DRIVE, 0xE0 | (drive << 4) | ((lba >> 24) & 0x0F));
-
-    outb(base + ATA_COMMAND, ATA_CMD_READ);
-    ata_wait(base);
+// one command: up to 256 sectors with LBA28, 65536 with LBA48
+static int ata_pio_command(uint8_t index, uint64_t lba, uint32_t count, uint8_t* buffer, int write) {
+    ata_drive_t* d = &drives[index];
+    ata_channel_t* ch = &channels[index / 2];
+    uint16_t base = ch->base;
+    uint8_t drive = index % 2;
+    int ext = lba + count > 0x0FFFFFFF || count > ATA_MAX_SECTORS_28;
+    int mult = d->multiple > 1;
+    uint8_t cmd;
+    if (write)
+        cmd = ext ? (mult ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_EXT)
+                  : (mult ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_WRITE);
+    else
+        cmd = ext ? (mult ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_EXT)
+                  : (mult ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ);
+
+    ch->mode = ATA_MODE_PIO;
+    ch->irq_done = 0;
+    ata_issue(base, drive, lba, count, ext, cmd);
+
+    // the drive raises DRQ once per block of d->multiple sectors and interrupts
+    // for each one, except the first block of a write which it asks for at once
+    uint32_t block = mult ? d->multiple : 1;
+    int first = 1;
+    int rc = 0;
+    while (count) {
+        uint32_t n = count < block ? count : block;
+        if (!write || !first) ata_wait_irq(ch);
+        first = 0;
+        if (ata_wait_drq(base)) { rc = -1; break; }
+        if (write) outsw(base + ATA_DATA, buffer, n * 256);
+        else insw(base + ATA_DATA, buffer, n * 256);
+        buffer += n * 512;
+        count -= n;
+        ata_delay400(base);
+    }
+    if (rc == 0) {
+        if (write) ata_wait_irq(ch);
+        rc = ata_wait_idle(base);
+    }
+    ch->mode = ATA_MODE_IDLE;
+    return rc;
+}
 
-    if (ata_check_error(base)) return -1;
+static int ata_pio_transfer(uint8_t drive, uint64_t lba, uint32_t count, uint8_t* buffer, int write) {
+    if (drive >= 4 || !drives[drive].present) return -1;
+    ata_drive_t* d = &drives[drive];
+    if (lba + count > d->sectors || (!d->lba48 && lba + count > 0x0FFFFFFF)) return -1;
+
+    uint32_t max = d->lba48 ? ATA_MAX_SECTORS_48 : ATA_MAX_SECTORS_28;
+    while (count) {
+        uint32_t n = count < max ? count : max;
+        if (ata_pio_command(drive, lba, n, buffer, write)) return -1;
+        lba += n;
+        buffer += (uint64_t)n * 512;
+        count -= n;
+    }
+    return 0;
+}
 
-    __asm__ volatile (
-        "rep insw"
-        : "+D"(buffer)
-        : "d"(base + ATA_DATA), "c"(256)
-        : "memory"
-    );
+static irqreturn_t ata_irq_handler(cpu_registers_t* regs, void* cookie) {
+    ata_channel_t* ch = cookie;
+    uint8_t bm = ch->bmide ? inb(ch->bmide + BMIDE_STATUS) : 0;
+    inb(ch->base + ATA_STATUS); // reading status deasserts INTRQ
+    if (ch->mode == ATA_MODE_IDLE) return IRQ_HANDLED;
+    if (ch->mode == ATA_MODE_DMA) {
+        // only a bus-master completion ends a DMA wait
+        if (!(bm & BMIDE_SR_IRQ)) return IRQ_HANDLED;
+        outb(ch->bmide + BMIDE_STATUS, bm | BMIDE_SR_IRQ | BMIDE_SR_ERR); // write-one-to-clear
+        ch->bm_status |= bm;
+    }
+    ch->irq_done = 1;
+    waitqueue_wake_all(&ch->wq);
+    return IRQ_HANDLED;
+}
 
+static int ata_dma_wait(ata_channel_t* ch) {
+    if (ch->irq_ready && waitqueue_can_sleep())
+        return waitqueue_wait(&ch->wq, &ch->irq_done, ATA_TIMEOUT_MS);
+    // interrupts are still off during boot and mount: poll the controller instead
+    uint32_t timeout = 10000000;
+    while (!ch->irq_done && !(inb(ch->bmide + BMIDE_STATUS) & BMIDE_SR_IRQ))
+        if (--timeout == 0) return -1;
     return 0;
 }
 
-int ata_write_sector(uint8_t drive, uint32_t lba, uint8_t* buffer) {
-    if (drive >= 4 || !drives[drive].present) return -1;
-    uint16_t base = (drive < 2) ? ATA_PRIMARY_BASE : ATA_SECONDARY_BASE;
-    uint8_t head = drive % 2;
-    ata_select_drive(base, head);
-    outb(base + ATA_SECTOR_COUNT, 1);
-    outb(base + ATA_SECTOR_NUM, lba & 0xFF);
-    outb(base + ATA_CYL_LOW, (lba >> 8) & 0xFF);
-    outb(base + ATA_CYL_HIGH, (lba >> 16) & 0xFF);
-    outb(base + ATA_DRIVE, 0xE0 | (head << 4) | ((lba >> 24) & 0x0F));
-    outb(base + ATA_COMMAND, ATA_CMD_WRITE);
-    uint8_t status;
-    uint32_t timeout = 1000000;
+static int ata_dma_command(uint8_t index, uint64_t lba, uint32_t count, int write) {
+    ata_channel_t* ch = &channels[index / 2];
+    int ext = lba + count > 0x0FFFFFFF || count > ATA_MAX_SECTORS_28;
+    uint8_t cmd = write ? (ext ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA)
+                        : (ext ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA);
+    uint8_t dir = write ? 0 : BMIDE_CMD_READ;
+
+    outb(ch->bmide + BMIDE_COMMAND, dir);
+    outl(ch->bmide + BMIDE_PRDT, (uint32_t)(uintptr_t)ch->prd);
+    outb(ch->bmide + BMIDE_STATUS, inb(ch->bmide + BMIDE_STATUS) | BMIDE_SR_IRQ | BMIDE_SR_ERR);
+    ch->bm_status = 0;
+    ch->irq_done = 0;
+    ch->mode = ATA_MODE_DMA;
+
+    ata_issue(ch->base, index % 2, lba, count, ext, cmd);
+    outb(ch->bmide + BMIDE_COMMAND, dir | BMIDE_CMD_START);
+
+    int rc = ata_dma_wait(ch);
+    outb(ch->bmide + BMIDE_COMMAND, dir);
+    uint8_t bm = inb(ch->bmide + BMIDE_STATUS) | ch->bm_status;
+    uint8_t status = inb(ch->base + ATA_STATUS);
+    outb(ch->bmide + BMIDE_STATUS, BMIDE_SR_IRQ | BMIDE_SR_ERR);
+    ch->mode = ATA_MODE_IDLE;
+    if (rc || (bm & BMIDE_SR_ERR) || (status & (ATA_SR_ERR | ATA_SR_DF))) return -1;
+    return 0;
+}
 
-    do { status = inb(base + ATA_STATUS); } while (((status & ATA_SR_BSY) || !(status & ATA_SR_DRQ)) && --timeout);
+typedef struct {
+    const iovec_t* iov;
+    int cnt;
+    int idx;
+    uint32_t off;
+} ata_iov_cursor_t;
+
+static void ata_iov_advance(ata_iov_cursor_t* c, uint32_t bytes) {
+    while (bytes && c->idx < c->cnt) {
+        uint32_t left = c->iov[c->idx].len - c->off;
+        uint32_t n = left < bytes ? left : bytes;
+        c->off += n;
+        bytes -= n;
+        if (c->off == c->iov[c->idx].len) { c->idx++; c->off = 0; }
+    }
+}
 
-    if (timeout == 0 || (status & ATA_SR_ERR)) {
-        return -1;
+// fill the channel's PRD table from the cursor; returns the bytes covered
+// (whole sectors), 0 if the buffer cannot be reached by the controller
+static uint32_t ata_build_prd(ata_channel_t* ch, const ata_iov_cursor_t* cur, uint32_t max_bytes) {
+    ata_iov_cursor_t c = *cur;
+    ata_prd_t* prd = ch->prd;
+    uint32_t total = 0;
+    int n = 0;
+    while (c.idx < c.cnt && total < max_bytes && n < ATA_PRD_ENTRIES) {
+        uint64_t addr = (uintptr_t)c.iov[c.idx].base + c.off;
+        uint32_t left = c.iov[c.idx].len - c.off;
+        if ((addr & 1) || addr + left > 0x100000000ULL) return 0; // 32-bit, word aligned only
+        uint32_t chunk = 0x10000 - (addr & 0xFFFF);                // split at 64K boundaries
+        if (chunk > left) chunk = left;
+        if (chunk > max_bytes - total) chunk = max_bytes - total;
+        prd[n].addr = (uint32_t)addr;
+        prd[n].count = chunk & 0xFFFF;
+        prd[n].flags = 0;
+        n++;
+        total += chunk;
+        ata_iov_advance(&c, chunk);
     }
-    for (int i = 0; i < 256; i++) {
-        uint16_t data = buffer[i*2] | (buffer[i*2+1] << 8);
-        outw(base + ATA_DATA, data);
+    // the table may fill up mid-sector: trim back to a sector boundary
+    uint32_t excess = total % 512;
+    total -= excess;
+    while (excess) {
+        uint32_t last = prd[n - 1].count ? prd[n - 1].count : 0x10000;
+        if (last <= excess) {
+            n--;
+            excess -= last;
+        } else {
+            prd[n - 1].count = last - excess;
+            excess = 0;
+        }
     }
-    timeout = 1000000;
+    if (n == 0) return 0;
+    prd[n - 1].flags = ATA_PRD_EOT;
+    return total;
+}
 
-    do { status = inb(base + ATA_STATUS); } while ((status & ATA_SR_BSY) && --timeout);
-    if (timeout == 0 || (status & ATA_SR_ERR)) {
-        return -1;
+// -2: buffer not usable for DMA, -1: the transfer failed
+static int ata_dma_transfer(uint8_t index, uint64_t lba, const iovec_t* iov, int iovcnt, int write) {
+    ata_channel_t* ch = &channels[index / 2];
+    uint32_t max = (drives[index].lba48 ? ATA_MAX_SECTORS_48 : ATA_MAX_SECTORS_28) * 512;
+    ata_iov_cursor_t cur = { iov, iovcnt, 0, 0 };
+    while (cur.idx < cur.cnt) {
+        uint32_t bytes = ata_build_prd(ch, &cur, max);
+        if (!bytes) return -2;
+        if (ata_dma_command(index, lba, bytes / 512, write)) return -1;
+        ata_iov_advance(&cur, bytes);
+        lba += bytes / 512;
     }
     return 0;
 }
 
+static int ata_transfer_iov(uint8_t drive, uint64_t lba, const iovec_t* iov, int iovcnt, int write) {
+    if (drive >= ATA_MAX_DRIVES || !drives[drive].present) return -1;
+    for (int i = 0; i < iovcnt; i++)
+        if (iov[i].len % 512) return -1;
+    ata_drive_t* d = &drives[drive];
+    if (lba + iov_total(iov, iovcnt) / 512 > d->sectors) return -1;
+
+    ata_channel_t* ch = &channels[drive / 2];
+    mutex_lock(&ch->lock);
+    int rc = -2;
+    if (d->dma) {
+        rc = ata_dma_transfer(drive, lba, iov, iovcnt, write);
+        if (rc == -1) {
+            kdbg(KWARN, "ata %d: dma error at lba %llu, falling back to pio\n", drive, lba);
+            d->dma = 0;
+        }
+    }
+    if (rc != 0) {
+        rc = 0;
+        for (int i = 0; i < iovcnt && rc == 0; i++) {
+            rc = ata_pio_transfer(drive, lba, iov[i].len / 512, iov[i].base, write);
+            lba += iov[i].len / 512;
+        }
+    }
+    mutex_unlock(&ch->lock);
+    return rc;
+}
+
+int ata_read_sectors_iov(uint8_t drive, uint64_t lba, const iovec_t* iov, int iovcnt) {
+    return ata_transfer_iov(drive, lba, iov, iovcnt, 0);
+}
+
+int ata_write_sectors_iov(uint8_t drive, uint64_t lba, const iovec_t* iov, int iovcnt) {
+    return ata_transfer_iov(drive, lba, iov, iovcnt, 1);
+}
+
+int ata_read_sectors(uint8_t drive, uint64_t lba, uint32_t count, uint8_t* buffer) {
+    if (count > 0xFFFFFFFF / 512) return -1;
+    iovec_t iov = { buffer, count * 512 };
+    return ata_transfer_iov(drive, lba, &iov, 1, 0);
+}
+
+int ata_write_sectors(uint8_t drive, uint64_t lba, uint32_t count, const uint8_t* buffer) {
+    if (count > 0xFFFFFFFF / 512) return -1;
+    iovec_t iov = { (void*)buffer, count * 512 };
+    return ata_transfer_iov(drive, lba, &iov, 1, 1);
+}
+
+// single sectors go through the block layer as a bio and wait for it
+static int ata_sector_bio(uint8_t drive, uint32_t lba, uint8_t* buffer, int write) {
+    if (drive >= ATA_MAX_DRIVES || !drives[drive].present) return -1;
+    iovec_t iov = { buffer, 512 };
+    bio_t bio;
+    bio_init(&bio, &ata_blk[drive], lba, &iov, 1, write);
+    block_submit_bio(&bio);
+    return bio_wait(&bio);
+}
+
+int ata_read_sector(uint8_t drive, uint32_t lba, uint8_t* buffer) {
+    return ata_sector_bio(drive, lba, buffer, 0);
+}
+
+int ata_write_sector(uint8_t drive, uint32_t lba, uint8_t* buffer) {
+    return ata_sector_bio(drive, lba, buffer, 1);
+}
+
 ata_drive_t* ata_get_drive(uint8_t drive) {
-    if (drive >= 4 || !drives[drive].present) return NULL;
+    if (drive >= ATA_MAX_DRIVES || !drives[drive].present) return NULL;
     return &drives[drive];
-} 
\ No newline at end of file
+}
+
+// FLUSH CACHE (EXT): no data, one interrupt once the write cache is on media
+int ata_flush(uint8_t drive) {
+    if (drive >= ATA_MAX_DRIVES || !drives[drive].present) return -1;
+    ata_channel_t* ch = &channels[drive / 2];
+    mutex_lock(&ch->lock);
+    ch->mode = ATA_MODE_PIO;
+    ch->irq_done = 0;
+    ata_select_drive(ch->base, drive % 2);
+    outb(ch->base + ATA_COMMAND, drives[drive].lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+    ata_delay400(ch->base);
+    ata_wait_irq(ch);
+    int rc = ata_wait_idle(ch->base);
+    ch->mode = ATA_MODE_IDLE;
+    mutex_unlock(&ch->lock);
+    return rc;
+}
+
+static int ata_blk_submit(block_device_t* dev, uint64_t lba, const iovec_t* iov, int iovcnt, int write) {
+    return ata_transfer_iov((ata_drive_t*)dev->priv - drives, lba, iov, iovcnt, write);
+}
+
+static int ata_blk_flush(block_device_t* dev) {
+    return ata_flush((ata_drive_t*)dev->priv - drives);
+}
+
+static const block_ops_t ata_blk_ops = {
+    .submit = ata_blk_submit,
+    .flush = ata_blk_flush,
+};
+
+static void ata_register_block(uint8_t drive) {
+    ata_drive_t* d = &drives[drive];
+    block_device_t* b = &ata_blk[drive];
+    memset(b, 0, sizeof(*b));
+    snprintf(b->name, sizeof(b->name), "ata%d", drive);
+    strncpy(b->model, d->name, sizeof(b->model) - 1);
+    b->sector_size = 512;
+    b->sectors = d->sectors;
+    b->limits.max_sectors = d->lba48 ? ATA_MAX_SECTORS_48 : ATA_MAX_SECTORS_28;
+    b->limits.max_segments = BLOCK_MAX_SEGMENTS;
+    b->ops = &ata_blk_ops;
+    b->priv = d;
+    block_register(b);
+}
@@ -0,0 +1,471 @@
+#include <nvme.h>
+#include <block.h>
+#include <pci.h>
+#include <irq.h>
+#include <irqflags.h>
+#include <lapic.h>
+#include <heap.h>
+#include <string.h>
+#include <debug.h>
+#include <vga.h>
+#include <waitqueue.h>
+
+#define NVME_ADMIN_DEPTH   16
+#define NVME_QUEUE_DEPTH   32       // entries per I/O queue, one stays empty
+#define NVME_MAX_QUEUES    8
+#define NVME_MAX_NS        8
+#define NVME_TIMEOUT_MS    5000
+#define NVME_SPIN          10000000
+#define NVME_COALESCE_THR  7        // interrupt after 8 completions ...
+#define NVME_COALESCE_TIME 1        // ... or 100us, whichever comes first
+
+typedef struct {
+    uint16_t qid;
+    uint16_t depth;
+    nvme_sqe_t* sq;
+    volatile nvme_cqe_t* cq;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint8_t phase;
+    volatile uint32_t* sq_db;
+    volatile uint32_t* cq_db;
+    int irq;                    // completions arrive by MSI-X
+    uint64_t* prp;              // one PRP list page per command id
+    uint32_t cid_busy;
+    volatile int cid_free;
+    volatile int done[NVME_QUEUE_DEPTH];
+    volatile uint16_t status[NVME_QUEUE_DEPTH];
+    volatile uint32_t result[NVME_QUEUE_DEPTH];
+    waitqueue_t cid_wq;
+    waitqueue_t done_wq;
+} nvme_queue_t;
+
+typedef struct {
+    struct pci_device* pci;
+    volatile uint8_t* regs;
+    uint64_t cap;
+    uint32_t max_bytes;         // per command: MDTS and one PRP list page
+    nvme_queue_t admin;
+    nvme_queue_t* io[NVME_MAX_QUEUES];
+    int nio;
+    char model[41];
+} nvme_ctrl_t;
+
+typedef struct {
+    uint32_t nsid;
+    uint64_t sectors;
+    block_device_t blk;
+} nvme_ns_t;
+
+typedef struct {
+    const iovec_t* iov;
+    int cnt;
+    int idx;
+    uint32_t off;
+} nvme_cursor_t;
+
+static nvme_ctrl_t ctrl;
+
+static inline uint32_t nvme_read32(uint32_t reg) {
+    return *(volatile uint32_t*)(ctrl.regs + reg);
+}
+
+static inline uint64_t nvme_read64(uint32_t reg) {
+    return nvme_read32(reg) | ((uint64_t)nvme_read32(reg + 4) << 32);
+}
+
+static inline void nvme_write32(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(ctrl.regs + reg) = value;
+}
+
+static inline void nvme_write64(uint32_t reg, uint64_t value) {
+    nvme_write32(reg, (uint32_t)value);
+    nvme_write32(reg + 4, (uint32_t)(value >> 32));
+}
+
+static int nvme_queue_init(nvme_queue_t* q, uint16_t qid, uint16_t depth) {
+    memset(q, 0, sizeof(*q));
+    q->qid = qid;
+    q->depth = depth;
+    q->phase = 1;
+    q->sq = kmalloc_aligned(depth * sizeof(nvme_sqe_t), NVME_PAGE_SIZE);
+    q->cq = kmalloc_aligned(depth * sizeof(nvme_cqe_t), NVME_PAGE_SIZE);
+    if (qid) q->prp = kmalloc_aligned(depth * NVME_PAGE_SIZE, NVME_PAGE_SIZE);
+    if (!q->sq || !q->cq || (qid && !q->prp)) return -1;
+    memset(q->sq, 0, depth * sizeof(nvme_sqe_t));
+    memset((void*)q->cq, 0, depth * sizeof(nvme_cqe_t));
+
+    uint32_t stride = 4u << NVME_CAP_DSTRD(ctrl.cap);
+    q->sq_db = (volatile uint32_t*)(ctrl.regs + NVME_REG_DBS + (2 * qid) * stride);
+    q->cq_db = (volatile uint32_t*)(ctrl.regs + NVME_REG_DBS + (2 * qid + 1) * stride);
+    waitqueue_init(&q->cid_wq);
+    waitqueue_init(&q->done_wq);
+    return 0;
+}
+
+// consume new completion entries; interrupts must be off
+static void nvme_process_cq(nvme_queue_t* q) {
+    int n = 0;
+    for (;;) {
+        volatile nvme_cqe_t* e = &q->cq[q->cq_head];
+        uint16_t status = e->status;
+        if ((status & 1) != q->phase) break;
+        uint16_t cid = e->cid;
+        if (cid < q->depth) {
+            q->result[cid] = e->result;
+            q->status[cid] = status >> 1;
+            q->done[cid] = 1;
+        }
+        if (++q->cq_head == q->depth) {
+            q->cq_head = 0;
+            q->phase ^= 1;
+        }
+        n++;
+    }
+    if (n) {
+        *q->cq_db = q->cq_head;
+        waitqueue_wake_all(&q->done_wq);
+    }
+}
+
+static irqreturn_t nvme_irq_handler(cpu_registers_t* regs, void* cookie) {
+    nvme_process_cq(cookie);
+    return IRQ_HANDLED;
+}
+
+// at most depth - 1 commands are outstanding, so the SQ never looks empty when full
+static int nvme_get_cid(nvme_queue_t* q) {
+    uint32_t usable = (1u << (q->depth - 1)) - 1;
+    for (;;) {
+        uint64_t irqf = local_irq_save();
+        uint32_t free = usable & ~q->cid_busy;
+        if (free) {
+            int cid = __builtin_ctz(free);
+            q->cid_busy |= 1u << cid;
+            local_irq_restore(irqf);
+            return cid;
+        }
+        q->cid_free = 0;
+        local_irq_restore(irqf);
+        // the ids' holders cannot run while this caller spins
+        if (!waitqueue_can_sleep()) {
+            kdbg(KERR, "nvme: queue %u: no free command id and cannot sleep\n", q->qid);
+            return -1;
+        }
+        waitqueue_wait(&q->cid_wq, &q->cid_free, 0);
+    }
+}
+
+static void nvme_put_cid(nvme_queue_t* q, int cid) {
+    uint64_t irqf = local_irq_save();
+    q->cid_busy &= ~(1u << cid);
+    q->cid_free = 1;
+    waitqueue_wake_all(&q->cid_wq);
+    local_irq_restore(irqf);
+}
+
+// 0 on success, -1 on a command error, -2 on timeout (the id stays reserved)
+static int nvme_submit(nvme_queue_t* q, int cid, nvme_sqe_t* cmd, uint32_t* result) {
+    cmd->cdw0 = (cmd->cdw0 & 0xFFFF) | ((uint32_t)cid << 16);
+
+    // the queue belongs to this CPU: masking interrupts is all the locking it needs
+    uint64_t irqf = local_irq_save();
+    q->done[cid] = 0;
+    q->sq[q->sq_tail] = *cmd;
+    if (++q->sq_tail == q->depth) q->sq_tail = 0;
+    __asm__ volatile("" ::: "memory"); // entry written before the doorbell
+    *q->sq_db = q->sq_tail;
+    local_irq_restore(irqf);
+
+    if (q->irq && waitqueue_can_sleep()) {
+        waitqueue_wait(&q->done_wq, &q->done[cid], NVME_TIMEOUT_MS);
+    } else {
+        for (uint32_t spin = 0; !q->done[cid] && spin < NVME_SPIN; spin++) {
+            irqf = local_irq_save();
+            nvme_process_cq(q);
+            local_irq_restore(irqf);
+        }
+    }
+    if (!q->done[cid]) {
+        kdbg(KERR, "nvme: queue %d: command 0x%02x timed out\n", q->qid, cmd->cdw0 & 0xFF);
+        return -2;
+    }
+    if (result) *result = q->result[cid];
+    if (q->status[cid]) {
+        kdbg(KERR, "nvme: queue %d: command 0x%02x failed, status 0x%x\n", q->qid,
+             cmd->cdw0 & 0xFF, q->status[cid]);
+        return -1;
+    }
+    return 0;
+}
+
+static int nvme_admin(uint8_t opcode, uint32_t nsid, void* buf, uint32_t cdw10, uint32_t cdw11, uint32_t* result) {
+    nvme_sqe_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cdw0 = opcode;
+    cmd.nsid = nsid;
+    cmd.prp1 = (uintptr_t)buf;
+    cmd.cdw10 = cdw10;
+    cmd.cdw11 = cdw11;
+    int cid = nvme_get_cid(&ctrl.admin);
+    if (cid < 0) return -1;
+    int rc = nvme_submit(&ctrl.admin, cid, &cmd, result);
+    if (rc != -2) nvme_put_cid(&ctrl.admin, cid);
+    return rc;
+}
+
+static void nvme_cursor_advance(nvme_cursor_t* c, uint32_t bytes) {
+    while (bytes && c->idx < c->cnt) {
+        uint32_t left = c->iov[c->idx].len - c->off;
+        uint32_t n = left < bytes ? left : bytes;
+        c->off += n;
+        bytes -= n;
+        if (c->off == c->iov[c->idx].len) { c->idx++; c->off = 0; }
+    }
+}
+
+// Describe as much of the cursor as one command can with PRP1/PRP2 and
+// the command's list page. Every page after the first must start on a page
+// boundary and the data before it must end on one; the request is cut where
+// the iovec breaks that rule. Returns bytes (whole sectors), 0 if unusable.
+static uint32_t nvme_build_prp(nvme_queue_t* q, int cid, const nvme_cursor_t* cur, nvme_sqe_t* cmd) {
+    uint64_t* list = &q->prp[cid * NVME_PRP_PER_PAGE];
+    nvme_cursor_t c = *cur;
+    uint32_t bytes = 0, first_len = 0;
+    uint64_t first = 0, end = 0;
+    int npages = 0;
+    while (c.idx < c.cnt && bytes < ctrl.max_bytes) {
+        uint64_t addr = (uintptr_t)c.iov[c.idx].base + c.off;
+        uint32_t left = c.iov[c.idx].len - c.off;
+        if (addr & 3) break; // PRP entries are dword aligned
+        if (npages && ((addr | end) & (NVME_PAGE_SIZE - 1))) break;
+        if (npages > NVME_PRP_PER_PAGE) break;
+        uint32_t chunk = NVME_PAGE_SIZE - (addr & (NVME_PAGE_SIZE - 1));
+        if (chunk > left) chunk = left;
+        if (chunk > ctrl.max_bytes - bytes) chunk = ctrl.max_bytes - bytes;
+        if (npages == 0) {
+            first = addr;
+            first_len = chunk;
+        } else {
+            list[npages - 1] = addr;
+        }
+        npages++;
+        bytes += chunk;
+        end = addr + chunk;
+        nvme_cursor_advance(&c, chunk);
+    }
+    bytes -= bytes % 512;
+    if (!bytes) return 0;
+    // only the first page may be partial, so the page count follows from the length
+    npages = bytes <= first_len ? 1 : 1 + (bytes - first_len + NVME_PAGE_SIZE - 1) / NVME_PAGE_SIZE;
+    cmd->prp1 = first;
+    if (npages == 2) cmd->prp2 = list[0];
+    else if (npages > 2) cmd->prp2 = (uintptr_t)list;
+    return bytes;
+}
+
+static nvme_queue_t* nvme_this_queue(void) {
+    return ctrl.io[lapic_cpu_index() % ctrl.nio];
+}
+
+static int nvme_transfer(block_device_t* dev, uint64_t lba, const iovec_t* iov, int iovcnt, int write) {
+    nvme_ns_t* ns = dev->priv;
+    nvme_queue_t* q = nvme_this_queue();
+    nvme_cursor_t cur = { iov, iovcnt, 0, 0 };
+    while (cur.idx < cur.cnt) {
+        nvme_sqe_t cmd;
+        memset(&cmd, 0, sizeof(cmd));
+        int cid = nvme_get_cid(q);
+        if (cid < 0) return -1;
+        uint32_t bytes = nvme_build_prp(q, cid, &cur, &cmd);
+        if (!bytes) {
+            nvme_put_cid(q, cid);
+            return -1;
+        }
+        cmd.cdw0 = write ? NVME_CMD_WRITE : NVME_CMD_READ;
+        cmd.nsid = ns->nsid;
+        cmd.cdw10 = (uint32_t)lba;
+        cmd.cdw11 = (uint32_t)(lba >> 32);
+        cmd.cdw12 = bytes / 512 - 1;
+        int rc = nvme_submit(q, cid, &cmd, NULL);
+        if (rc != -2) nvme_put_cid(q, cid);
+        if (rc) return -1;
+        nvme_cursor_advance(&cur, bytes);
+        lba += bytes / 512;
+    }
+    return 0;
+}
+
+static int nvme_flush(block_device_t* dev) {
+    nvme_ns_t* ns = dev->priv;
+    nvme_queue_t* q = nvme_this_queue();
+    nvme_sqe_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cdw0 = NVME_CMD_FLUSH;
+    cmd.nsid = ns->nsid;
+    int cid = nvme_get_cid(q);
+    if (cid < 0) return -1;
+    int rc = nvme_submit(q, cid, &cmd, NULL);
+    if (rc != -2) nvme_put_cid(q, cid);
+    return rc ? -1 : 0;
+}
+
+static const block_ops_t nvme_ops = {
+    .submit = nvme_transfer,
+    .flush = nvme_flush,
+};
+
+static int nvme_wait_ready(int ready) {
+    for (uint32_t spin = 0; spin < NVME_SPIN; spin++) {
+        uint32_t csts = nvme_read32(NVME_REG_CSTS);
+        if (csts & NVME_CSTS_CFS) return -1;
+        if (!!(csts & NVME_CSTS_RDY) == ready) return 0;
+    }
+    return -1;
+}
+
+// undo a failed nvme_create_io_queue; the queue is not on the controller
+static void nvme_queue_free(nvme_queue_t* q, int vector) {
+    if (q->irq) irq_free(vector, q);
+    kfree_aligned(q->sq);
+    kfree_aligned((void*)q->cq);
+    kfree_aligned(q->prp);
+    kfree(q);
+}
+
+static int nvme_create_io_queue(int index, int msix_nvec) {
+    nvme_queue_t* q = kmalloc(sizeof(nvme_queue_t));
+    if (!q) return -1;
+    if (nvme_queue_init(q, index + 1, NVME_QUEUE_DEPTH) != 0) {
+        nvme_queue_free(q, -1);
+        return -1;
+    }
+
+    int entry = msix_nvec > 0 ? index % msix_nvec : 0;
+    int vector = -1;
+    uint32_t cq_flags = 1; // physically contiguous
+    if (msix_nvec > 0) {
+        vector = pci_irq_vector(ctrl.pci, entry);
+        if (irq_request(vector, nvme_irq_handler, IRQF_SHARED, "nvme", q) == 0) {
+            q->irq = 1;
+            cq_flags |= 2 | ((uint32_t)entry << 16); // interrupts enabled, vector
+        }
+    }
+    uint32_t size = (uint32_t)(q->depth - 1) << 16;
+    if (nvme_admin(NVME_ADMIN_CREATE_CQ, 0, (void*)q->cq, q->qid | size, cq_flags, NULL) != 0) {
+        nvme_queue_free(q, vector);
+        return -1;
+    }
+    if (nvme_admin(NVME_ADMIN_CREATE_SQ, 0, q->sq, q->qid | size, 1 | ((uint32_t)q->qid << 16), NULL) != 0) {
+        // the controller must let go of the CQ before its memory is freed
+        nvme_admin(NVME_ADMIN_DELETE_CQ, 0, NULL, q->qid, 0, NULL);
+        nvme_queue_free(q, vector);
+        return -1;
+    }
+    ctrl.io[ctrl.nio++] = q;
+    return 0;
+}
+
+static void nvme_add_namespace(uint32_t nsid, uint8_t* id) {
+    if (nvme_admin(NVME_ADMIN_IDENTIFY, nsid, id, NVME_IDENTIFY_NS, 0, NULL) != 0) return;
+    uint64_t nsze = *(uint64_t*)&id[0];
+    uint32_t lbaf = *(uint32_t*)&id[128 + 4 * (id[26] & 0xF)];
+    uint32_t lbads = (lbaf >> 16) & 0xFF;
+    if (!nsze) return;
+    if (lbads != 9) {
+        kdbg(KWARN, "nvme: namespace %u uses %u-byte blocks, only 512 is supported\n", nsid, 1u << lbads);
+        return;
+    }
+    nvme_ns_t* ns = kmalloc(sizeof(nvme_ns_t));
+    if (!ns) return;
+    memset(ns, 0, sizeof(*ns));
+    ns->nsid = nsid;
+    ns->sectors = nsze;
+
+    snprintf(ns->blk.name, sizeof(ns->blk.name), "nvme0n%u", nsid);
+    memcpy(ns->blk.model, ctrl.model, sizeof(ns->blk.model));
+    ns->blk.sector_size = 512;
+    ns->blk.sectors = nsze;
+    ns->blk.limits.max_sectors = ctrl.max_bytes / 512;
+    ns->blk.limits.queue_depth = NVME_QUEUE_DEPTH - 1;
+    ns->blk.ops = &nvme_ops;
+    ns->blk.priv = ns;
+    int drive = block_register(&ns->blk);
+    kdbg(KINFO, "nvme: namespace %u -> disk %d\n", nsid, drive);
+}
+
+void nvme_init(void) {
+    struct pci_device* dev = pci_find_class(0x01, 0x08, 0);
+    if (!dev) return;
+    uint64_t bar = pci_bar_address(dev, 0);
+    if (!bar || pci_bar_is_io(dev, 0) || bar >= 0x100000000ULL) {
+        kdbg(KWARN, "nvme: BAR0 not usable\n");
+        return;
+    }
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.pci = dev;
+    ctrl.regs = (volatile uint8_t*)(uintptr_t)bar;
+    pci_enable_bus_master(dev);
+    ctrl.cap = nvme_read64(NVME_REG_CAP);
+
+    // reset, program the admin queue, enable
+    nvme_write32(NVME_REG_CC, nvme_read32(NVME_REG_CC) & ~NVME_CC_EN);
+    if (nvme_wait_ready(0) != 0) { kdbg(KERR, "nvme: controller does not reset\n"); return; }
+    uint16_t adepth = NVME_CAP_MQES(ctrl.cap) < NVME_ADMIN_DEPTH ? NVME_CAP_MQES(ctrl.cap) : NVME_ADMIN_DEPTH;
+    if (nvme_queue_init(&ctrl.admin, 0, adepth) != 0) return;
+    nvme_write32(NVME_REG_AQA, (adepth - 1) | ((uint32_t)(adepth - 1) << 16));
+    nvme_write64(NVME_REG_ASQ, (uintptr_t)ctrl.admin.sq);
+    nvme_write64(NVME_REG_ACQ, (uintptr_t)ctrl.admin.cq);
+    nvme_write32(NVME_REG_CC, NVME_CC_EN | NVME_CC_IOSQES | NVME_CC_IOCQES); // 4K pages, NVM command set
+    if (nvme_wait_ready(1) != 0) { kdbg(KERR, "nvme: controller failed to start\n"); return; }
+
+    uint8_t* id = kmalloc_aligned(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
+    if (!id) return;
+    if (nvme_admin(NVME_ADMIN_IDENTIFY, 0, id, NVME_IDENTIFY_CTRL, 0, NULL) != 0) {
+        kfree_aligned(id);
+        return;
+    }
+    memcpy(ctrl.model, &id[24], 40);
+    ctrl.model[40] = 0;
+    trim(ctrl.model);
+    uint8_t mdts = id[77];
+    uint32_t nn = *(uint32_t*)&id[516];
+    ctrl.max_bytes = NVME_PRP_PER_PAGE * NVME_PAGE_SIZE;
+    if (mdts && mdts < 20 && (NVME_PAGE_SIZE << mdts) < ctrl.max_bytes)
+        ctrl.max_bytes = NVME_PAGE_SIZE << mdts;
+
+    // one queue pair per CPU, as many as the controller grants
+    int want = lapic_cpu_count();
+    if (want > NVME_MAX_QUEUES) want = NVME_MAX_QUEUES;
+    uint32_t granted = 0;
+    if (nvme_admin(NVME_ADMIN_SET_FEATURES, 0, 0, NVME_FEAT_NUM_QUEUES,
+                   (want - 1) | ((uint32_t)(want - 1) << 16), &granted) == 0) {
+        int nsq = (granted & 0xFFFF) + 1, ncq = (granted >> 16) + 1;
+        if (nsq < want) want = nsq;
+        if (ncq < want) want = ncq;
+    } else {
+        want = 1;
+    }
+    nvme_admin(NVME_ADMIN_SET_FEATURES, 0, 0, NVME_FEAT_IRQ_COALESCE,
+               NVME_COALESCE_THR | (NVME_COALESCE_TIME << 8), NULL);
+
+    int nvec = pci_enable_msix(dev, want);
+    if (nvec < 0) {
+        // e.g. the table sits above 4GB: every queue shares one MSI vector
+        nvec = pci_enable_msi(dev, 1) >= 0 ? 1 : 0;
+        if (!nvec) kdbg(KWARN, "nvme: no msi-x or msi, completions are polled\n");
+    }
+    for (int i = 0; i < want; i++)
+        if (nvme_create_io_queue(i, nvec) != 0) break;
+    if (!ctrl.nio) {
+        kdbg(KERR, "nvme: could not create i/o queues\n");
+        kfree_aligned(id);
+        return;
+    }
+    kdbg(KINFO, "nvme: %s, %d i/o queue%s, %d vectors, max %u KiB per command\n", ctrl.model,
+         ctrl.nio, ctrl.nio > 1 ? "s" : "", nvec, ctrl.max_bytes / 1024);
+
+    for (uint32_t nsid = 1; nsid <= nn && nsid <= NVME_MAX_NS; nsid++)
+        nvme_add_namespace(nsid, id);
+    kfree_aligned(id);
+}
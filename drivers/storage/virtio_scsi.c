@@ -0,0 +1,349 @@
+#include <virtio_scsi.h>
+#include <virtio.h>
+#include <block.h>
+#include <pci.h>
+#include <irq.h>
+#include <irqflags.h>
+#include <heap.h>
+#include <string.h>
+#include <debug.h>
+#include <vga.h>
+#include <waitqueue.h>
+
+#define VSCSI_MAX_TARGETS 8
+#define VSCSI_MAX_SEGS    (VIRTQ_MAX_INDIRECT - 2)   // request and response take two
+#define VSCSI_TIMEOUT_MS  5000
+#define VSCSI_SPIN        10000000
+#define VSCSI_RETRIES     3
+
+typedef struct {
+    virtio_device_t vdev;
+    virtqueue_t* vq;            // first request queue
+    int irq;
+    int msix;                   // 0: legacy INTx, acknowledged through the ISR
+    int max_segs;
+    uint32_t max_sectors;
+    waitqueue_t done_wq;
+    waitqueue_t free_wq;
+    volatile int has_free;
+} vscsi_host_t;
+
+typedef struct {
+    uint16_t target;
+    uint16_t lun;
+    uint64_t sectors;
+    char name[26];
+    block_device_t blk;
+} vscsi_lun_t;
+
+// one in-flight command; the device writes resp, so it must outlive a timeout
+typedef struct {
+    virtio_scsi_req_t req;
+    virtio_scsi_resp_t resp;
+    volatile int done;
+} vscsi_cmd_t;
+
+typedef struct {
+    const iovec_t* iov;
+    int cnt;
+    int idx;
+    uint32_t off;
+} vscsi_cursor_t;
+
+static vscsi_host_t host;
+
+// reap finished commands; interrupts must be off
+static void vscsi_complete(void) {
+    int n = 0;
+    vscsi_cmd_t* cmd;
+    do {
+        while ((cmd = virtqueue_get_buf(host.vq, NULL))) {
+            cmd->done = 1;
+            n++;
+        }
+    } while (virtqueue_enable_cb(host.vq));
+    if (n) {
+        host.has_free = 1;
+        waitqueue_wake_all(&host.done_wq);
+        waitqueue_wake_all(&host.free_wq);
+    }
+}
+
+static irqreturn_t vscsi_irq_handler(cpu_registers_t* regs, void* cookie) {
+    if (!host.msix && !(virtio_isr(&host.vdev) & 1)) return IRQ_NONE;
+    vscsi_complete();
+    return IRQ_HANDLED;
+}
+
+static void vscsi_submit(vscsi_cmd_t* cmd, const iovec_t* sg, int out, int in) {
+    for (;;) {
+        uint64_t irqf = local_irq_save();
+        if (virtqueue_add(host.vq, sg, out, in, cmd) == 0) {
+            virtqueue_kick(host.vq);
+            local_irq_restore(irqf);
+            return;
+        }
+        host.has_free = 0;
+        vscsi_complete();
+        local_irq_restore(irqf);
+        if (host.irq && waitqueue_can_sleep())
+            waitqueue_wait(&host.free_wq, &host.has_free, 0);
+        else
+            __asm__ volatile("pause");
+    }
+}
+
+static int vscsi_wait(vscsi_cmd_t* cmd) {
+    if (host.irq && waitqueue_can_sleep()) {
+        waitqueue_wait(&host.done_wq, &cmd->done, VSCSI_TIMEOUT_MS);
+    } else {
+        for (uint32_t spin = 0; !cmd->done && spin < VSCSI_SPIN; spin++) {
+            uint64_t irqf = local_irq_save();
+            vscsi_complete();
+            local_irq_restore(irqf);
+        }
+    }
+    return cmd->done ? 0 : -1;
+}
+
+// 0 on GOOD, the sense key on CHECK CONDITION, -1 if the command failed otherwise
+static int vscsi_execute(vscsi_lun_t* l, const uint8_t* cdb, int cdb_len,
+                         const iovec_t* data, int nseg, int write) {
+    vscsi_cmd_t* cmd = kmalloc(sizeof(vscsi_cmd_t));
+    if (!cmd) return -1;
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->req.lun[0] = 1;
+    cmd->req.lun[1] = l->target;
+    cmd->req.lun[2] = (l->lun >> 8) | 0x40; // flat addressing
+    cmd->req.lun[3] = l->lun & 0xFF;
+    cmd->req.tag = (uintptr_t)cmd;
+    memcpy(cmd->req.cdb, cdb, cdb_len);
+
+    iovec_t sg[VSCSI_MAX_SEGS + 2];
+    int out, in;
+    sg[0].base = &cmd->req;
+    sg[0].len = sizeof(cmd->req);
+    if (write) {
+        memcpy(&sg[1], data, nseg * sizeof(iovec_t));
+        sg[nseg + 1].base = &cmd->resp;
+        sg[nseg + 1].len = sizeof(cmd->resp);
+        out = nseg + 1;
+        in = 1;
+    } else {
+        sg[1].base = &cmd->resp;
+        sg[1].len = sizeof(cmd->resp);
+        memcpy(&sg[2], data, nseg * sizeof(iovec_t));
+        out = 1;
+        in = nseg + 1;
+    }
+    vscsi_submit(cmd, sg, out, in);
+    if (vscsi_wait(cmd) != 0) {
+        kdbg(KERR, "virtio-scsi: %d:%d: command 0x%02x timed out\n", l->target, l->lun, cdb[0]);
+        return -1; // cmd stays allocated, the device may still complete it
+    }
+
+    int rc = -1;
+    if (cmd->resp.response == VIRTIO_SCSI_S_OK) {
+        if (cmd->resp.status == SCSI_STATUS_GOOD) {
+            rc = 0;
+        } else if (cmd->resp.status == SCSI_STATUS_CHECK_CONDITION && cmd->resp.sense_len >= 3) {
+            // fixed (0x70/0x71) or descriptor (0x72/0x73) sense data
+            uint8_t* s = cmd->resp.sense;
+            int key = ((s[0] & 0x7F) >= 0x72 ? s[1] : s[2]) & 0xF;
+            if (key) rc = key;
+        }
+    }
+    kfree(cmd);
+    return rc;
+}
+
+// retry past the unit attention every LUN reports after a reset
+static int vscsi_execute_retry(vscsi_lun_t* l, const uint8_t* cdb, int cdb_len,
+                               const iovec_t* data, int nseg, int write) {
+    int rc = -1;
+    for (int i = 0; i < VSCSI_RETRIES; i++) {
+        rc = vscsi_execute(l, cdb, cdb_len, data, nseg, write);
+        if (rc != SCSI_SENSE_UNIT_ATTENTION) break;
+    }
+    return rc;
+}
+
+static void vscsi_cursor_advance(vscsi_cursor_t* c, uint32_t bytes) {
+    while (bytes && c->idx < c->cnt) {
+        uint32_t left = c->iov[c->idx].len - c->off;
+        uint32_t n = left < bytes ? left : bytes;
+        c->off += n;
+        bytes -= n;
+        if (c->off == c->iov[c->idx].len) { c->idx++; c->off = 0; }
+    }
+}
+
+static void vscsi_put_be(uint8_t* p, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--, v >>= 8)
+        p[i] = v & 0xFF;
+}
+
+static uint64_t vscsi_get_be(const uint8_t* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static int vscsi_transfer(block_device_t* dev, uint64_t lba, const iovec_t* iov, int iovcnt, int write) {
+    vscsi_lun_t* l = dev->priv;
+    vscsi_cursor_t cur = { iov, iovcnt, 0, 0 };
+    uint32_t max_bytes = host.max_sectors * 512;
+    while (cur.idx < cur.cnt) {
+        // take segments until the segment or size limit, then trim to whole sectors
+        iovec_t seg[VSCSI_MAX_SEGS];
+        int n = 0;
+        uint32_t bytes = 0;
+        vscsi_cursor_t c = cur;
+        while (c.idx < c.cnt && n < host.max_segs && bytes < max_bytes) {
+            uint32_t len = c.iov[c.idx].len - c.off;
+            if (len > max_bytes - bytes) len = max_bytes - bytes;
+            seg[n].base = (uint8_t*)c.iov[c.idx].base + c.off;
+            seg[n].len = len;
+            n++;
+            bytes += len;
+            vscsi_cursor_advance(&c, len);
+        }
+        uint32_t cut = bytes % 512;
+        bytes -= cut;
+        while (cut) {
+            uint32_t t = seg[n - 1].len < cut ? seg[n - 1].len : cut;
+            seg[n - 1].len -= t;
+            cut -= t;
+            if (!seg[n - 1].len) n--;
+        }
+        if (!bytes) return -1;
+
+        uint8_t cdb[16];
+        memset(cdb, 0, sizeof(cdb));
+        cdb[0] = write ? SCSI_WRITE_16 : SCSI_READ_16;
+        vscsi_put_be(&cdb[2], lba, 8);
+        vscsi_put_be(&cdb[10], bytes / 512, 4);
+        if (vscsi_execute_retry(l, cdb, sizeof(cdb), seg, n, write) != 0) return -1;
+        vscsi_cursor_advance(&cur, bytes);
+        lba += bytes / 512;
+    }
+    return 0;
+}
+
+static int vscsi_flush(block_device_t* dev) {
+    uint8_t cdb[10];
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = SCSI_SYNCHRONIZE_CACHE_10; // LBA 0, 0 blocks: the whole medium
+    return vscsi_execute_retry(dev->priv, cdb, sizeof(cdb), NULL, 0, 0) ? -1 : 0;
+}
+
+static const block_ops_t vscsi_ops = {
+    .submit = vscsi_transfer,
+    .flush = vscsi_flush,
+};
+
+static void vscsi_probe(uint16_t target, uint8_t* buf) {
+    vscsi_lun_t probe = { .target = target, .lun = 0 };
+    uint8_t cdb[16];
+    iovec_t io = { buf, 36 };
+
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = SCSI_INQUIRY;
+    cdb[4] = 36;
+    if (vscsi_execute_retry(&probe, cdb, 6, &io, 1, 0) != 0) return;
+    if (buf[0] != 0x00) return; // connected direct-access device only
+
+    memcpy(probe.name, &buf[8], 8);
+    probe.name[8] = ' ';
+    memcpy(&probe.name[9], &buf[16], 16);
+    probe.name[25] = 0;
+    trim(probe.name);
+
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = SCSI_SERVICE_ACTION_IN;
+    cdb[1] = SCSI_SAI_READ_CAPACITY_16;
+    cdb[13] = 32;
+    io.len = 32;
+    if (vscsi_execute_retry(&probe, cdb, sizeof(cdb), &io, 1, 0) != 0) {
+        kdbg(KWARN, "virtio-scsi: target %d: read capacity failed\n", target);
+        return;
+    }
+    uint32_t block = vscsi_get_be(&buf[8], 4);
+    if (block != 512) {
+        kdbg(KWARN, "virtio-scsi: target %d uses %u-byte blocks, only 512 is supported\n", target, block);
+        return;
+    }
+    vscsi_lun_t* l = kmalloc(sizeof(vscsi_lun_t));
+    if (!l) return;
+    *l = probe;
+    l->sectors = vscsi_get_be(&buf[0], 8) + 1;
+    memset(&l->blk, 0, sizeof(l->blk));
+    snprintf(l->blk.name, sizeof(l->blk.name), "vsd%d", target);
+    memcpy(l->blk.model, l->name, sizeof(l->name));
+    l->blk.sector_size = 512;
+    l->blk.sectors = l->sectors;
+    l->blk.limits.max_sectors = host.max_sectors;
+    l->blk.limits.max_segments = host.max_segs;
+    l->blk.limits.queue_depth = host.vq->size;
+    l->blk.ops = &vscsi_ops;
+    l->blk.priv = l;
+    int drive = block_register(&l->blk);
+    kdbg(KINFO, "virtio-scsi: target %d: %s, %llu sectors -> disk %d\n", target, l->name,
+         l->sectors, drive);
+}
+
+void virtio_scsi_init(void) {
+    struct pci_device* dev = pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_SCSI_DEVICE_MODERN, 0);
+    if (!dev) dev = pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_SCSI_DEVICE_LEGACY, 0);
+    if (!dev) return;
+
+    memset(&host, 0, sizeof(host));
+    waitqueue_init(&host.done_wq);
+    waitqueue_init(&host.free_wq);
+    virtio_device_t* vdev = &host.vdev;
+    if (virtio_pci_init(vdev, dev) != 0 || !vdev->config) return;
+    if (virtio_negotiate(vdev, (1ULL << VIRTIO_F_INDIRECT_DESC) | (1ULL << VIRTIO_F_EVENT_IDX)) != 0)
+        return;
+
+    volatile virtio_scsi_config_t* cfg = (volatile virtio_scsi_config_t*)vdev->config;
+    cfg->cdb_size = VIRTIO_SCSI_CDB_SIZE;
+    cfg->sense_size = VIRTIO_SCSI_SENSE_SIZE;
+    host.max_sectors = cfg->max_sectors ? cfg->max_sectors : 0xFFFF;
+    host.max_segs = VSCSI_MAX_SEGS;
+    if (cfg->seg_max && cfg->seg_max < (uint32_t)host.max_segs) host.max_segs = cfg->seg_max;
+    uint16_t max_target = cfg->max_target;
+
+    // one MSI-X vector for the request queue; config changes are not signalled
+    int vector = -1;
+    uint32_t flags = 0;
+    if (pci_enable_msix(dev, 1) > 0) {
+        vector = pci_irq_vector(dev, 0);
+        host.msix = 1;
+        vdev->common->msix_config = VIRTIO_MSI_NO_VECTOR;
+    } else if (dev->irq_line < 16) {
+        vector = 32 + dev->irq_line;
+        flags = IRQF_SHARED;
+    }
+    host.vq = virtio_setup_queue(vdev, VIRTIO_SCSI_REQUEST_QUEUE, host.msix ? 0 : VIRTIO_MSI_NO_VECTOR);
+    if (!host.vq) {
+        kdbg(KERR, "virtio-scsi: no request queue\n");
+        virtio_fail(vdev);
+        return;
+    }
+    // without indirect tables every segment takes a ring slot
+    if (!host.vq->indirect && host.max_segs > host.vq->size - 2) host.max_segs = host.vq->size - 2;
+    if (vector >= 0 && irq_request(vector, vscsi_irq_handler, flags, "virtio-scsi", &host) == 0)
+        host.irq = 1;
+    virtio_driver_ok(vdev);
+    kdbg(KINFO, "virtio-scsi: queue %d entries%s%s, %d segments, %s\n", host.vq->size,
+         host.vq->indirect ? ", indirect" : "",
+         virtio_has_feature(vdev, VIRTIO_F_EVENT_IDX) ? ", event idx" : "", host.max_segs,
+         host.irq ? (host.msix ? "msi-x" : "intx") : "polled");
+
+    uint8_t* buf = kmalloc(512);
+    if (!buf) return;
+    for (uint16_t t = 0; t <= max_target && t < VSCSI_MAX_TARGETS; t++)
+        vscsi_probe(t, buf);
+    kfree(buf);
+}
@@ -326,7 +326,9 @@ void kprintf(const char *fmt, ...) {
                 break;
             }
             case 'u': {
-                unsigned int val = va_arg(args, unsigned int);
+                unsigned long long val = longlong ? va_arg(args, unsigned long long)
+                                       : longval ? va_arg(args, unsigned long)
+                                       : va_arg(args, unsigned int);
                 int i = 0;
                 char numbuf[32];
                 do { numbuf[i++] = '0' + (val % 10); val /= 10; } while (val);
@@ -444,7 +446,8 @@ void kvprintf(const char *fmt, va_list args) {
                 break;
             }
             case 'u': {
-                unsigned int val = va_arg(args, unsigned int);
+                unsigned long long val = longlong ? va_arg(args, unsigned long long)
+                                       : va_arg(args, unsigned int);
                 int i = 0;
                 char numbuf[32];
                 do { numbuf[i++] = '0' + (val % 10); val /= 10; } while (val);
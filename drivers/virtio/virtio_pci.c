@@ -0,0 +1,155 @@
+#include <virtio.h>
+#include <heap.h>
+#include <string.h>
+#include <debug.h>
+
+// virtio_pci_cap fields, offsets from the capability
+#define VIRTIO_CAP_TYPE     3
+#define VIRTIO_CAP_BAR      4
+#define VIRTIO_CAP_OFFSET   8
+#define VIRTIO_CAP_NOTIFY_MULT 16
+
+#define VIRTIO_RESET_SPIN   1000000
+
+static volatile uint8_t* virtio_cap_map(struct pci_device* pci, uint8_t cap) {
+    uint8_t bar = pci_dev_read8(pci, cap + VIRTIO_CAP_BAR);
+    if (bar > 5 || pci_bar_is_io(pci, bar)) return 0;
+    uint64_t base = pci_bar_address(pci, bar);
+    if (!base || base >= 0x100000000ULL) return 0; // only 0-4GB is mapped
+    return (volatile uint8_t*)(uintptr_t)(base + pci_dev_read32(pci, cap + VIRTIO_CAP_OFFSET));
+}
+
+int virtio_pci_init(virtio_device_t* vdev, struct pci_device* pci) {
+    memset(vdev, 0, sizeof(*vdev));
+    vdev->pci = pci;
+    for (uint8_t cap = pci_find_capability(pci, PCI_CAP_ID_VENDOR, 0); cap;
+         cap = pci_find_capability(pci, PCI_CAP_ID_VENDOR, cap)) {
+        uint8_t type = pci_dev_read8(pci, cap + VIRTIO_CAP_TYPE);
+        volatile uint8_t* p = virtio_cap_map(pci, cap);
+        if (!p) continue;
+        // the first capability of each type is the preferred one
+        if (type == VIRTIO_PCI_CAP_COMMON && !vdev->common) {
+            vdev->common = (volatile virtio_pci_common_t*)p;
+        } else if (type == VIRTIO_PCI_CAP_NOTIFY && !vdev->notify_base) {
+            vdev->notify_base = p;
+            vdev->notify_mult = pci_dev_read32(pci, cap + VIRTIO_CAP_NOTIFY_MULT);
+        } else if (type == VIRTIO_PCI_CAP_ISR && !vdev->isr) {
+            vdev->isr = p;
+        } else if (type == VIRTIO_PCI_CAP_DEVICE && !vdev->config) {
+            vdev->config = p;
+        }
+    }
+    if (!vdev->common || !vdev->notify_base || !vdev->isr) {
+        kdbg(KWARN, "virtio: %02x:%02x.%d has no usable modern interface\n", pci->bus,
+             pci->device, pci->function);
+        return -1;
+    }
+    pci_enable_bus_master(pci);
+
+    vdev->common->device_status = 0;
+    for (int spin = 0; vdev->common->device_status && spin < VIRTIO_RESET_SPIN; spin++)
+        __asm__ volatile("pause");
+    if (vdev->common->device_status) {
+        kdbg(KERR, "virtio: device does not reset\n");
+        return -1;
+    }
+    vdev->common->device_status = VIRTIO_STATUS_ACK;
+    vdev->common->device_status = VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER;
+    return 0;
+}
+
+int virtio_negotiate(virtio_device_t* vdev, uint64_t wanted) {
+    volatile virtio_pci_common_t* c = vdev->common;
+    c->device_feature_select = 0;
+    uint64_t offered = c->device_feature;
+    c->device_feature_select = 1;
+    offered |= (uint64_t)c->device_feature << 32;
+
+    wanted |= 1ULL << VIRTIO_F_VERSION_1;
+    vdev->features = offered & wanted;
+    if (!(vdev->features & (1ULL << VIRTIO_F_VERSION_1))) {
+        kdbg(KERR, "virtio: device is legacy only\n");
+        virtio_fail(vdev);
+        return -1;
+    }
+    c->driver_feature_select = 0;
+    c->driver_feature = (uint32_t)vdev->features;
+    c->driver_feature_select = 1;
+    c->driver_feature = (uint32_t)(vdev->features >> 32);
+
+    c->device_status |= VIRTIO_STATUS_FEATURES_OK;
+    if (!(c->device_status & VIRTIO_STATUS_FEATURES_OK)) {
+        kdbg(KERR, "virtio: features 0x%llx rejected\n", vdev->features);
+        virtio_fail(vdev);
+        return -1;
+    }
+    return 0;
+}
+
+int virtio_has_feature(virtio_device_t* vdev, int bit) {
+    return (vdev->features >> bit) & 1;
+}
+
+virtqueue_t* virtio_setup_queue(virtio_device_t* vdev, uint16_t index, uint16_t msix_entry) {
+    volatile virtio_pci_common_t* c = vdev->common;
+    c->queue_select = index;
+    uint16_t size = c->queue_size;
+    if (!size) return 0;
+    if (size > VIRTQ_MAX_SIZE) size = VIRTQ_MAX_SIZE; // both are powers of two
+
+    virtqueue_t* vq = kmalloc(sizeof(virtqueue_t));
+    if (!vq) return 0;
+    memset(vq, 0, sizeof(*vq));
+    vq->vdev = vdev;
+    vq->index = index;
+    vq->size = size;
+    vq->desc = kmalloc_aligned(size * sizeof(virtq_desc_t), 16);
+    vq->avail = kmalloc_aligned(6 + 2 * size, 2);
+    vq->used = kmalloc_aligned(6 + 8 * size, 4);
+    vq->cookies = kmalloc(size * sizeof(void*));
+    if (virtio_has_feature(vdev, VIRTIO_F_INDIRECT_DESC))
+        vq->indirect = kmalloc_aligned(size * VIRTQ_MAX_INDIRECT * sizeof(virtq_desc_t), 16);
+    if (!vq->desc || !vq->avail || !vq->used || !vq->cookies) {
+        kdbg(KERR, "virtio: queue %d: out of memory\n", index);
+        kfree_aligned(vq->desc);
+        kfree_aligned((void*)vq->avail);
+        kfree_aligned((void*)vq->used);
+        kfree(vq->cookies);
+        kfree_aligned(vq->indirect);
+        kfree(vq);
+        return 0;
+    }
+    memset(vq->desc, 0, size * sizeof(virtq_desc_t));
+    memset((void*)vq->avail, 0, 6 + 2 * size);
+    memset((void*)vq->used, 0, 6 + 8 * size);
+    memset(vq->cookies, 0, size * sizeof(void*));
+    for (uint16_t i = 0; i < size; i++)
+        vq->desc[i].next = i + 1;
+    vq->num_free = size;
+
+    c->queue_size = size;
+    c->queue_msix_vector = msix_entry;
+    if (msix_entry != VIRTIO_MSI_NO_VECTOR && c->queue_msix_vector != msix_entry)
+        kdbg(KWARN, "virtio: queue %d: msi-x entry %d refused\n", index, msix_entry);
+    c->queue_desc_lo = (uint32_t)(uintptr_t)vq->desc;
+    c->queue_desc_hi = 0;
+    c->queue_driver_lo = (uint32_t)(uintptr_t)vq->avail;
+    c->queue_driver_hi = 0;
+    c->queue_device_lo = (uint32_t)(uintptr_t)vq->used;
+    c->queue_device_hi = 0;
+    vq->notify = (volatile uint16_t*)(vdev->notify_base + c->queue_notify_off * vdev->notify_mult);
+    c->queue_enable = 1;
+    return vq;
+}
+
+void virtio_driver_ok(virtio_device_t* vdev) {
+    vdev->common->device_status |= VIRTIO_STATUS_DRIVER_OK;
+}
+
+void virtio_fail(virtio_device_t* vdev) {
+    vdev->common->device_status |= VIRTIO_STATUS_FAILED;
+}
+
+uint8_t virtio_isr(virtio_device_t* vdev) {
+    return *vdev->isr;
+}
@@ -0,0 +1,107 @@
+#include <virtio.h>
+#include <stddef.h>
+
+// with EVENT_IDX each side publishes the ring index it wants to hear about
+// in the slot after the other side's ring
+static inline volatile uint16_t* vq_used_event(virtqueue_t* vq) {
+    return &vq->avail->ring[vq->size];
+}
+
+static inline volatile uint16_t* vq_avail_event(virtqueue_t* vq) {
+    return (volatile uint16_t*)&vq->used->ring[vq->size];
+}
+
+static inline void vq_fill(virtq_desc_t* d, const iovec_t* sg, int write, int more) {
+    d->addr = (uintptr_t)sg->base;
+    d->len = sg->len;
+    d->flags = (write ? VIRTQ_DESC_F_WRITE : 0) | (more ? VIRTQ_DESC_F_NEXT : 0);
+}
+
+int virtqueue_add(virtqueue_t* vq, const iovec_t* sg, int out, int in, void* cookie) {
+    int total = out + in;
+    if (total < 1) return -1;
+    // one ring slot per request when the table fits, whatever the segment count
+    int indirect = vq->indirect && total > 1 && total <= VIRTQ_MAX_INDIRECT;
+    if (vq->num_free < (indirect ? 1 : total)) return -1;
+
+    uint16_t head = vq->free_head;
+    if (indirect) {
+        virtq_desc_t* table = &vq->indirect[head * VIRTQ_MAX_INDIRECT];
+        for (int i = 0; i < total; i++) {
+            vq_fill(&table[i], &sg[i], i >= out, i + 1 < total);
+            table[i].next = i + 1;
+        }
+        virtq_desc_t* d = &vq->desc[head];
+        vq->free_head = d->next;
+        d->addr = (uintptr_t)table;
+        d->len = total * sizeof(virtq_desc_t);
+        d->flags = VIRTQ_DESC_F_INDIRECT;
+        vq->num_free--;
+    } else {
+        // free descriptors are linked through next, so the chain is already in place
+        uint16_t i = head;
+        for (int n = 0; n < total; n++) {
+            vq_fill(&vq->desc[i], &sg[n], n >= out, n + 1 < total);
+            i = vq->desc[i].next;
+        }
+        vq->free_head = i;
+        vq->num_free -= total;
+    }
+    vq->cookies[head] = cookie;
+
+    uint16_t idx = vq->avail->idx;
+    vq->avail->ring[idx & (vq->size - 1)] = head;
+    __asm__ volatile("" ::: "memory"); // x86 keeps stores in order; the compiler must too
+    vq->avail->idx = idx + 1;
+    return 0;
+}
+
+void virtqueue_kick(virtqueue_t* vq) {
+    // the new avail idx must be visible before the suppression state is read
+    __sync_synchronize();
+    uint16_t now = vq->avail->idx, old = vq->kicked;
+    vq->kicked = now;
+    int notify;
+    if (virtio_has_feature(vq->vdev, VIRTIO_F_EVENT_IDX)) {
+        uint16_t event = *vq_avail_event(vq);
+        notify = (uint16_t)(now - event - 1) < (uint16_t)(now - old);
+    } else {
+        notify = !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+    }
+    if (notify) *vq->notify = vq->index;
+}
+
+static void vq_detach(virtqueue_t* vq, uint16_t head) {
+    uint16_t i = head, n = 1;
+    while (vq->desc[i].flags & VIRTQ_DESC_F_NEXT) {
+        i = vq->desc[i].next;
+        n++;
+    }
+    vq->desc[i].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += n;
+}
+
+void* virtqueue_get_buf(virtqueue_t* vq, uint32_t* len) {
+    if (vq->last_used == vq->used->idx) return NULL;
+    __asm__ volatile("" ::: "memory"); // read the element after the index
+    volatile virtq_used_elem_t* e = &vq->used->ring[vq->last_used & (vq->size - 1)];
+    uint16_t head = e->id;
+    if (len) *len = e->len;
+    vq->last_used++;
+    if (head >= vq->size) return NULL;
+    void* cookie = vq->cookies[head];
+    vq->cookies[head] = NULL;
+    vq_detach(vq, head);
+    // used_event is left alone: until virtqueue_enable_cb the device stays quiet
+    return cookie;
+}
+
+int virtqueue_enable_cb(virtqueue_t* vq) {
+    if (virtio_has_feature(vq->vdev, VIRTIO_F_EVENT_IDX))
+        *vq_used_event(vq) = vq->last_used;
+    else
+        vq->avail->flags &= ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+    __sync_synchronize();
+    return vq->used->idx != vq->last_used;
+}
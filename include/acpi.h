@@ -0,0 +1,245 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+#define ACPI_MAX_TABLES     32
+#define ACPI_MAX_CPUS       32
+#define ACPI_MAX_IOAPICS    8
+#define ACPI_MAX_OVERRIDES  16
+#define ACPI_MAX_MCFG       4
+
+// --- Firmware structures ---------------------------------------------------
+typedef struct __attribute__((packed)) {
+    char     signature[8];     // "RSD PTR "
+    uint8_t  checksum;
+    char     oem_id[6];
+    uint8_t  revision;         // 0 = ACPI 1.0 (RSDT only), 2+ = XSDT present
+    uint32_t rsdt_address;
+    // ACPI 2.0+
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t  ext_checksum;
+    uint8_t  reserved[3];
+} acpi_rsdp_t;
+
+typedef struct __attribute__((packed)) {
+    char     signature[4];
+    uint32_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} acpi_sdt_header_t;
+
+// Generic Address Structure
+#define ACPI_GAS_MEMORY 0
+#define ACPI_GAS_IO     1
+
+typedef struct __attribute__((packed)) {
+    uint8_t  space_id;
+    uint8_t  bit_width;
+    uint8_t  bit_offset;
+    uint8_t  access_size;
+    uint64_t address;
+} acpi_gas_t;
+
+// MADT ("APIC")
+#define ACPI_MADT_LAPIC          0
+#define ACPI_MADT_IOAPIC         1
+#define ACPI_MADT_ISO            2
+#define ACPI_MADT_LAPIC_NMI      4
+#define ACPI_MADT_LAPIC_OVERRIDE 5
+
+#define ACPI_MADT_PCAT_COMPAT    0x1   // dual 8259 present
+#define ACPI_MADT_LAPIC_ENABLED  0x1
+
+typedef struct __attribute__((packed)) {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint8_t  entries[];
+} acpi_madt_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t length;
+} acpi_madt_entry_t;
+
+typedef struct __attribute__((packed)) {
+    acpi_madt_entry_t h;
+    uint8_t  processor_id;
+    uint8_t  apic_id;
+    uint32_t flags;
+} acpi_madt_lapic_t;
+
+typedef struct __attribute__((packed)) {
+    acpi_madt_entry_t h;
+    uint8_t  ioapic_id;
+    uint8_t  reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} acpi_madt_ioapic_t;
+
+typedef struct __attribute__((packed)) {
+    acpi_madt_entry_t h;
+    uint8_t  bus;
+    uint8_t  source;
+    uint32_t gsi;
+    uint16_t flags;
+} acpi_madt_iso_t;
+
+typedef struct __attribute__((packed)) {
+    acpi_madt_entry_t h;
+    uint16_t reserved;
+    uint64_t address;
+} acpi_madt_lapic_override_t;
+
+// HPET
+typedef struct __attribute__((packed)) {
+    acpi_sdt_header_t header;
+    uint32_t   event_timer_block_id;
+    acpi_gas_t base_address;
+    uint8_t    hpet_number;
+    uint16_t   min_tick;
+    uint8_t    page_protection;
+} acpi_hpet_t;
+
+// MCFG (PCI Express ECAM)
+typedef struct __attribute__((packed)) {
+    uint64_t base_address;
+    uint16_t segment;
+    uint8_t  start_bus;
+    uint8_t  end_bus;
+    uint32_t reserved;
+} acpi_mcfg_alloc_t;
+
+typedef struct __attribute__((packed)) {
+    acpi_sdt_header_t header;
+    uint64_t reserved;
+    acpi_mcfg_alloc_t allocs[];
+} acpi_mcfg_t;
+
+// FADT ("FACP"); fields past header.length must not be trusted
+#define ACPI_FADT_TMR_VAL_EXT (1 << 8)
+
+typedef struct __attribute__((packed)) {
+    acpi_sdt_header_t header;
+    uint32_t firmware_ctrl;
+    uint32_t dsdt;
+    uint8_t  reserved0;
+    uint8_t  preferred_pm_profile;
+    uint16_t sci_int;
+    uint32_t smi_cmd;
+    uint8_t  acpi_enable;
+    uint8_t  acpi_disable;
+    uint8_t  s4bios_req;
+    uint8_t  pstate_cnt;
+    uint32_t pm1a_evt_blk;
+    uint32_t pm1b_evt_blk;
+    uint32_t pm1a_cnt_blk;
+    uint32_t pm1b_cnt_blk;
+    uint32_t pm2_cnt_blk;
+    uint32_t pm_tmr_blk;
+    uint32_t gpe0_blk;
+    uint32_t gpe1_blk;
+    uint8_t  pm1_evt_len;
+    uint8_t  pm1_cnt_len;
+    uint8_t  pm2_cnt_len;
+    uint8_t  pm_tmr_len;
+    uint8_t  gpe0_blk_len;
+    uint8_t  gpe1_blk_len;
+    uint8_t  gpe1_base;
+    uint8_t  cst_cnt;
+    uint16_t p_lvl2_lat;
+    uint16_t p_lvl3_lat;
+    uint16_t flush_size;
+    uint16_t flush_stride;
+    uint8_t  duty_offset;
+    uint8_t  duty_width;
+    uint8_t  day_alrm;
+    uint8_t  mon_alrm;
+    uint8_t  century;
+    uint16_t iapc_boot_arch;
+    uint8_t  reserved1;
+    uint32_t flags;
+    acpi_gas_t reset_reg;
+    uint8_t  reset_value;
+    uint16_t arm_boot_arch;
+    uint8_t  fadt_minor_version;
+    uint64_t x_firmware_ctrl;
+    uint64_t x_dsdt;
+    acpi_gas_t x_pm1a_evt_blk;
+    acpi_gas_t x_pm1b_evt_blk;
+    acpi_gas_t x_pm1a_cnt_blk;
+    acpi_gas_t x_pm1b_cnt_blk;
+    acpi_gas_t x_pm2_cnt_blk;
+    acpi_gas_t x_pm_tmr_blk;
+    acpi_gas_t x_gpe0_blk;
+    acpi_gas_t x_gpe1_blk;
+} acpi_fadt_t;
+
+_Static_assert(sizeof(acpi_fadt_t) == 244, "acpi_fadt_t must be 244 bytes");
+
+// --- Parsed results, filled once by acpi_init() ------------------------------
+typedef struct {
+    uint8_t  id;
+    uint32_t address;
+    uint32_t gsi_base;
+} acpi_ioapic_info_t;
+
+typedef struct {
+    uint8_t  source;   // ISA irq
+    uint32_t gsi;
+    uint16_t flags;    // MPS polarity/trigger bits
+} acpi_irq_override_t;
+
+typedef struct {
+    int      present;
+
+    // MADT
+    uint64_t lapic_address;
+    int      pcat_compat;
+    int      cpu_count;
+    uint8_t  cpu_apic_ids[ACPI_MAX_CPUS];
+    int      ioapic_count;
+    acpi_ioapic_info_t  ioapics[ACPI_MAX_IOAPICS];
+    int      override_count;
+    acpi_irq_override_t overrides[ACPI_MAX_OVERRIDES];
+
+    // HPET
+    uint64_t hpet_address;     // 0 if absent
+    uint16_t hpet_min_tick;
+
+    // MCFG
+    int      mcfg_count;
+    acpi_mcfg_alloc_t mcfg[ACPI_MAX_MCFG];
+
+    // FADT
+    uint16_t sci_irq;
+    uint32_t pm_timer_port;    // 0 if absent
+    int      pm_timer_32bit;
+    uint8_t  century_reg;
+} acpi_info_t;
+
+void acpi_init(uint32_t magic, uint32_t mbi_addr);
+
+// Raw tables (NULL if the firmware did not provide them)
+const acpi_sdt_header_t* acpi_find_table(const char signature[4]);
+const acpi_madt_t* acpi_get_madt(void);
+const acpi_hpet_t* acpi_get_hpet(void);
+const acpi_mcfg_t* acpi_get_mcfg(void);
+const acpi_fadt_t* acpi_get_fadt(void);
+
+// Decoded view of the tables above
+const acpi_info_t* acpi_get_info(void);
+
+// ISA irq -> GSI, honouring MADT interrupt source overrides
+uint32_t acpi_irq_to_gsi(uint8_t irq, uint16_t* flags);
+// ECAM address of a function's config space, 0 if not covered by MCFG
+uint64_t acpi_ecam_address(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function);
+
+#endif // ACPI_H
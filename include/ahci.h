@@ -0,0 +1,92 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+
+// HBA registers (ABAR, PCI BAR5)
+#define AHCI_CAP        0x00
+#define AHCI_GHC        0x04
+#define AHCI_IS         0x08
+#define AHCI_PI         0x0C
+#define AHCI_VS         0x10
+
+#define AHCI_CAP_NP(c)    ((c) & 0x1F)
+#define AHCI_CAP_NCS(c)   ((((c) >> 8) & 0x1F) + 1)
+#define AHCI_CAP_SNCQ     (1u << 30)
+#define AHCI_GHC_HR       (1u << 0)
+#define AHCI_GHC_IE       (1u << 1)
+#define AHCI_GHC_AE       (1u << 31)
+
+// port registers, 0x100 + 0x80 * port
+#define AHCI_PORT(p)    (0x100 + (p) * 0x80)
+#define AHCI_PxCLB      0x00
+#define AHCI_PxCLBU     0x04
+#define AHCI_PxFB       0x08
+#define AHCI_PxFBU      0x0C
+#define AHCI_PxIS       0x10
+#define AHCI_PxIE       0x14
+#define AHCI_PxCMD      0x18
+#define AHCI_PxTFD      0x20
+#define AHCI_PxSIG      0x24
+#define AHCI_PxSSTS     0x28
+#define AHCI_PxSERR     0x30
+#define AHCI_PxSACT     0x34
+#define AHCI_PxCI       0x38
+
+#define AHCI_PxCMD_ST   (1u << 0)
+#define AHCI_PxCMD_FRE  (1u << 4)
+#define AHCI_PxCMD_FR   (1u << 14)
+#define AHCI_PxCMD_CR   (1u << 15)
+
+#define AHCI_PxIS_DHRS  (1u << 0)   // D2H register FIS
+#define AHCI_PxIS_PSS   (1u << 1)   // PIO setup FIS
+#define AHCI_PxIS_SDBS  (1u << 3)   // set device bits FIS (NCQ completion)
+#define AHCI_PxIS_TFES  (1u << 30)  // task file error
+#define AHCI_PxIS_ERROR 0x7DC00010u // all error bits
+
+#define AHCI_SIG_ATA    0x00000101
+#define AHCI_SSTS_DET_PRESENT 3
+
+#define AHCI_MAX_PORTS  32
+#define AHCI_MAX_SLOTS  32
+#define AHCI_PRDT_ENTRIES 32
+#define AHCI_PRD_MAX_BYTES (4u << 20)
+
+#define FIS_TYPE_REG_H2D 0x27
+#define AHCI_H2D_FIS_DWORDS 5
+
+#define ATA_CMD_READ_FPDMA_QUEUED  0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+
+typedef struct {
+    uint16_t flags;     // CFL in bits 0-4, W bit 6, C bit 10
+    uint16_t prdtl;
+    volatile uint32_t prdbc;
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+} __attribute__((packed)) ahci_cmd_header_t;
+
+#define AHCI_CMD_WRITE  (1u << 6)
+#define AHCI_CMD_CLEAR  (1u << 10)
+
+typedef struct {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;       // byte count - 1, bit 31 interrupt on completion
+} __attribute__((packed)) ahci_prd_t;
+
+typedef struct {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    ahci_prd_t prdt[AHCI_PRDT_ENTRIES];
+} __attribute__((packed)) ahci_cmd_table_t;
+
+_Static_assert(sizeof(ahci_cmd_header_t) == 32, "ahci_cmd_header_t must be 32 bytes");
+_Static_assert(sizeof(ahci_cmd_table_t) % 128 == 0, "command tables must stay 128-byte aligned");
+
+void ahci_init(void);
+
+#endif // AHCI_H
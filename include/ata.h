@@ -2,10 +2,12 @@
 #define ATA_H
 
 #include <stdint.h>
+#include <iovec.h>
 
 #define ATA_PRIMARY_BASE    0x1F0
 #define ATA_SECONDARY_BASE  0x170
 #define ATA_CONTROL_BASE    0x3F6
+#define ATA_SECONDARY_CONTROL 0x376
 
 #define ATA_DATA        0x00
 #define ATA_ERROR       0x01
@@ -21,6 +23,23 @@
 #define ATA_CMD_READ    0x20
 #define ATA_CMD_WRITE   0x30
 #define ATA_CMD_IDENTIFY 0xEC
+#define ATA_CMD_READ_EXT          0x24
+#define ATA_CMD_WRITE_EXT         0x34
+#define ATA_CMD_READ_MULTIPLE     0xC4
+#define ATA_CMD_WRITE_MULTIPLE    0xC5
+#define ATA_CMD_SET_MULTIPLE      0xC6
+#define ATA_CMD_READ_MULTIPLE_EXT  0x29
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+
+#define ATA_CMD_READ_DMA          0xC8
+#define ATA_CMD_WRITE_DMA         0xCA
+#define ATA_CMD_READ_DMA_EXT      0x25
+#define ATA_CMD_WRITE_DMA_EXT     0x35
+#define ATA_CMD_FLUSH_CACHE       0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT   0xEA
+
+#define ATA_MAX_SECTORS_28 256    // sector count 0 means 256
+#define ATA_MAX_SECTORS_48 65536  // sector count 0 means 65536
 
 #define ATA_SR_BSY      0x80
 #define ATA_SR_DRDY     0x40
@@ -31,10 +50,35 @@
 #define ATA_SR_IDX      0x02
 #define ATA_SR_ERR      0x01
 
+// bus-master IDE registers, BAR4 + 8 * channel
+#define BMIDE_COMMAND   0x00
+#define BMIDE_STATUS    0x02
+#define BMIDE_PRDT      0x04
+#define BMIDE_CMD_START 0x01
+#define BMIDE_CMD_READ  0x08   // device to memory
+#define BMIDE_SR_ACTIVE 0x01
+#define BMIDE_SR_ERR    0x02
+#define BMIDE_SR_IRQ    0x04
+
+#define ATA_PRD_ENTRIES 256
+#define ATA_PRD_EOT     0x8000
+
+// physical region descriptor; a region may not cross a 64K boundary
+typedef struct {
+    uint32_t addr;
+    uint16_t count;   // bytes, 0 means 64K
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+#define ATA_MAX_DRIVES  4    // primary/secondary master/slave
+
 typedef struct {
     uint8_t present;
     uint8_t type;
-    uint32_t sectors;
+    uint8_t lba48;      // READ/WRITE SECTORS EXT supported (IDENTIFY word 83 bit 10)
+    uint16_t multiple;  // sectors per DRQ block after SET MULTIPLE MODE, 1 if unused
+    uint8_t dma;        // bus-master DMA usable (controller found, IDENTIFY word 49 bit 8)
+    uint64_t sectors;
     uint32_t size;      
     char name[40];        
     char vendor[40];
@@ -44,6 +88,13 @@ typedef struct {
 void ata_init();
 int ata_read_sector(uint8_t drive, uint32_t lba, uint8_t* buffer);
 int ata_write_sector(uint8_t drive, uint32_t lba, uint8_t* buffer);
+// count sectors of 512 bytes; split into as few commands as the drive allows
+int ata_read_sectors(uint8_t drive, uint64_t lba, uint32_t count, uint8_t* buffer);
+int ata_write_sectors(uint8_t drive, uint64_t lba, uint32_t count, const uint8_t* buffer);
+// scatter-gather: every segment must be a multiple of 512 bytes
+int ata_read_sectors_iov(uint8_t drive, uint64_t lba, const iovec_t* iov, int iovcnt);
+int ata_write_sectors_iov(uint8_t drive, uint64_t lba, const iovec_t* iov, int iovcnt);
 ata_drive_t* ata_get_drive(uint8_t drive);
+int ata_flush(uint8_t drive);
 
 #endif // ATA_H 
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <block.h>
+
+#define BCACHE_HASH_SIZE         1024
+#define BCACHE_DEFAULT_BUDGET    (2 * 1024 * 1024)  // bytes of cached sectors
+#define BCACHE_FLUSH_INTERVAL_MS 500
+#define BCACHE_DIRTY_AGE_MS      3000               // written back by the flusher after this
+
+#define B_VALID 0x01    // data matches the disk or is newer
+#define B_DIRTY 0x02    // data is newer than the disk
+#define B_OWNED 0x04    // new from bcache_get, not ready until its caller fills it
+
+// One cached sector of a whole disk; partitions share their disk's buffers.
+typedef struct buf {
+    block_device_t* disk;
+    uint64_t block;             // sector on the disk
+    uint8_t* data;
+    uint32_t size;
+    uint32_t flags;
+    volatile int ready;         // 0 while the first read is in flight
+    int refcnt;                 // pinned while > 0, never evicted
+    uint32_t dirtied;           // timer tick the buffer became dirty
+    struct buf* hnext;
+    struct buf* prev;           // LRU list, most recently used first
+    struct buf* next;
+} buf_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;
+    uint32_t buffers;
+    uint32_t bytes;
+    uint32_t dirty;
+    uint32_t pinned;
+    uint32_t budget;
+} bcache_stats_t;
+
+void bcache_init(void);
+// the background write-back thread, started with thread_create
+void bcache_flusher(void);
+
+// Return the buffer for sector lba of dev, pinned; NULL on an I/O error
+// or when out of memory. bcache_get skips the read, for callers that
+// overwrite the whole sector; a buffer it creates is hidden from other
+// lookups until the caller's bcache_dirty or bcache_release.
+buf_t* bcache_read(block_device_t* dev, uint64_t lba);
+buf_t* bcache_get(block_device_t* dev, uint64_t lba);
+// mark a pinned buffer modified; the flusher writes it back later
+void bcache_dirty(buf_t* b);
+// unpin
+void bcache_release(buf_t* b);
+// write a dirty buffer now
+int bcache_write(buf_t* b);
+// write back every dirty buffer of the disk behind dev, all disks if NULL
+int bcache_sync(block_device_t* dev);
+// drop the clean unpinned buffers of dev's disk, all disks if NULL
+void bcache_invalidate(block_device_t* dev);
+
+void bcache_set_budget(uint32_t bytes);
+void bcache_get_stats(bcache_stats_t* st);
+
+// Keep the cache coherent with I/O that bypasses it (block_submit): cached
+// sectors take the data of a write before it is issued, and dirty ones are
+// copied over the result of a read.
+void bcache_io_hook(block_device_t* disk, uint64_t lba, const iovec_t* iov, int iovcnt, int write);
+// After a write with result rc: the cached sectors still holding its data
+// become clean on success and dirty on failure, so none of it is lost.
+// Deferred writes that fail at dispatch report here again.
+void bcache_write_done(block_device_t* disk, uint64_t lba, const iovec_t* iov, int iovcnt, int rc);
+
+#endif // BCACHE_H
@@ -0,0 +1,138 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include <iovec.h>
+#include <mutex.h>
+#include <waitqueue.h>
+
+#define BLOCK_MAX_DEVICES  32
+#define BLOCK_MAX_SEGMENTS 64    // upper bound on limits.max_segments
+#define BLOCK_NAME_LEN     16
+
+typedef struct block_device block_device_t;
+typedef struct blk_request blk_request_t;
+typedef struct bio bio_t;
+
+#define BLK_MAX_REQUEST_SECTORS 256   // merging stops at 128K per request
+#define BLK_BATCH_REQUESTS      32    // a plugged queue this long is dispatched
+#define BLK_WRITE_DEADLINE_MS   1000
+
+// Per-disk request queue. Plugged writes wait here, merged with their
+// neighbours, and leave in elevator order: ascending LBA from the last
+// dispatched request (C-LOOK), unless a request is past its deadline.
+// Reads are never queued: they are issued at once, served from queued
+// data they fall inside, and dispatch any queued write they overlap.
+typedef struct {
+    mutex_t lock;
+    blk_request_t* sorted;      // by LBA
+    blk_request_t* fifo;        // arrival order, for the deadline
+    int count;
+    int plugged;                // blk_plug nesting of plug_owner
+    thread_t* plug_owner;
+    uint64_t head;              // sector after the last dispatched request
+    int error;                  // first failed deferred request, reported at unplug
+    uint32_t merges;
+    uint32_t dispatched;
+    // asynchronous requests waiting for a worker thread
+    bio_t* bio_head;
+    bio_t* bio_tail;
+    volatile int bio_pending;
+    waitqueue_t bio_wq;
+    int workers;
+    int workers_started;        // bio_start_workers ran, even if it got none
+} blk_queue_t;
+
+typedef struct {
+    // lba is relative to the device; every segment is a whole number of
+    // sectors and the request fits the device's limits. 0 or < 0 on error
+    int (*submit)(block_device_t* dev, uint64_t lba, const iovec_t* iov, int iovcnt, int write);
+    // write the device's volatile cache to media; NULL if it has none
+    int (*flush)(block_device_t* dev);
+} block_ops_t;
+
+typedef struct {
+    uint32_t max_sectors;       // per submit call, 0 = unlimited
+    uint16_t max_segments;      // per submit call, 0 = BLOCK_MAX_SEGMENTS
+    uint16_t queue_depth;       // submit calls the driver runs at once, 0 = 1
+} block_limits_t;
+
+struct block_device {
+    char name[BLOCK_NAME_LEN];  // "ata0", "nvme0n1", partitions append "p1"
+    char model[41];
+    uint32_t sector_size;
+    uint64_t sectors;
+    block_limits_t limits;
+    const block_ops_t* ops;
+    void* priv;                 // driver data
+    block_device_t* parent;     // whole disk of a partition, NULL for disks
+    uint64_t start;             // first sector of a partition on its disk
+    uint8_t part_type;          // MBR partition type
+    int index;                  // position in the registry
+    blk_queue_t queue;          // disks only; partitions use their disk's
+};
+
+// Disks are registered by their drivers; dev must stay allocated.
+// Returns the index (the "drive number" fat32 and the shell use), -1 if full.
+int block_register(block_device_t* dev);
+// add the MBR partitions of every registered disk after the disks themselves
+void block_scan_partitions(void);
+int block_count(void);
+block_device_t* block_get(int index);
+block_device_t* block_find(const char* name);
+
+// Requests are checked against the device size, moved onto the parent
+// disk for partitions and split to the driver's limits.
+int block_submit(block_device_t* dev, uint64_t lba, const iovec_t* iov, int iovcnt, int write);
+int block_read(block_device_t* dev, uint64_t lba, uint32_t count, void* buf);
+int block_write(block_device_t* dev, uint64_t lba, uint32_t count, const void* buf);
+int block_flush(block_device_t* dev);
+
+// Plug the disk behind dev for the calling thread: its writes are queued,
+// merged and sorted instead of issued one by one. Reads see queued data.
+// The queue is dispatched at the outermost blk_unplug, when it reaches
+// BLK_BATCH_REQUESTS or when a request expires, and on block_flush.
+void blk_plug(block_device_t* dev);
+// returns the first error among the writes deferred under the plug
+int blk_unplug(block_device_t* dev);
+
+#define BIO_MAX_WORKERS       4   // worker threads per disk
+#define BIO_MAX_TOTAL_WORKERS 8   // all disks together; they hold thread slots for good
+
+typedef void (*bio_end_io_t)(bio_t* bio);
+
+// An asynchronous request. The caller owns the bio and its iovec until it
+// completes; bios in flight together may complete in any order.
+struct bio {
+    block_device_t* dev;
+    uint64_t lba;
+    const iovec_t* iov;
+    int iovcnt;
+    int write;
+    int status;                 // block_submit's result, valid once done
+    volatile int done;
+    bio_end_io_t end_io;        // run on completion, in thread context; NULL to wait instead
+    void* priv;                 // for end_io
+    waitqueue_t wait;
+    bio_t* next;
+};
+
+void bio_init(bio_t* bio, block_device_t* dev, uint64_t lba, const iovec_t* iov, int iovcnt, int write);
+// Queue the bio for the disk's worker threads; up to limits.queue_depth of
+// them run at once. Before threads run (or with interrupts off), and on a
+// disk left without workers by BIO_MAX_TOTAL_WORKERS, the bio is executed
+// and completed before this returns.
+void block_submit_bio(bio_t* bio);
+// sleep until the bio completes; returns its status. Not for bios with end_io,
+// which own the bio once they run.
+int bio_wait(bio_t* bio);
+// completed yet; only for bios without end_io, whose done is never set
+static inline int bio_done(const bio_t* bio) { return bio->done; }
+
+// internal, between block.c and queue.c
+void blk_queue_init(blk_queue_t* q);
+int blk_queue_submit(block_device_t* disk, uint64_t lba, const iovec_t* iov, int iovcnt, int write);
+int blk_queue_drain(block_device_t* disk);
+int block_issue(block_device_t* disk, uint64_t lba, const iovec_t* iov, int iovcnt, int write);
+
+#endif // BLOCK_H
@@ -22,4 +22,25 @@ static inline void set_cr3(uint64_t value) {
     __asm__ volatile("mov %0, %%cr3" : : "r" (value));
 }
 
+static inline uint64_t rdtsc() {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#define RFLAGS_IF 0x200
+
+static inline uint64_t read_rflags() {
+    uint64_t flags;
+    __asm__ volatile("pushfq; popq %0" : "=r" (flags));
+    return flags;
+}
+
+// always inlined so the address belongs to the caller
+static inline __attribute__((always_inline)) uint64_t current_rip() {
+    uint64_t rip;
+    __asm__ volatile("lea 0(%%rip), %0" : "=r" (rip));
+    return rip;
+}
+
 #endif // _CPU_H
\ No newline at end of file
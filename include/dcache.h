@@ -0,0 +1,49 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdint.h>
+#include <fat32.h>
+
+#define DCACHE_HASH_SIZE   512
+#define DCACHE_MAX_ENTRIES 1024
+
+// A name in a directory, or its absence (negative entry).
+typedef struct dentry {
+    uint8_t drive;
+    uint32_t parent;            // first cluster of the directory holding it
+    uint32_t hash;              // of drive, parent and the case-folded name
+    int negative;
+    fat32_entry_t ent;          // name as on disk; the looked-up name if negative
+    struct dentry* hnext;       // name hash chain
+    struct dentry* cnext;       // cluster hash chain, subdirectories only
+    struct dentry* prev;        // LRU list, most recently used first
+    struct dentry* next;
+} dentry_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t negative_hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t entries;
+} dcache_stats_t;
+
+void dcache_init(void);
+
+// 1 and the entry if name is in directory parent, 0 if it is known not to
+// be, -1 if the cache doesn't know. Names compare case-insensitively.
+int  dcache_lookup(uint8_t drive, uint32_t parent, const char* name, fat32_entry_t* out);
+// find a subdirectory by its first cluster: its parent and entry
+int  dcache_lookup_dir(uint8_t drive, uint32_t cluster, uint32_t* parent, fat32_entry_t* out);
+
+// add or replace an entry; a negative one records that name is absent
+void dcache_add(uint8_t drive, uint32_t parent, const fat32_entry_t* ent);
+void dcache_add_negative(uint8_t drive, uint32_t parent, const char* name);
+// forget one name, for create, rename and delete
+void dcache_remove(uint8_t drive, uint32_t parent, const char* name);
+// forget everything about a volume, e.g. on mount or mkfs
+void dcache_invalidate(uint8_t drive);
+
+void dcache_get_stats(dcache_stats_t* st);
+
+#endif // DCACHE_H
@@ -3,6 +3,8 @@
 #define FAT32_H
 
 #include <stdint.h>
+#include <iovec.h>
+#include <block.h>
 
 // --- BIOS Parameter Block (BPB) для FAT32 -------------------------------
 #pragma pack(push, 1)
@@ -80,8 +82,93 @@ typedef struct {
     uint8_t  attr;
     uint32_t first_cluster;
     uint32_t size;
+    uint32_t dir_lba;       // сектор с SFN-записью, 0 — не с диска
+    uint16_t dir_off;       // её смещение в секторе
 } fat32_entry_t;
 
+// --- Итератор каталога ---------------------------------------------------
+typedef struct {
+    uint8_t  drive;
+    uint32_t first_cluster;
+    uint32_t cluster;       // кластер, в котором запись pos
+    uint32_t pos;           // номер 32-байтной записи от начала каталога
+    int      end;
+    struct buf* buf;        // закреплённый буфер кеша с текущим сектором
+    uint32_t buf_lba;
+    char     lfn[20][14];   // части длинного имени, собираемые по ходу
+    int      lfn_present;
+    uint8_t  lfn_sum;       // контрольная сумма SFN из записей LFN
+} fat32_dir_t;
+
+// --- Карта экстентов: цепочка кластеров файла непрерывными участками ---
+#define FAT32_PREALLOC_MAX (1024 * 1024)  // запас кластеров растущему файлу
+
+typedef struct {
+    uint32_t file_cluster;  // номер кластера в файле
+    uint32_t disk_cluster;
+    uint32_t length;        // кластеров подряд
+} fat32_extent_t;
+
+typedef struct {
+    uint8_t  drive;
+    uint32_t first_cluster;
+    fat32_extent_t *ext;    // по возрастанию file_cluster
+    int      count;
+    int      cap;
+    uint32_t mapped;        // отображено кластеров с начала цепочки
+    int      complete;      // дошли до конца цепочки
+} fat32_extmap_t;
+
+// --- Состояние упреждающего чтения одного открытого файла ---------------
+#define FAT32_RA_MIN (16 * 1024)    // окно при начале последовательного чтения
+#define FAT32_RA_MAX (128 * 1024)   // окно удваивается до этого размера
+
+typedef struct {
+    uint8_t *data;          // FAT32_RA_MAX байт, выделяется при первом чтении
+    uint32_t start;         // смещение в файле (кратно 512)
+    uint32_t len;           // байт в окне, 0 — пустое
+    int      busy;          // чтение запущено, bio ещё не дождались
+    int      status;
+    iovec_t  iov;
+    bio_t    bio;
+} fat32_ra_win_t;
+
+typedef struct {
+    uint8_t  drive;
+    uint32_t first_cluster;
+    uint32_t size;          // размер файла, 0 — читать до конца цепочки
+    uint32_t next;          // где кончилось прошлое чтение
+    uint32_t window;        // текущий размер упреждения, 0 — доступ не последовательный
+    fat32_extmap_t map;
+    fat32_ra_win_t win[2];  // текущее окно и окно впереди
+} fat32_ra_t;
+
+// --- Таблица открытых файлов ---------------------------------------------
+#define FAT32_MAX_OPEN 32
+
+#define FAT32_O_READ   0x01
+#define FAT32_O_WRITE  0x02
+#define FAT32_O_RDWR   (FAT32_O_READ | FAT32_O_WRITE)
+#define FAT32_O_CREAT  0x04
+#define FAT32_O_TRUNC  0x08
+#define FAT32_O_APPEND 0x10
+
+#define FAT32_SEEK_SET 0
+#define FAT32_SEEK_CUR 1
+#define FAT32_SEEK_END 2
+
+typedef struct {
+    int      used;
+    int      flags;         // FAT32_O_*
+    uint8_t  drive;
+    uint32_t dir;           // кластер каталога, где лежит запись файла
+    fat32_entry_t ent;      // место записи, размер и первый кластер
+    uint32_t pos;
+    int      grown;         // файл уже удлинялся через этот дескриптор
+    int      prealloc;      // за концом есть запасные кластеры, снять при закрытии
+    fat32_ra_t ra;          // упреждение; его карта экстентов — карта файла
+} fat32_file_t;
+
 // ------------------- Публичный API дискового драйвера -------------------
 #ifdef __cplusplus
 extern "C" {
@@ -91,10 +178,21 @@ int      fat32_mount(uint8_t drive);
 uint32_t fat32_cluster_to_lba(uint32_t cluster);
 uint32_t fat32_get_next_cluster(uint8_t drive, uint32_t cluster);
 
-// Чтение каталога с конвертацией LFN-цепочек. Возвращает кол-во элементов.
+// Чтение каталога с конвертацией LFN-цепочек в массив (не больше
+// max_entries, остальное отбрасывается). Возвращает кол-во элементов.
 int fat32_list_dir(uint8_t drive, uint32_t cluster,
                    fat32_entry_t* entries, int max_entries);
 
+// Обход каталога по одной записи, память постоянная: LFN-цепочки
+// собираются на лету из секторов кеша буферов. readdir: 1 — запись в out,
+// 0 — конец, <0 — ошибка. telldir/seekdir запоминают и восстанавливают
+// место между записями. closedir обязателен — он снимает закрепление буфера.
+int      fat32_opendir(uint8_t drive, uint32_t cluster, fat32_dir_t* dir);
+int      fat32_readdir(fat32_dir_t* dir, fat32_entry_t* out);
+uint32_t fat32_telldir(const fat32_dir_t* dir);
+void     fat32_seekdir(fat32_dir_t* dir, uint32_t pos);
+void     fat32_closedir(fat32_dir_t* dir);
+
 // Обратная совместимость – функции, на которые ранее ссылался shell.c
 int fat32_read_dir(uint8_t drive, uint32_t cluster,
                    fat32_dir_entry_t* entries, int max_entries);
@@ -111,11 +209,69 @@ int fat32_read_file_data(uint8_t drive, const char* path,
                          uint32_t offset);
 int fat32_create_dir(uint8_t drive, const char* name);
 
+// Векторный ввод-вывод: данные идут прямо в сегменты вызывающего.
+// readv читает с позиции offset цепочки first_cluster, возвращает число байт;
+// writev пишет в файл по пути (создаёт его при offset 0).
+int fat32_readv(uint8_t drive, uint32_t first_cluster, uint32_t offset,
+                const iovec_t* iov, int iovcnt);
+int fat32_writev(uint8_t drive, const char* name,
+                 const iovec_t* iov, int iovcnt, uint32_t offset);
+
+// Дескрипторы файлов: путь как у fat32_lookup, при FAT32_O_CREAT файл
+// создаётся в каталоге из пути. Чтение и запись идут с любого смещения
+// потоком, без загрузки файла целиком; read/write сдвигают позицию,
+// preadv/pwritev её не трогают. open возвращает дескриптор или <0,
+// остальные — число байт / новую позицию или <0. Файл открывается либо
+// многими читателями, либо одним писателем; иначе open возвращает -4
+// (то же для fallocate и trim, пока файл открыт).
+int     fat32_open(uint8_t drive, const char* path, int flags);
+int     fat32_read(int fd, void* buf, uint32_t size);
+int     fat32_write(int fd, const void* buf, uint32_t size);
+int     fat32_preadv(int fd, const iovec_t* iov, int iovcnt, uint32_t offset);
+int     fat32_pwritev(int fd, const iovec_t* iov, int iovcnt, uint32_t offset);
+int64_t fat32_seek(int fd, int64_t offset, int whence);
+int     fat32_close(int fd);
+
+// Место под файл: fallocate резервирует кластеры под [0, length) одним
+// участком, где это возможно, не меняя размера (как FALLOC_FL_KEEP_SIZE);
+// trim освобождает кластеры за размером файла из его записи каталога,
+// в том числе зарезервированные fallocate.
+int fat32_fallocate(uint8_t drive, const char* name, uint32_t length);
+int fat32_trim(uint8_t drive, const char* name);
+
+// Карта строится лениво, по мере обращения к дальним кластерам; поиск
+// кластера по смещению — двоичный. Владелец карты дополняет её сам при
+// удлинении цепочки (это делает fat32_writev со своей картой).
+void fat32_extmap_init(fat32_extmap_t* map, uint8_t drive, uint32_t first_cluster);
+void fat32_extmap_free(fat32_extmap_t* map);
+
+// Чтение с упреждением: последовательный доступ распознаётся по смещению,
+// следующее окно читается асинхронно, пока вызывающий разбирает текущее.
+// Состояние принадлежит одному читателю; после записи в файл — заново init.
+void fat32_ra_init(fat32_ra_t* ra, uint8_t drive, uint32_t first_cluster, uint32_t size);
+int  fat32_read_ra(fat32_ra_t* ra, uint32_t offset, const iovec_t* iov, int iovcnt);
+void fat32_ra_release(fat32_ra_t* ra);
+
+// Разбор пути: "a/b/c", "/x/y", "..\..", "0:\dir\file"; разделители '/' и '\'.
+// Каждый компонент ищется через кеш dentry. В out — конечная запись, в dir
+// (если не NULL) — кластер каталога, где она лежит; для ".", ".." и корня
+// out описывает сам каталог, и dir — он же. -1 — нет такого пути,
+// -2 — промежуточный компонент не каталог.
+int fat32_lookup(uint8_t drive, const char* path, fat32_entry_t* out, uint32_t* dir);
+// Кластер каталога по пути; -2, если путь ведёт к файлу.
 int fat32_resolve_path(uint8_t drive, const char* path, uint32_t* target_cluster);
+// Имя каталога cluster в родителе и кластер родителя; из кеша dentry,
+// диск читается только при промахе.
+int fat32_dir_name(uint8_t drive, uint32_t cluster, uint32_t* parent, char* name, int size);
 int fat32_change_dir(uint8_t drive, const char* path);
 
 void fat32_create_fs(uint8_t drive);
 
+// Сводка по тому: всего кластеров, свободных и байт в кластере. Число
+// свободных — подсчёт по FAT в памяти или, если её нет, счётчик FSInfo;
+// 0xFFFFFFFF, если не известно ни то, ни другое. -1 — том не смонтирован.
+int fat32_statfs(uint32_t* total, uint32_t* free, uint32_t* cluster_bytes);
+
 extern fat32_bpb_t  fat32_bpb;
 extern uint32_t     fat_start;
 extern uint32_t     root_dir_first_cluster;
@@ -11,6 +11,9 @@ void *kmalloc(size_t size);
 void *kcalloc(size_t nmemb, size_t size);
 void *krealloc(void *ptr, size_t size);
 void kfree(void *ptr);
+// align must be a power of two; free with kfree_aligned
+void *kmalloc_aligned(size_t size, size_t align);
+void kfree_aligned(void *ptr);
 size_t heap_total(void);
 size_t heap_used(void);
 size_t heap_free(void);
@@ -0,0 +1,18 @@
+#ifndef IOVEC_H
+#define IOVEC_H
+
+#include <stdint.h>
+
+// one piece of a scatter-gather buffer; memory is identity mapped, so base is also the DMA address
+typedef struct {
+    void*    base;
+    uint32_t len;
+} iovec_t;
+
+static inline uint64_t iov_total(const iovec_t* iov, int cnt) {
+    uint64_t total = 0;
+    for (int i = 0; i < cnt; i++) total += iov[i].len;
+    return total;
+}
+
+#endif // IOVEC_H
@@ -0,0 +1,44 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+#include <cpu.h>
+
+typedef enum {
+    IRQ_NONE        = 0,   // not our device
+    IRQ_HANDLED     = 1,
+    IRQ_WAKE_THREAD = 2,   // run the threaded part
+} irqreturn_t;
+
+// top half: runs in isr_dispatch with interrupts off
+typedef irqreturn_t (*irq_handler_t)(cpu_registers_t* regs, void* cookie);
+// bottom half: runs in the action's kernel thread with interrupts on
+typedef void (*irq_thread_fn_t)(void* cookie);
+
+#define IRQF_SHARED  0x01  // line may be shared with other IRQF_SHARED actions
+#define IRQF_ONESHOT 0x02  // keep the PIC line masked until the thread has run
+
+#define IRQ_THREAD_PRIO 10 // default priority of interrupt threads
+
+int irq_request(uint8_t vector, irq_handler_t handler, uint32_t flags,
+                const char* name, void* cookie);
+// handler may be NULL: the thread is then woken on every interrupt
+int irq_request_threaded(uint8_t vector, irq_handler_t handler, irq_thread_fn_t thread_fn,
+                         uint32_t flags, const char* name, void* cookie, int priority);
+void irq_free(uint8_t vector, void* cookie);
+
+// Dynamic vectors for MSI/MSI-X, acknowledged at the local APIC.
+#define IRQ_DYN_VECTOR_BASE 0x30
+#define IRQ_DYN_VECTOR_END  0xEF
+// count vectors starting on a multiple of align (MSI needs aligned blocks)
+int irq_alloc_vectors(int count, int align);
+void irq_free_vectors(int first, int count);
+int irq_vector_is_dynamic(uint8_t vector);
+
+// called by isr_dispatch; returns 1 if any action claimed the interrupt
+int irq_handle_chain(uint8_t vector, cpu_registers_t* regs);
+int irq_has_chain(uint8_t vector);
+// set when an irq thread was woken; isr_dispatch yields to it after EOI
+extern volatile int irq_need_resched;
+
+#endif // IRQ_H
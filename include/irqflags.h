@@ -0,0 +1,36 @@
+#ifndef IRQFLAGS_H
+#define IRQFLAGS_H
+
+#include <stdint.h>
+#include <cpu.h>
+#include <latency.h>
+
+// cli/sti wrappers that feed the irqsoff latency tracer.
+// Use these instead of bare cli/sti so long masked regions are visible.
+
+static inline __attribute__((always_inline)) void local_irq_disable() {
+    uint64_t flags = read_rflags();
+    __asm__ volatile("cli" ::: "memory");
+    if (flags & RFLAGS_IF) latency_irqs_off(current_rip());
+}
+
+static inline __attribute__((always_inline)) void local_irq_enable() {
+    if (!(read_rflags() & RFLAGS_IF)) latency_irqs_on(current_rip());
+    __asm__ volatile("sti" ::: "memory");
+}
+
+static inline __attribute__((always_inline)) uint64_t local_irq_save() {
+    uint64_t flags = read_rflags();
+    __asm__ volatile("cli" ::: "memory");
+    if (flags & RFLAGS_IF) latency_irqs_off(current_rip());
+    return flags;
+}
+
+static inline __attribute__((always_inline)) void local_irq_restore(uint64_t flags) {
+    if (flags & RFLAGS_IF) {
+        latency_irqs_on(current_rip());
+        __asm__ volatile("sti" ::: "memory");
+    }
+}
+
+#endif // IRQFLAGS_H
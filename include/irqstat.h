@@ -0,0 +1,42 @@
+#ifndef IRQSTAT_H
+#define IRQSTAT_H
+
+#include <stdint.h>
+
+#define IRQSTAT_VECTORS 256
+#define IRQSTAT_BUCKETS 32   // log2(cycles) buckets, last one catches everything above
+
+typedef struct {
+    uint64_t count;
+    uint64_t spurious;
+    uint64_t total_cycles;
+    uint64_t min_cycles;
+    uint64_t max_cycles;
+    uint32_t hist[IRQSTAT_BUCKETS];
+} irqstat_t;
+
+extern irqstat_t irq_stats[IRQSTAT_VECTORS];
+
+// called from isr_dispatch with interrupts off, so no locking; keep it cheap
+static inline void irqstat_record(uint8_t vec, uint64_t cycles)
+{
+    irqstat_t* s = &irq_stats[vec];
+    int bucket = 63 - __builtin_clzll(cycles | 1);
+    if (bucket >= IRQSTAT_BUCKETS) bucket = IRQSTAT_BUCKETS - 1;
+    s->count++;
+    s->total_cycles += cycles;
+    if (cycles < s->min_cycles || s->count == 1) s->min_cycles = cycles;
+    if (cycles > s->max_cycles) s->max_cycles = cycles;
+    s->hist[bucket]++;
+}
+
+static inline void irqstat_spurious(uint8_t vec)
+{
+    irq_stats[vec].spurious++;
+}
+
+void irqstat_reset(void);
+// vec < 0: summary of every vector that fired, otherwise that vector's histogram
+void irqstat_print(int vec);
+
+#endif // IRQSTAT_H
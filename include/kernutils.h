@@ -12,7 +12,8 @@ extern int drive_num;
 
 uint8_t hex_char_to_byte(char c);
 void hexstr_to_bytes(const char* hex_str, uint8_t* byte_array, size_t max_bytes);
-int build_path(uint32_t cluster, char path[][9], int max_depth);
+#define PATH_NAME_MAX 32    // longer directory names are cut in the prompt
+int build_path(uint32_t cluster, char path[][PATH_NAME_MAX + 1], int max_depth);
 void print_prompt();
 void fat_name_from_string(const char *src, char dest[11]);
 
@@ -0,0 +1,19 @@
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include <stdint.h>
+
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+// MSI address window; the destination APIC id goes into bits 12-19
+#define LAPIC_MSI_ADDRESS 0xFEE00000
+
+void lapic_init(void);
+int lapic_enabled(void);
+uint8_t lapic_id(void);
+void lapic_eoi(void);
+// processors listed in the MADT, and this one's position among them
+int lapic_cpu_count(void);
+int lapic_cpu_index(void);
+
+#endif // LAPIC_H
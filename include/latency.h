@@ -0,0 +1,36 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+#define LATENCY_TOP_N 8
+
+typedef enum {
+    LATENCY_IRQSOFF,
+    LATENCY_PREEMPTOFF,
+    LATENCY_KINDS
+} latency_kind_t;
+
+typedef struct {
+    uint64_t cycles;
+    uint64_t start_rip;   // where the window was opened
+    uint64_t end_rip;     // where it was closed
+    uint32_t tick;        // timer_ticks when it closed
+    uint64_t tid;
+} latency_entry_t;
+
+// Window boundaries. irqs_off/irqs_on must be called with IF already clear.
+void latency_irqs_off(uint64_t rip);
+void latency_irqs_on(uint64_t rip);
+void latency_preempt_off(uint64_t rip);
+void latency_preempt_on(uint64_t rip);
+
+// A context switch closes the outgoing thread's windows and reopens them
+// for the incoming one if it resumes with irqs or preemption still off.
+void latency_switch_out(uint64_t rip);
+void latency_switch_in(uint64_t rip, int irqs_off, int preempt_off);
+
+void latency_reset(void);
+void latency_print(void);
+
+#endif // LATENCY_H
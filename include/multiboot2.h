@@ -0,0 +1,31 @@
+#ifndef MULTIBOOT2_H
+#define MULTIBOOT2_H
+
+#include <stdint.h>
+
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36D76289
+
+#define MULTIBOOT_TAG_TYPE_END      0
+#define MULTIBOOT_TAG_TYPE_CMDLINE  1
+#define MULTIBOOT_TAG_TYPE_MMAP     6
+#define MULTIBOOT_TAG_TYPE_ACPI_OLD 14
+#define MULTIBOOT_TAG_TYPE_ACPI_NEW 15
+
+typedef struct __attribute__((packed)) {
+    uint32_t total_size;
+    uint32_t reserved;
+} multiboot_info_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t type;
+    uint32_t size;
+} multiboot_tag_t;
+
+// tags 14/15 carry a verbatim copy of the RSDP
+typedef struct __attribute__((packed)) {
+    uint32_t type;
+    uint32_t size;
+    uint8_t  rsdp[];
+} multiboot_tag_acpi_t;
+
+#endif // MULTIBOOT2_H
@@ -0,0 +1,19 @@
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include <waitqueue.h>
+
+// Sleeping lock for code that may block while holding it (e.g. a disk command).
+// Before threads run it degrades to a plain flag. Contending for it where the
+// caller cannot sleep (interrupts off, preemption disabled) halts the kernel.
+typedef struct {
+    volatile int available;
+    thread_t*    owner;
+    waitqueue_t  waiters;
+} mutex_t;
+
+void mutex_init(mutex_t* m);
+void mutex_lock(mutex_t* m);
+void mutex_unlock(mutex_t* m);
+
+#endif // MUTEX_H
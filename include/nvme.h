@@ -0,0 +1,77 @@
+#ifndef NVME_H
+#define NVME_H
+
+#include <stdint.h>
+
+// controller registers (BAR0)
+#define NVME_REG_CAP    0x00
+#define NVME_REG_VS     0x08
+#define NVME_REG_INTMS  0x0C
+#define NVME_REG_CC     0x14
+#define NVME_REG_CSTS   0x1C
+#define NVME_REG_AQA    0x24
+#define NVME_REG_ASQ    0x28
+#define NVME_REG_ACQ    0x30
+#define NVME_REG_DBS    0x1000
+
+#define NVME_CAP_MQES(c)   ((uint32_t)((c) & 0xFFFF) + 1)
+#define NVME_CAP_TO(c)     ((uint32_t)(((c) >> 24) & 0xFF))    // 500ms units
+#define NVME_CAP_DSTRD(c)  ((uint32_t)(((c) >> 32) & 0xF))
+
+#define NVME_CC_EN         (1u << 0)
+#define NVME_CC_IOSQES     (6u << 16)   // 64-byte submission entries
+#define NVME_CC_IOCQES     (4u << 20)   // 16-byte completion entries
+#define NVME_CSTS_RDY      (1u << 0)
+#define NVME_CSTS_CFS      (1u << 1)
+
+// admin opcodes
+#define NVME_ADMIN_CREATE_SQ  0x01
+#define NVME_ADMIN_DELETE_CQ  0x04
+#define NVME_ADMIN_CREATE_CQ  0x05
+#define NVME_ADMIN_IDENTIFY   0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+#define NVME_FEAT_NUM_QUEUES  0x07
+#define NVME_FEAT_IRQ_COALESCE 0x08
+
+#define NVME_IDENTIFY_NS      0
+#define NVME_IDENTIFY_CTRL    1
+
+// NVM opcodes
+#define NVME_CMD_FLUSH  0x00
+#define NVME_CMD_WRITE  0x01
+#define NVME_CMD_READ   0x02
+
+#define NVME_PAGE_SIZE  4096
+#define NVME_PRP_PER_PAGE (NVME_PAGE_SIZE / 8)
+
+typedef struct {
+    uint32_t cdw0;      // opcode bits 0-7, command id bits 16-31
+    uint32_t nsid;
+    uint64_t reserved;
+    uint64_t mptr;
+    uint64_t prp1;
+    uint64_t prp2;
+    uint32_t cdw10;
+    uint32_t cdw11;
+    uint32_t cdw12;
+    uint32_t cdw13;
+    uint32_t cdw14;
+    uint32_t cdw15;
+} __attribute__((packed)) nvme_sqe_t;
+
+typedef struct {
+    uint32_t result;
+    uint32_t reserved;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t cid;
+    uint16_t status;    // phase tag in bit 0, status field above it
+} __attribute__((packed)) nvme_cqe_t;
+
+_Static_assert(sizeof(nvme_sqe_t) == 64, "nvme_sqe_t must be 64 bytes");
+_Static_assert(sizeof(nvme_cqe_t) == 16, "nvme_cqe_t must be 16 bytes");
+
+void nvme_init(void);
+
+#endif // NVME_H
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
+#define PCI_MAX_DEVICES 64
+#define PCI_MSI_MAX_VECTORS 32
+
 struct pci_device {
     uint8_t bus;
     uint8_t device;
@@ -13,14 +16,80 @@ struct pci_device {
     uint8_t subclass;
     uint8_t prog_if;
     uint8_t revision_id;
+    uint8_t irq_line;
+
+    // MSI / MSI-X state, filled by pci_enable_msi/pci_enable_msix
+    uint8_t msi_cap;             // config offset of the capability, 0 if none
+    uint8_t msix_cap;
+    uint8_t msi_enabled;
+    uint8_t msix_enabled;
+    uint8_t msi_nvec;
+    uint8_t msi_vector;          // first vector of the MSI block
+    uint16_t msix_nvec;
+    volatile uint32_t* msix_table;
+    uint8_t msix_vectors[PCI_MSI_MAX_VECTORS];
 };
 
 #define PCI_CONFIG_ADDRESS 0xCF8
 #define PCI_CONFIG_DATA    0xCFC
 
+// config space offsets
+#define PCI_COMMAND        0x04
+#define PCI_STATUS         0x06
+#define PCI_BAR0           0x10
+#define PCI_CAP_PTR        0x34
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO           0x0001
+#define PCI_COMMAND_MEMORY       0x0002
+#define PCI_COMMAND_MASTER       0x0004
+#define PCI_COMMAND_INTX_DISABLE 0x0400
+#define PCI_STATUS_CAP_LIST      0x0010
+
+#define PCI_CAP_ID_MSI     0x05
+#define PCI_CAP_ID_VENDOR  0x09
+#define PCI_CAP_ID_MSIX    0x11
+
 void pci_init();
 uint32_t pci_config_read32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
 uint16_t pci_config_read16(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
 uint8_t pci_config_read8(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
+void pci_config_write32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value);
+void pci_config_write16(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint16_t value);
+void pci_config_write8(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint8_t value);
+
+// devices found by pci_init()
+int pci_device_count(void);
+struct pci_device* pci_get_device(int index);
+struct pci_device* pci_find_device(uint16_t vendor_id, uint16_t device_id, int nth);
+struct pci_device* pci_find_class(uint8_t class_code, uint8_t subclass, int nth);
+
+uint32_t pci_dev_read32(struct pci_device* dev, uint8_t offset);
+uint16_t pci_dev_read16(struct pci_device* dev, uint8_t offset);
+uint8_t pci_dev_read8(struct pci_device* dev, uint8_t offset);
+void pci_dev_write32(struct pci_device* dev, uint8_t offset, uint32_t value);
+void pci_dev_write16(struct pci_device* dev, uint8_t offset, uint16_t value);
+
+// decoded BAR address (memory or I/O), 64-bit BARs combined; 0 if unused
+uint64_t pci_bar_address(struct pci_device* dev, int bar);
+int pci_bar_is_io(struct pci_device* dev, int bar);
+void pci_enable_bus_master(struct pci_device* dev);
+
+// walk the capability list; returns the config offset, 0 if absent.
+// start = 0 begins at the head, otherwise continues after that capability
+uint8_t pci_find_capability(struct pci_device* dev, uint8_t cap_id, uint8_t start);
+
+// MSI: nvec is rounded up to a power of two; returns the first vector or < 0
+int pci_enable_msi(struct pci_device* dev, int nvec);
+void pci_disable_msi(struct pci_device* dev);
+void pci_msi_mask(struct pci_device* dev, int index, int masked);
+
+// MSI-X: allocates nvec vectors into dev->msix_vectors; returns nvec or < 0
+int pci_enable_msix(struct pci_device* dev, int nvec);
+void pci_disable_msix(struct pci_device* dev);
+void pci_msix_mask(struct pci_device* dev, int entry, int masked);
+
+// vector for MSI/MSI-X message index, -1 if none
+int pci_irq_vector(struct pci_device* dev, int index);
 
-#endif // PCI_H 
\ No newline at end of file
+#endif // PCI_H
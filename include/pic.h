@@ -16,5 +16,6 @@ void pic_remap(int offset1, int offset2);
 void pic_send_eoi(uint8_t irq);
 void pic_set_mask(uint8_t irq_line);
 void pic_clear_mask(uint8_t irq_line);
+uint16_t pic_get_isr(void);
 
 #endif
\ No newline at end of file
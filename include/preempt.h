@@ -0,0 +1,22 @@
+#ifndef PREEMPT_H
+#define PREEMPT_H
+
+#include <stdint.h>
+#include <cpu.h>
+#include <latency.h>
+
+// Non-zero while the running thread must not be preempted by the timer.
+// Saved per thread across context switches by thread_schedule().
+extern volatile uint32_t preempt_count;
+
+static inline __attribute__((always_inline)) void preempt_disable() {
+    if (preempt_count++ == 0) latency_preempt_off(current_rip());
+    __asm__ volatile("" ::: "memory");
+}
+
+static inline __attribute__((always_inline)) void preempt_enable() {
+    __asm__ volatile("" ::: "memory");
+    if (--preempt_count == 0) latency_preempt_on(current_rip());
+}
+
+#endif // PREEMPT_H
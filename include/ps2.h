@@ -10,8 +10,6 @@ void keyboard_buffer_push(char c);
 //pop a char from keyboard buffer; returns 1 if char available, 0 otherw
 int keyboard_buffer_pop(char *c);
 
-static void keyboard_handler(cpu_registers_t* regs);
-
 void ps2_init(void);
 char kgetch(void);
 char *kgets();
@@ -22,6 +22,10 @@ typedef struct thread {
     uint64_t tid;
     char name[32];
     uint32_t sleep_until;  // Время пробуждения (в тиках таймера)
+    uint64_t offcpu_cycles; // TSC cycles spent switched out, see isr_dispatch
+    uint32_t preempt_count; // saved preempt_count while switched out
+    int priority;          // higher runs first, 0 for ordinary threads
+    void* arg;             // free for the thread's entry function
 } thread_t;
 
 void thread_init();
@@ -37,5 +41,6 @@ void thread_unblock(int pid);
 int thread_get_state(int pid);
 int thread_get_count();
 void thread_sleep(uint32_t ms);
+void thread_set_priority(thread_t* t, int priority);
 
 #endif // THREAD_H 
\ No newline at end of file
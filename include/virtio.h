@@ -0,0 +1,138 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+#include <pci.h>
+#include <iovec.h>
+
+#define VIRTIO_PCI_VENDOR 0x1AF4
+
+// vendor capability types (virtio 1.0 PCI transport)
+#define VIRTIO_PCI_CAP_COMMON  1
+#define VIRTIO_PCI_CAP_NOTIFY  2
+#define VIRTIO_PCI_CAP_ISR     3
+#define VIRTIO_PCI_CAP_DEVICE  4
+
+#define VIRTIO_STATUS_ACK         0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+#define VIRTIO_STATUS_FAILED      0x80
+
+#define VIRTIO_F_INDIRECT_DESC 28
+#define VIRTIO_F_EVENT_IDX     29
+#define VIRTIO_F_VERSION_1     32
+
+#define VIRTIO_MSI_NO_VECTOR 0xFFFF
+
+typedef struct {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t msix_config;
+    uint16_t num_queues;
+    uint8_t device_status;
+    uint8_t config_generation;
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint32_t queue_desc_lo;
+    uint32_t queue_desc_hi;
+    uint32_t queue_driver_lo;
+    uint32_t queue_driver_hi;
+    uint32_t queue_device_lo;
+    uint32_t queue_device_hi;
+} __attribute__((packed)) virtio_pci_common_t;
+
+// split virtqueue layout
+#define VIRTQ_DESC_F_NEXT     1
+#define VIRTQ_DESC_F_WRITE    2
+#define VIRTQ_DESC_F_INDIRECT 4
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+#define VIRTQ_USED_F_NO_NOTIFY     1
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];    // followed by used_event when EVENT_IDX is on
+} virtq_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} virtq_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    virtq_used_elem_t ring[];   // followed by avail_event
+} virtq_used_t;
+
+_Static_assert(sizeof(virtq_desc_t) == 16, "virtq_desc_t must be 16 bytes");
+
+#define VIRTQ_MAX_SIZE     128
+#define VIRTQ_MAX_INDIRECT 64   // descriptors per indirect table
+
+struct virtio_device;
+
+typedef struct virtqueue {
+    struct virtio_device* vdev;
+    uint16_t index;
+    uint16_t size;
+    virtq_desc_t* desc;
+    volatile virtq_avail_t* avail;
+    volatile virtq_used_t* used;
+    volatile uint16_t* notify;
+    uint16_t free_head;
+    uint16_t num_free;
+    uint16_t last_used;
+    uint16_t kicked;            // avail idx at the last notification check
+    void** cookies;             // per head descriptor
+    virtq_desc_t* indirect;     // VIRTQ_MAX_INDIRECT entries per head, NULL if unsupported
+} virtqueue_t;
+
+typedef struct virtio_device {
+    struct pci_device* pci;
+    volatile virtio_pci_common_t* common;
+    volatile uint8_t* notify_base;
+    uint32_t notify_mult;
+    volatile uint8_t* isr;
+    volatile uint8_t* config;   // device specific configuration
+    uint64_t features;          // negotiated
+} virtio_device_t;
+
+// find the modern capabilities, reset and acknowledge; 0 on success
+int virtio_pci_init(virtio_device_t* vdev, struct pci_device* pci);
+// accept wanted & offered (VERSION_1 is required); returns 0 once FEATURES_OK sticks
+int virtio_negotiate(virtio_device_t* vdev, uint64_t wanted);
+int virtio_has_feature(virtio_device_t* vdev, int bit);
+// msix_entry may be VIRTIO_MSI_NO_VECTOR; NULL if the queue is absent
+virtqueue_t* virtio_setup_queue(virtio_device_t* vdev, uint16_t index, uint16_t msix_entry);
+void virtio_driver_ok(virtio_device_t* vdev);
+void virtio_fail(virtio_device_t* vdev);
+// reading the ISR acknowledges a legacy interrupt; returns its bits
+uint8_t virtio_isr(virtio_device_t* vdev);
+
+// Queue a buffer of out device-readable segments followed by in
+// device-writable ones. Returns 0, or -1 if the ring is full.
+// The caller serialises access to the queue (interrupts off).
+int virtqueue_add(virtqueue_t* vq, const iovec_t* sg, int out, int in, void* cookie);
+// publish added buffers and notify the device unless it suppressed that
+void virtqueue_kick(virtqueue_t* vq);
+// next finished buffer's cookie, NULL if none
+void* virtqueue_get_buf(virtqueue_t* vq, uint32_t* len);
+// re-arm the completion interrupt; returns 1 if buffers arrived meanwhile
+int virtqueue_enable_cb(virtqueue_t* vq);
+
+#endif // VIRTIO_H
@@ -0,0 +1,63 @@
+#ifndef VIRTIO_SCSI_H
+#define VIRTIO_SCSI_H
+
+#include <stdint.h>
+
+#define VIRTIO_SCSI_DEVICE_LEGACY 0x1004   // transitional
+#define VIRTIO_SCSI_DEVICE_MODERN 0x1048
+
+#define VIRTIO_SCSI_CDB_SIZE   32
+#define VIRTIO_SCSI_SENSE_SIZE 96
+
+// queue 0 is control, 1 events, request queues follow
+#define VIRTIO_SCSI_REQUEST_QUEUE 2
+
+typedef struct {
+    uint32_t num_queues;
+    uint32_t seg_max;
+    uint32_t max_sectors;
+    uint32_t cmd_per_lun;
+    uint32_t event_info_size;
+    uint32_t sense_size;
+    uint32_t cdb_size;
+    uint16_t max_channel;
+    uint16_t max_target;
+    uint32_t max_lun;
+} __attribute__((packed)) virtio_scsi_config_t;
+
+typedef struct {
+    uint8_t lun[8];
+    uint64_t tag;
+    uint8_t task_attr;
+    uint8_t prio;
+    uint8_t crn;
+    uint8_t cdb[VIRTIO_SCSI_CDB_SIZE];
+} __attribute__((packed)) virtio_scsi_req_t;
+
+typedef struct {
+    uint32_t sense_len;
+    uint32_t resid;
+    uint16_t status_qualifier;
+    uint8_t status;
+    uint8_t response;
+    uint8_t sense[VIRTIO_SCSI_SENSE_SIZE];
+} __attribute__((packed)) virtio_scsi_resp_t;
+
+#define VIRTIO_SCSI_S_OK 0
+
+// SCSI commands and status
+#define SCSI_TEST_UNIT_READY  0x00
+#define SCSI_INQUIRY          0x12
+#define SCSI_READ_16          0x88
+#define SCSI_WRITE_16         0x8A
+#define SCSI_SYNCHRONIZE_CACHE_10 0x35
+#define SCSI_SERVICE_ACTION_IN 0x9E
+#define SCSI_SAI_READ_CAPACITY_16 0x10
+
+#define SCSI_STATUS_GOOD            0x00
+#define SCSI_STATUS_CHECK_CONDITION 0x02
+#define SCSI_SENSE_UNIT_ATTENTION   0x06
+
+void virtio_scsi_init(void);
+
+#endif // VIRTIO_SCSI_H
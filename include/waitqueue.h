@@ -0,0 +1,28 @@
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <thread.h>
+
+// Threads sleeping until an event (usually an interrupt) fires.
+// Entries live on the waiter's stack for the duration of the wait.
+typedef struct wait_entry {
+    thread_t*          thread;
+    struct wait_entry* next;
+} wait_entry_t;
+
+typedef struct {
+    wait_entry_t* head;
+} waitqueue_t;
+
+void waitqueue_init(waitqueue_t* wq);
+// sleep until *cond is non-zero; timeout_ms = 0 waits forever.
+// returns 0 once the condition holds, -1 on timeout.
+int waitqueue_wait(waitqueue_t* wq, volatile int* cond, uint32_t timeout_ms);
+// make every waiter runnable; safe to call from interrupt handlers
+void waitqueue_wake_all(waitqueue_t* wq);
+// 1 if the caller may sleep (threads running, interrupts and preemption on)
+int waitqueue_can_sleep(void);
+
+#endif // WAITQUEUE_H
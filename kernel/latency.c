@@ -0,0 +1,125 @@
+#include <latency.h>
+#include <preempt.h>
+#include <thread.h>
+#include <cpu.h>
+#include <string.h>
+#include <vga.h>
+
+extern volatile uint32_t timer_ticks;
+
+volatile uint32_t preempt_count = 0;
+
+typedef struct {
+    int      active;
+    uint64_t start_tsc;
+    uint64_t start_rip;
+} latency_window_t;
+
+static latency_window_t open_window[LATENCY_KINDS];
+static latency_entry_t  top[LATENCY_KINDS][LATENCY_TOP_N];
+
+static const char* kind_names[LATENCY_KINDS] = { "irqsoff", "preemptoff" };
+
+// the tracer itself must not go through local_irq_* or it would recurse
+static inline uint64_t raw_irq_save() {
+    uint64_t flags = read_rflags();
+    __asm__ volatile("cli" ::: "memory");
+    return flags;
+}
+
+static inline void raw_irq_restore(uint64_t flags) {
+    if (flags & RFLAGS_IF) __asm__ volatile("sti" ::: "memory");
+}
+
+static void latency_open(latency_kind_t kind, uint64_t rip)
+{
+    latency_window_t* w = &open_window[kind];
+    w->start_rip = rip;
+    w->start_tsc = rdtsc();
+    w->active    = 1;
+}
+
+static void latency_close(latency_kind_t kind, uint64_t rip)
+{
+    latency_window_t* w = &open_window[kind];
+    if (!w->active) return;
+    w->active = 0;
+
+    uint64_t cycles = rdtsc() - w->start_tsc;
+    latency_entry_t* tbl = top[kind];
+    if (cycles <= tbl[LATENCY_TOP_N - 1].cycles) return; // common case: not a new record
+
+    int pos = LATENCY_TOP_N - 1;
+    while (pos > 0 && tbl[pos - 1].cycles < cycles) {
+        tbl[pos] = tbl[pos - 1];
+        pos--;
+    }
+    thread_t* t = thread_current();
+    tbl[pos].cycles    = cycles;
+    tbl[pos].start_rip = w->start_rip;
+    tbl[pos].end_rip   = rip;
+    tbl[pos].tick      = timer_ticks;
+    tbl[pos].tid       = t ? t->tid : 0;
+}
+
+void latency_irqs_off(uint64_t rip)
+{
+    latency_open(LATENCY_IRQSOFF, rip);
+}
+
+void latency_irqs_on(uint64_t rip)
+{
+    latency_close(LATENCY_IRQSOFF, rip);
+}
+
+void latency_preempt_off(uint64_t rip)
+{
+    uint64_t flags = raw_irq_save();
+    latency_open(LATENCY_PREEMPTOFF, rip);
+    raw_irq_restore(flags);
+}
+
+void latency_preempt_on(uint64_t rip)
+{
+    uint64_t flags = raw_irq_save();
+    latency_close(LATENCY_PREEMPTOFF, rip);
+    raw_irq_restore(flags);
+}
+
+void latency_switch_out(uint64_t rip)
+{
+    latency_close(LATENCY_IRQSOFF, rip);
+    latency_close(LATENCY_PREEMPTOFF, rip);
+}
+
+void latency_switch_in(uint64_t rip, int irqs_off, int preempt_off)
+{
+    if (irqs_off) latency_open(LATENCY_IRQSOFF, rip);
+    if (preempt_off) latency_open(LATENCY_PREEMPTOFF, rip);
+}
+
+void latency_reset(void)
+{
+    uint64_t flags = raw_irq_save();
+    memset(top, 0, sizeof(top));
+    raw_irq_restore(flags);
+}
+
+void latency_print(void)
+{
+    latency_entry_t snap[LATENCY_KINDS][LATENCY_TOP_N];
+    uint64_t flags = raw_irq_save();
+    memcpy(snap, top, sizeof(snap));
+    raw_irq_restore(flags);
+
+    for (int k = 0; k < LATENCY_KINDS; k++) {
+        kprintf("%s (top %d):\n", kind_names[k], LATENCY_TOP_N);
+        kprintf("  #          cycles  start             end               pid   tick\n");
+        for (int i = 0; i < LATENCY_TOP_N; i++) {
+            latency_entry_t* e = &snap[k][i];
+            if (!e->cycles) break;
+            kprintf("  %d %15llu  %016llx  %016llx  %3u %6u\n", i, e->cycles,
+                    e->start_rip, e->end_rip, (uint32_t)e->tid, e->tick);
+        }
+    }
+}
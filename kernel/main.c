@@ -17,11 +17,20 @@
 #include <gpu.h>
 #include <fat32.h>
 #include <ata.h>
+#include <ahci.h>
+#include <nvme.h>
+#include <virtio_scsi.h>
+#include <block.h>
+#include <bcache.h>
+#include <dcache.h>
 #include <usb.h>
 #include <thread.h>
 #include <spinlock.h>
 #include <kernutils.h>
 #include <sys.h>
+#include <acpi.h>
+#include <lapic.h>
+#include <irqflags.h>
 
 extern uint32_t timer_ticks;
 
@@ -31,12 +40,10 @@ int drive_num = 0;
 //dec: 0123456789
 //hex: 0123456789ABCDEF
 
-void idle_irq1(cpu_registers_t* regs) {
-    (void)inb(0x60);
-}
-
 void kernel_main(uint32_t magic, uint32_t addr)
 {
+    // boot.asm entered with interrupts masked: trace the whole init window
+    latency_irqs_off(current_rip());
     gdt_init();
     kprintf("\n<(0F)>%s %s Operating System\n\n", KERNEL_FNAME, KERNEL_VERSION);
     gdt_print_gdt();
@@ -45,6 +52,8 @@ void kernel_main(uint32_t magic, uint32_t addr)
     kdbg(KINFO, "pic_remap: remapping 0x20, 0x28\n");
     pic_remap(0x20, 0x28);
     paging_init();
+    acpi_init(magic, addr);
+    lapic_init();
 
     pci_init();
 
@@ -57,15 +66,27 @@ void kernel_main(uint32_t magic, uint32_t addr)
     pic_clear_mask(1); 
     
     init_timer(); 
-    idt_register_handler(0x21, idle_irq1);
     idt_register_handler(0x20, timer_isr_wrapper); 
-    ata_init();
 
     heap_init(0x200000, 0x1000000); // start at 2MB, size 16MB
     kdbg(KINFO, "heap_init: initialized at 0x200000, size 16MB\n");
-
-    fat32_mount(0);
-    fat32_mount(1);
+    bcache_init();
+    dcache_init();
+    ps2_init();
+    ata_init(); // needs the heap for PRD tables and irq actions
+    ahci_init();
+    nvme_init();
+    virtio_scsi_init();
+    block_scan_partitions(); // partitions numbered after all disks
+
+    // fat32 keeps one volume: mount the first that works, don't let a later
+    // device (e.g. the partition of the disk just mounted) replace it
+    for (int d = 0; d < block_count(); d++) {
+        if (fat32_mount(d) == 0) {
+            drive_num = d;
+            break;
+        }
+    }
 
     gpu_info_t gpu;
     if (gpu_init(&gpu) == 0) {
@@ -82,8 +103,9 @@ void kernel_main(uint32_t magic, uint32_t addr)
     thread_create(calc_time, "calctime");
     thread_create(sys_time, "systime");
     thread_create(shell, "shell");
+    thread_create(bcache_flusher, "bflush");
     
-    __asm__("sti");
+    local_irq_enable();
 
 
     pc_speaker_beep(400, 100);
@@ -100,6 +122,6 @@ void kernel_main(uint32_t magic, uint32_t addr)
     pc_speaker_beep(700, 100);
     pc_speaker_beep(500, 100);
     pc_speaker_beep(400, 300);
-    __asm__("cli");
+    local_irq_disable();
     for (;;) __asm__("hlt");
 }
@@ -0,0 +1,43 @@
+#include <mutex.h>
+#include <irqflags.h>
+#include <debug.h>
+
+void mutex_init(mutex_t* m)
+{
+    m->available = 1;
+    m->owner = NULL;
+    waitqueue_init(&m->waiters);
+}
+
+void mutex_lock(mutex_t* m)
+{
+    for (;;) {
+        uint64_t irqf = local_irq_save();
+        if (m->available) {
+            m->available = 0;
+            m->owner = thread_current();
+            local_irq_restore(irqf);
+            return;
+        }
+        local_irq_restore(irqf);
+
+        // the holder cannot run while this caller spins: a certain deadlock
+        if (!waitqueue_can_sleep()) {
+            kdbg(KPANIC, "mutex_lock: held by %s, caller cannot sleep\n",
+                 m->owner ? m->owner->name : "?");
+            local_irq_save();
+            for (;;) __asm__ volatile("hlt");
+        }
+        // several waiters may wake on one unlock; the loser goes back to sleep
+        waitqueue_wait(&m->waiters, &m->available, 0);
+    }
+}
+
+void mutex_unlock(mutex_t* m)
+{
+    uint64_t irqf = local_irq_save();
+    m->owner = NULL;
+    m->available = 1;
+    waitqueue_wake_all(&m->waiters);
+    local_irq_restore(irqf);
+}
@@ -5,6 +5,8 @@
 #include <cpu.h>
 #include <debug.h>
 #include <vga.h>
+#include <preempt.h>
+#include <latency.h>
 
 #define MAX_THREADS 32
 static thread_t* threads[MAX_THREADS];
@@ -104,25 +106,44 @@ void thread_schedule() {
         }
     }
     
+    // highest priority READY thread wins, round robin among equals
+    thread_t* best = NULL;
     int next = (current->tid + 1) % thread_count;
     for (int i = 0; i < thread_count; ++i) {
         int idx = (next + i) % thread_count;
-        if (threads[idx]->state == THREAD_READY) {
-            thread_t* prev = current;
-            current = threads[idx];
-            current->state = THREAD_RUNNING;
-            
-            // Не меняем состояние предыдущего потока, если он спит
-            if (prev->state != THREAD_SLEEPING) {
-                prev->state = THREAD_READY;
-            }
-            
-            context_switch(&prev->context, &current->context);
-            // После возврата из context_switch поток снова активен
-            current->state = THREAD_RUNNING;
-            return;
+        if (threads[idx]->state == THREAD_READY &&
+            (!best || threads[idx]->priority > best->priority)) {
+            best = threads[idx];
         }
     }
+    if (!best) return;
+    if (current->state == THREAD_RUNNING && current->priority > best->priority) return;
+    if (best == current) { // woken again before it got switched out
+        current->state = THREAD_RUNNING;
+        return;
+    }
+
+    thread_t* prev = current;
+    current = best;
+    current->state = THREAD_RUNNING;
+
+    // only a running thread goes back to READY; sleeping, blocked and
+    // terminated ones stay put until something wakes them
+    if (prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_READY;
+    }
+
+    prev->preempt_count = preempt_count;
+    preempt_count = current->preempt_count;
+    latency_switch_out(current_rip());
+
+    uint64_t switched_out = rdtsc();
+    context_switch(&prev->context, &current->context);
+    // prev == current again here: we are back on our own stack
+    prev->offcpu_cycles += rdtsc() - switched_out;
+    latency_switch_in(current_rip(), !(read_rflags() & RFLAGS_IF), preempt_count != 0);
+    // После возврата из context_switch поток снова активен
+    current->state = THREAD_RUNNING;
 }
 
 void thread_unblock(int pid) {
@@ -164,4 +185,8 @@ int thread_get_state(int pid) {
 
 int thread_get_count() {
     return thread_count;
-}
\ No newline at end of file
+}
+
+void thread_set_priority(thread_t* t, int priority) {
+    if (t) t->priority = priority;
+}
@@ -24,52 +24,16 @@ void hexstr_to_bytes(const char* hex_str, uint8_t* byte_array, size_t max_bytes)
     }
 }
 
-int build_path(uint32_t cluster, char path[][9], int max_depth) {
+int build_path(uint32_t cluster, char path[][PATH_NAME_MAX + 1], int max_depth) {
     extern uint32_t root_dir_first_cluster;
     int depth = 0;
     uint32_t cur = cluster;
 
+    /* имя и родитель каждого уровня берутся из кеша dentry */
     while (cur != root_dir_first_cluster && depth < max_depth) {
-        /* 1. Прочитаем текущий каталог, чтобы узнать кластер родителя (запись "..") */
-        fat32_dir_entry_t *entries = kmalloc(sizeof(fat32_dir_entry_t) * 32);
-        if (!entries) break;
-        int n = fat32_read_dir(0, cur, entries, 32);
-        uint32_t parent_cluster = root_dir_first_cluster;
-        for (int i = 0; i < n; i++) {
-            if (entries[i].name[0] == '.' && entries[i].name[1] == '.') {
-                parent_cluster = ((uint32_t)entries[i].first_cluster_high << 16) | entries[i].first_cluster_low;
-                if (parent_cluster == 0) parent_cluster = root_dir_first_cluster;
-                break;
-            }
-        }
-
-        /* 2. Прочитаем родительский каталог, чтобы найти имя текущего каталога */
-        fat32_dir_entry_t *pentries = kmalloc(sizeof(fat32_dir_entry_t) * 32);
-        if (!pentries) { kfree(entries); break; }
-        int pn = fat32_read_dir(0, parent_cluster, pentries, 32);
-        char name[9] = {0};
-        for (int i = 0; i < pn; i++) {
-            if ((pentries[i].attr & 0x10) != 0x10) continue; /* только каталоги */
-            uint32_t cl = ((uint32_t)pentries[i].first_cluster_high << 16) | pentries[i].first_cluster_low;
-            if (cl == cur) {
-                int pos = 0;
-                for (int j = 0; j < 8; j++) {
-                    if (pentries[i].name[j] != ' ' && pentries[i].name[j] != 0) {
-                        name[pos++] = pentries[i].name[j];
-                    }
-                }
-                name[pos] = 0;
-                break;
-            }
-        }
-
-        /* 3. Сохраняем имя в массиве path */
-        for (int i = 0; i < 9; i++) path[depth][i] = name[i];
-
-        /* 4. Освобождаем память и поднимаемся вверх */
-        kfree(entries);
-        kfree(pentries);
-        cur = parent_cluster;
+        uint32_t parent;
+        if (fat32_dir_name(drive_num, cur, &parent, path[depth], PATH_NAME_MAX + 1) != 0) break;
+        cur = parent;
         depth++;
     }
     return depth;
@@ -82,7 +46,7 @@ void print_prompt() {
     if (current_dir_cluster == root_dir_first_cluster) {
         kprintf("%d:\\>", drive_num);
     } else {
-        char path[32][9];
+        char path[32][PATH_NAME_MAX + 1];
         int depth = build_path(current_dir_cluster, path, 32);
         kprintf("%d:", drive_num);
         for (int i = depth - 1; i >= 0; i--) {
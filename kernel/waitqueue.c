@@ -0,0 +1,76 @@
+#include <waitqueue.h>
+#include <irqflags.h>
+#include <preempt.h>
+
+extern volatile uint32_t timer_ticks;
+
+void waitqueue_init(waitqueue_t* wq)
+{
+    wq->head = NULL;
+}
+
+static void waitqueue_add(waitqueue_t* wq, wait_entry_t* e)
+{
+    e->thread = thread_current();
+    e->next = wq->head;
+    wq->head = e;
+}
+
+static void waitqueue_remove(waitqueue_t* wq, wait_entry_t* e)
+{
+    wait_entry_t** pp = &wq->head;
+    while (*pp && *pp != e) pp = &(*pp)->next;
+    if (*pp) *pp = e->next;
+}
+
+int waitqueue_can_sleep(void)
+{
+    return thread_current() && (read_rflags() & RFLAGS_IF) && preempt_count == 0;
+}
+
+int waitqueue_wait(waitqueue_t* wq, volatile int* cond, uint32_t timeout_ms)
+{
+    wait_entry_t e;
+    uint32_t start = timer_ticks;
+    for (;;) {
+        // the condition is checked and the thread queued with interrupts off,
+        // so a wake-up cannot slip in between
+        uint64_t irqf = local_irq_save();
+        if (*cond) {
+            local_irq_restore(irqf);
+            return 0;
+        }
+        if (timeout_ms && timer_ticks - start >= timeout_ms) {
+            local_irq_restore(irqf);
+            return -1;
+        }
+        thread_t* self = thread_current();
+        waitqueue_add(wq, &e);
+        if (timeout_ms) {
+            self->sleep_until = start + timeout_ms;
+            self->state = THREAD_SLEEPING;
+        } else {
+            self->state = THREAD_BLOCKED;
+        }
+        local_irq_restore(irqf);
+
+        thread_yield();
+
+        irqf = local_irq_save();
+        waitqueue_remove(wq, &e);
+        if (self->state != THREAD_RUNNING)
+            self->state = THREAD_RUNNING; // nothing else was runnable, yield came straight back
+        local_irq_restore(irqf);
+    }
+}
+
+void waitqueue_wake_all(waitqueue_t* wq)
+{
+    uint64_t irqf = local_irq_save();
+    for (wait_entry_t* e = wq->head; e; e = e->next) {
+        thread_t* t = e->thread;
+        if (t->state == THREAD_BLOCKED || t->state == THREAD_SLEEPING)
+            t->state = THREAD_READY;
+    }
+    local_irq_restore(irqf);
+}
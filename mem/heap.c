@@ -64,6 +64,18 @@ void kfree(void *ptr) {
         return;
     }
 }
+void *kmalloc_aligned(size_t size, size_t align) {
+    if (align < 16) align = 16;
+    uint8_t *raw = kmalloc(size + align + sizeof(void*));
+    if (!raw) return NULL;
+    uintptr_t p = ((uintptr_t)raw + sizeof(void*) + align - 1) & ~(uintptr_t)(align - 1);
+    ((void**)p)[-1] = raw; // remember the real block just below the aligned pointer
+    return (void*)p;
+}
+void kfree_aligned(void *ptr) {
+    if (!ptr) return;
+    kfree(((void**)ptr)[-1]);
+}
 void *krealloc(void *ptr, size_t size) {
     if (!ptr) return kmalloc(size);
     heap_block_t *block = (heap_block_t*)((uint8_t*)ptr - BLOCK_SIZE);
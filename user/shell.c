@@ -16,9 +16,13 @@
 #include <gpu.h>
 #include <kernutils.h>
 #include <fat32.h>
-#include <ata.h>
+#include <block.h>
+#include <bcache.h>
+#include <dcache.h>
 #include <usb.h>
 #include <thread.h>
+#include <irqstat.h>
+#include <latency.h>
 
 extern int end;
 extern int drive_num;
@@ -29,6 +33,12 @@ int sh_execute_script(const char *filename);
 int exec_sh_script(const char *pathname);
 int sh_exec_single(const char *cmd);
 
+// найти обычный файл по пути (относительному, абсолютному, с префиксом диска)
+static int shell_find_file(const char *path, fat32_entry_t *ent) {
+    if (fat32_lookup(drive_num, path, ent, NULL) != 0) return -1;
+    return (ent->attr & 0x10) ? -1 : 0;
+}
+
 // Структура для переменных окружения
 typedef struct {
     char name[32];
@@ -131,117 +141,95 @@ void expand_variables(char *line, char *expanded, size_t max_len) {
 
 // Функция для выполнения shell-скрипта с расширенными возможностями
 int exec_sh_script(const char *pathname) {
-    fat32_dir_entry_t *entries = kmalloc(sizeof(fat32_dir_entry_t)*128);
-    if (!entries) { 
-        kprintf("exec_sh_script: OOM\n"); 
-        return 1;
-    }
-    
-    int n = fat32_read_dir(drive_num, current_dir_cluster, entries, 128);
-    if (n < 0) { 
-        kprintf("exec_sh_script: dir error\n"); 
-        kfree(entries); 
-        return 1;
-    }
-    
-    char fatname[12]; fat_name_from_string(pathname, fatname);
-    int file_found = 0;
+    fat32_entry_t ent;
+    int file_found = shell_find_file(pathname, &ent) == 0;
     int status = 1;
     
-    for (int i = 0; i < n; i++) {
-        if (!(entries[i].attr & 0x10)) { // файл
-            if (!memcmp(entries[i].name, fatname, 11)) {
-                uint32_t size = entries[i].file_size;
-                uint32_t first_cluster = (entries[i].first_cluster_high << 16) | entries[i].first_cluster_low;
-                uint8_t *buf = kmalloc(size + 1); // +1 для null-terminator
-                if (!buf) { 
-                    kprintf("exec_sh_script: OOM\n"); 
-                    kfree(entries); 
-                    return 1;
-                }
-                
-                int rd = fat32_read_file(drive_num, first_cluster, buf, size);
-                if (rd > 0) {
-                    buf[rd] = '\0'; // Добавляем null-terminator
-                    
-                    // Разбиваем файл на строки и выполняем каждую
-                    char *line = strtok((char*)buf, "\n\r");
-                    int line_num = 1;
+    if (file_found) {
+        uint32_t size = ent.size;
+        uint32_t first_cluster = ent.first_cluster;
+        uint8_t *buf = kmalloc(size + 1); // +1 для null-terminator
+        if (!buf) { 
+            kprintf("exec_sh_script: OOM\n"); 
+            return 1;
+        }
+        
+        int rd = fat32_read_file(drive_num, first_cluster, buf, size);
+        if (rd > 0) {
+            buf[rd] = '\0'; // Добавляем null-terminator
+            
+            // Разбиваем файл на строки и выполняем каждую
+            char *line = strtok((char*)buf, "\n\r");
+            int line_num = 1;
+            
+            while (line != NULL) {
+                // Пропускаем пустые строки и комментарии
+                if (strlen(line) > 0 && line[0] != '#') {
+                    // Убираем пробелы в начале и конце
+                    while (*line == ' ' || *line == '\t') line++;
+                    char *end = line + strlen(line) - 1;
+                    while (end > line && (*end == ' ' || *end == '\t' || *end == '\r')) end--;
+                    *(end + 1) = '\0';
                     
-                    while (line != NULL) {
-                        // Пропускаем пустые строки и комментарии
-                        if (strlen(line) > 0 && line[0] != '#') {
-                            // Убираем пробелы в начале и конце
-                            while (*line == ' ' || *line == '\t') line++;
-                            char *end = line + strlen(line) - 1;
-                            while (end > line && (*end == ' ' || *end == '\t' || *end == '\r')) end--;
-                            *(end + 1) = '\0';
+                    if (strlen(line) > 0) {
+                        // Проверяем, является ли это присваиванием переменной
+                        char *equals = strchr(line, '=');
+                        if (equals && equals != line) {
+                            // Это присваивание переменной
+                            char var_name[32] = {0};
+                            char var_value[128] = {0};
                             
-                            if (strlen(line) > 0) {
-                                // Проверяем, является ли это присваиванием переменной
-                                char *equals = strchr(line, '=');
-                                if (equals && equals != line) {
-                                    // Это присваивание переменной
-                                    char var_name[32] = {0};
-                                    char var_value[128] = {0};
-                                    
-                                    int name_len = equals - line;
-                                    if (name_len < 31) {
-                                        strncpy(var_name, line, name_len);
-                                        var_name[name_len] = '\0';
-                                        
-                                        // Убираем пробелы из имени переменной
-                                        char *name_end = var_name + strlen(var_name) - 1;
-                                        while (name_end > var_name && (*name_end == ' ' || *name_end == '\t')) {
-                                            *name_end = '\0';
-                                            name_end--;
-                                        }
-                                        
-                                        strcpy(var_value, equals + 1);
-                                        
-                                        // Убираем кавычки из значения
-                                        if (var_value[0] == '"' || var_value[0] == '\'') {
-                                            char quote = var_value[0];
-                                            memmove(var_value, var_value + 1, strlen(var_value));
-                                            char *quote_end = strchr(var_value, quote);
-                                            if (quote_end) *quote_end = '\0';
-                                        }
-                                        
-                                        set_env_var(var_name, var_value);
-                                        kprintf("Set %s=%s\n", var_name, var_value);
-                                    }
-                                } else {
-                                    // Это команда - подставляем переменные
-                                    char expanded_line[256];
-                                    expand_variables(line, expanded_line, sizeof(expanded_line));
-                                    
-                                    int cmd_status = sh_exec_single(expanded_line);
-                                    if (cmd_status != 0) {
-                                        kprintf("exec_sh_script: line %d failed: %s\n", line_num, line);
-                                        status = cmd_status;
-                                    }
+                            int name_len = equals - line;
+                            if (name_len < 31) {
+                                strncpy(var_name, line, name_len);
+                                var_name[name_len] = '\0';
+                                
+                                // Убираем пробелы из имени переменной
+                                char *name_end = var_name + strlen(var_name) - 1;
+                                while (name_end > var_name && (*name_end == ' ' || *name_end == '\t')) {
+                                    *name_end = '\0';
+                                    name_end--;
+                                }
+                                
+                                strcpy(var_value, equals + 1);
+                                
+                                // Убираем кавычки из значения
+                                if (var_value[0] == '"' || var_value[0] == '\'') {
+                                    char quote = var_value[0];
+                                    memmove(var_value, var_value + 1, strlen(var_value));
+                                    char *quote_end = strchr(var_value, quote);
+                                    if (quote_end) *quote_end = '\0';
                                 }
+                                
+                                set_env_var(var_name, var_value);
+                                kprintf("Set %s=%s\n", var_name, var_value);
+                            }
+                        } else {
+                            // Это команда - подставляем переменные
+                            char expanded_line[256];
+                            expand_variables(line, expanded_line, sizeof(expanded_line));
+                            
+                            int cmd_status = sh_exec_single(expanded_line);
+                            if (cmd_status != 0) {
+                                kprintf("exec_sh_script: line %d failed: %s\n", line_num, line);
+                                status = cmd_status;
                             }
                         }
-                        line = strtok(NULL, "\n\r");
-                        line_num++;
                     }
-                    status = 0;
                 }
-                kfree(buf);
-                file_found = 1;
-                break;
+                line = strtok(NULL, "\n\r");
+                line_num++;
             }
+            status = 0;
         }
+        kfree(buf);
     }
     
-    kfree(entries);
-    
     if (!file_found) {
         kprintf("<(0C)>exec_sh_script: %s: not found<(07)>\n", pathname);
         status = 1;
     }
-    
+
     return status;
 }
 
@@ -271,6 +259,73 @@ int sh_exec_single(const char *cmd) {
             status = 1;
         }
     }
+    else if (strcmp(args[0], "lsblk") == 0) {
+        for (int i = 0; i < block_count(); i++) {
+            block_device_t* b = block_get(i);
+            kprintf("%c%2d  %s  %llu MiB  %s\n", i == drive_num ? '*' : ' ', i, b->name,
+                    b->sectors * b->sector_size / (1024 * 1024), b->parent ? "" : b->model);
+        }
+        status = 0;
+    }
+    else if (strcmp(args[0], "bcache") == 0) {
+        bcache_stats_t st;
+        if (count == 2) bcache_set_budget(atoi(args[1]) * 1024);
+        bcache_get_stats(&st);
+        uint32_t lookups = st.hits + st.misses;
+        kprintf("buffers %u (%u KiB of %u KiB), dirty %u, pinned %u\n", st.buffers,
+                st.bytes / 1024, st.budget / 1024, st.dirty, st.pinned);
+        kprintf("hits %u, misses %u (%u%%), evictions %u, writebacks %u\n", st.hits, st.misses,
+                lookups ? st.hits * 100 / lookups : 0, st.evictions, st.writebacks);
+        status = 0;
+    }
+    else if (strcmp(args[0], "dcache") == 0) {
+        dcache_stats_t st;
+        dcache_get_stats(&st);
+        uint32_t lookups = st.hits + st.negative_hits + st.misses;
+        kprintf("entries %u of %u, evictions %u\n", st.entries, DCACHE_MAX_ENTRIES, st.evictions);
+        kprintf("hits %u, negative %u, misses %u (%u%% hit)\n", st.hits, st.negative_hits, st.misses,
+                lookups ? (st.hits + st.negative_hits) * 100 / lookups : 0);
+        status = 0;
+    }
+    else if (strcmp(args[0], "df") == 0) {
+        uint32_t total, free, csize;
+        if (fat32_statfs(&total, &free, &csize) != 0) {
+            kprint("<(0C)>df: no volume mounted<(07)>\n");
+            status = 1;
+        } else if (free == 0xFFFFFFFF) {
+            kprintf("%u clusters of %u bytes, free space unknown\n", total, csize);
+            status = 0;
+        } else {
+            kprintf("%u clusters of %u bytes, %u free (%llu KiB)\n", total, csize, free,
+                    (uint64_t)free * csize / 1024);
+            status = 0;
+        }
+    }
+    else if (strcmp(args[0], "sync") == 0) {
+        status = 0;
+        for (int i = 0; i < block_count(); i++) {
+            block_device_t* b = block_get(i);
+            if (!b->parent && block_flush(b) != 0) {
+                kprintf("<(0C)>sync: %s failed<(07)>\n", b->name);
+                status = 1;
+            }
+        }
+    }
+    else if (strcmp(args[0], "mount") == 0) {
+        if (count == 2) {
+            int d = atoi(args[1]);
+            if (fat32_mount(d) == 0) {
+                drive_num = d;
+                status = 0;
+            } else {
+                kprintf("<(0C)>mount: no fat32 volume on disk %d<(07)>\n", d);
+                status = 1;
+            }
+        } else {
+            kprintf("<(0C)>Usage: mount <drive_number><(07)>\n");
+            status = 1;
+        }
+    }
     else if (strcmp(args[0], "help") == 0) {
         kprint("help command\n");
         status = 0;
@@ -281,53 +336,25 @@ int sh_exec_single(const char *cmd) {
             status = 1;
         } else {
             const char* filename = args[1];
-            fat32_dir_entry_t *entries = kmalloc(sizeof(fat32_dir_entry_t)*128);
-            if (!entries) { 
+            int fd = fat32_open(drive_num, filename, FAT32_O_READ);
+            uint8_t *buf = fd >= 0 ? kmalloc(4096) : NULL;
+            if (fd < 0) {
+                kprintf("<(0C)>cat: %s: %s<(07)>\n", filename, fd == -2 ? "is a directory" : "not found");
+                status = 1;
+            } else if (!buf) { 
                 kprint("cat: OOM\n"); 
                 status = 1;
             } else {
-                int n = fat32_read_dir(drive_num, current_dir_cluster, entries, 128);
-                if (n<0) { 
-                    kprint("cat: dir error\n"); 
-                    kfree(entries); 
-                    status = 1;
-                } else {
-                    char fatname[12]; fat_name_from_string(filename, fatname);
-                    int file_found = 0;
-                    for (int i=0;i<n;i++) {
-                        if (!(entries[i].attr & 0x10)) { // файл
-                            if (!memcmp(entries[i].name, fatname, 11)) {
-                                uint32_t size = entries[i].file_size;
-                                uint32_t first_cluster = (entries[i].first_cluster_high << 16) | entries[i].first_cluster_low;
-                                uint8_t *buf = kmalloc(size);
-                                if (!buf) { 
-                                    kprint("cat: OOM\n"); 
-                                    kfree(entries); 
-                                    status = 1;
-                                    break;
-                                }
-                                int rd = fat32_read_file(drive_num, first_cluster, buf, size);
-                                if (rd > 0) {
-                                    for (int b=0; b<rd; b++) putchar(buf[b],0x07);
-                                    kprint("\n");
-                                    status = 0;
-                                } else {
-                                    status = 1;
-                                }
-                                kfree(buf);
-                                file_found = 1;
-                                break;
-                            }
-                        }
-                    }
-                    kfree(entries);
-                    
-                    if (!file_found) {
-                        kprintf("<(0C)>cat: %s: not found<(07)>\n", filename);
-                        status = 1;
-                    }
-                }
+                // stream the file; read-ahead keeps the next window in flight
+                status = 0;
+                int rd;
+                while ((rd = fat32_read(fd, buf, 4096)) > 0)
+                    for (int b=0; b<rd; b++) putchar(buf[b],0x07);
+                if (rd < 0) status = 1;
+                kprint("\n");
             }
+            kfree(buf);
+            if (fd >= 0) fat32_close(fd);
         }
     }
     else if (strcmp(args[0], "info") == 0) {
@@ -367,6 +394,33 @@ int sh_exec_single(const char *cmd) {
             status = 1;
         }
     }
+    else if (strcmp(args[0], "irqstat") == 0) {
+        if (count == 1) {
+            irqstat_print(-1);
+            status = 0;
+        } else if (count == 2 && strcmp(args[1], "reset") == 0) {
+            irqstat_reset();
+            status = 0;
+        } else if (count == 2) {
+            irqstat_print(atoi(args[1]));
+            status = 0;
+        } else {
+            kprintf("<(0C)>Usage: irqstat [vector|reset]<(07)>\n");
+            status = 1;
+        }
+    }
+    else if (strcmp(args[0], "latency") == 0) {
+        if (count == 1) {
+            latency_print();
+            status = 0;
+        } else if (count == 2 && strcmp(args[1], "reset") == 0) {
+            latency_reset();
+            status = 0;
+        } else {
+            kprintf("<(0C)>Usage: latency [reset]<(07)>\n");
+            status = 1;
+        }
+    }
     else if (strcmp(args[0], "mkfs.fat32") == 0) {
         fat32_create_fs(drive_num);
         status = 0;
@@ -396,66 +450,47 @@ int sh_exec_single(const char *cmd) {
             
             if (status == 0) {
                 const char *fname = args[fidx];
-                fat32_dir_entry_t *dir = kmalloc(sizeof(fat32_dir_entry_t)*32);
-                if (!dir) { 
+                int fd = fat32_open(drive_num, fname, FAT32_O_READ);
+                uint8_t *file_buf = fd >= 0 ? kmalloc(4096) : NULL;
+                if (fd < 0) {
+                    kprintf("xxd: %s not found\n", fname); 
+                    status = 1;
+                } else if (!file_buf) { 
                     kprint("xxd: OOM error\n"); 
                     status = 1;
                 } else {
-                    int n = fat32_read_dir(drive_num, current_dir_cluster, dir, 32);
-                    if (n < 0) { 
-                        kprint("xxd: dir error\n"); 
-                        kfree(dir);
-                        status = 1;
-                    } else {
-                        char fatname[12]; fat_name_from_string(fname, fatname);
-                        uint32_t clu = 0, fsize = 0;
-                        for (int i=0;i<n;i++)
-                            if (!memcmp(dir[i].name,fatname,11)) {
-                                clu = (dir[i].first_cluster_high<<16)|dir[i].first_cluster_low;
-                                fsize = dir[i].file_size; break;
+                    // 4 KiB at a time, a multiple of the 16-byte line
+                    uint32_t off = 0;
+                    int read_result = 0;
+                    while (!len_limit || off < len_limit) {
+                        uint32_t want = (len_limit && len_limit - off < 4096) ? len_limit - off : 4096;
+                        read_result = fat32_read(fd, file_buf, want);
+                        if (read_result <= 0) break;
+                        for (uint32_t p=0; p<(uint32_t)read_result; p+=16, off+=16){
+                            uint32_t chunk = (read_result-p>16)?16:read_result-p;
+                            
+                            kprintf("%08X: ", off);
+                            for(int i=0;i<16;i++){
+                                if(i<chunk) kprintf("%02X ", file_buf[p+i]);
+                                else kprint("   ");
                             }
-                        if (!clu){ 
-                            kprintf("xxd: %s not found\n", fname); 
-                            kfree(dir); 
-                            status = 1;
-                        } else {
-                            uint32_t max = (len_limit && len_limit < fsize) ? len_limit : fsize;
-                            uint8_t *file_buf = kmalloc(max);
-                            if (!file_buf) { 
-                                kprint("xxd: OOM error\n"); 
-                                kfree(dir); 
-                                status = 1;
-                            } else {
-                                int read_result = fat32_read_file(drive_num, clu, file_buf, max);
-                                if (read_result < 0) { 
-                                    kprintf("xxd: read error (result %d)\n", read_result); 
-                                    kfree(file_buf); 
-                                    kfree(dir); 
-                                    status = 1;
-                                } else {
-                                    for (uint32_t off=0; off<max; off+=16){
-                                        uint32_t chunk = (max-off>16)?16:max-off;
-                                        
-                                        kprintf("%08X: ", off);
-                                        for(int i=0;i<16;i++){
-                                            if(i<chunk) kprintf("%02X ", file_buf[off+i]);
-                                            else kprint("   ");
-                                        }
-                                        kprint(" ");
-                                        for(int i=0;i<chunk;i++){
-                                            char c=(file_buf[off+i]>=32&&file_buf[off+i]<=126)?file_buf[off+i]:'.';
-                                            putchar(c,0x07);
-                                        }
-                                        kprint("\n");
-                                    }
-                                    kfree(file_buf);
-                                    kfree(dir);
-                                    status = 0;
-                                }
+                            kprint(" ");
+                            for(int i=0;i<chunk;i++){
+                                char c=(file_buf[p+i]>=32&&file_buf[p+i]<=126)?file_buf[p+i]:'.';
+                                putchar(c,0x07);
                             }
+                            kprint("\n");
                         }
                     }
+                    if (read_result < 0) {
+                        kprintf("xxd: read error (result %d)\n", read_result); 
+                        status = 1;
+                    } else {
+                        status = 0;
+                    }
                 }
+                kfree(file_buf);
+                if (fd >= 0) fat32_close(fd);
             }
         }
     }
@@ -470,38 +505,33 @@ int sh_exec_single(const char *cmd) {
         }
     }
     else if (strcmp(args[0], "ls") == 0) {
-        fat32_entry_t *entries = kmalloc(sizeof(fat32_entry_t) * 128);
-        if (!entries) { 
-            kprintf("<(0c)>ls: OOM<(0f)>\n"); 
+        fat32_dir_t dir;
+        fat32_entry_t ent;
+        if (fat32_opendir(drive_num, current_dir_cluster, &dir) != 0) {
+            kprintf("ls: dir read error\n");
             status = 1;
         } else {
-            int n = fat32_list_dir(drive_num, current_dir_cluster, entries, 128);
-            if (n < 0) { 
-                kprintf("ls: dir read error\n"); 
-                kfree(entries); 
-                status = 1;
-            } else {
-                /* Сначала директории */
-                for (int i = 0; i < n; i++) {
-                    if (entries[i].attr & 0x10) {
-                        kprintf(" <DIR>  %s\n", entries[i].name);
-                    }
+            int r;
+            /* Сначала директории */
+            while ((r = fat32_readdir(&dir, &ent)) == 1)
+                if (ent.attr & 0x10) kprintf(" <DIR>  %s\n", ent.name);
+            /* Затем файлы — второй проход с начала */
+            if (r == 0) fat32_seekdir(&dir, 0);
+            while (r == 0 && (r = fat32_readdir(&dir, &ent)) == 1) {
+                if (!(ent.attr & 0x10)) {
+                    uint32_t size = ent.size;
+                    if (size < 1024)
+                        kprintf(" <FILE> %s (%u bytes)\n", ent.name, size);
+                    else if (size < 1024*1024)
+                        kprintf(" <FILE> %s (%u.%u KB)\n", ent.name, size/1024, (size%1024)/100);
+                    else
+                        kprintf(" <FILE> %s (%u.%u MB)\n", ent.name, size/(1024*1024), (size%(1024*1024))/100000);
                 }
-                /* Затем файлы */
-                for (int i = 0; i < n; i++) {
-                    if (!(entries[i].attr & 0x10)) {
-                        uint32_t size = entries[i].size;
-                        if (size < 1024)
-                            kprintf(" <FILE> %s (%u bytes)\n", entries[i].name, size);
-                        else if (size < 1024*1024)
-                            kprintf(" <FILE> %s (%u.%u KB)\n", entries[i].name, size/1024, (size%1024)/100);
-                        else
-                            kprintf(" <FILE> %s (%u.%u MB)\n", entries[i].name, size/(1024*1024), (size%(1024*1024))/100000);
-                    }
-                }
-                kfree(entries);
-                status = 0;
+                r = 0;
             }
+            fat32_closedir(&dir);
+            if (r < 0) kprintf("ls: dir read error\n");
+            status = r < 0;
         }
     }
     else if (strcmp(args[0], "cd") == 0) {
@@ -595,7 +625,7 @@ int sh_exec_single(const char *cmd) {
 
             hexstr_to_bytes(hex_data_str, buffer, 512);
 
-            if (ata_write_sector(drive_num, lba, buffer) == 0) {
+            if (block_write(block_get(drive_num), lba, 1, buffer) == 0) {
                 kprintf("Sector %u written successfully.\n", lba);
                 status = 0;
             } else {
@@ -624,12 +654,9 @@ int sh_exec_single(const char *cmd) {
             } else {
                 uint32_t sectors_to_read = (size_to_read + 511) / 512;
                 bool read_success = true;
-                for (uint32_t i = 0; i < sectors_to_read; ++i) {
-                    if (ata_read_sector(drive_num, start_lba + i, read_buffer + (i * 512)) != 0) {
-                        kprintf("error reading sector %u.\n", start_lba + i);
-                        read_success = false;
-                        break;
-                    }
+                if (block_read(block_get(drive_num), start_lba, sectors_to_read, read_buffer) != 0) {
+                    kprintf("error reading sectors %u..%u.\n", start_lba, start_lba + sectors_to_read - 1);
+                    read_success = false;
                 }
                 
                 if (read_success) {
@@ -651,7 +678,7 @@ int sh_exec_single(const char *cmd) {
         } else if (count == 2) {
             uint32_t lba = atoi(args[1]);
             uint8_t buffer[512];
-            if (ata_read_sector(drive_num, lba, buffer) == 0) {
+            if (block_read(block_get(drive_num), lba, 1, buffer) == 0) {
                 kprintf("sector %u (512 bytes):\n", lba);
                 for (int i = 0; i < 512; ++i) {
                     kprintf("%02X ", buffer[i]);
@@ -703,75 +730,53 @@ int sh_exec_single(const char *cmd) {
 
 // Функция для выполнения shell-скрипта
 int sh_execute_script(const char *filename) {
-    fat32_dir_entry_t *entries = kmalloc(sizeof(fat32_dir_entry_t)*128);
-    if (!entries) { 
-        kprintf("sh: OOM\n"); 
-        return 1;
-    }
-    
-    int n = fat32_read_dir(drive_num, current_dir_cluster, entries, 128);
-    if (n < 0) { 
-        kprintf("sh: dir error\n"); 
-        kfree(entries); 
-        return 1;
-    }
-    
-    char fatname[12]; fat_name_from_string(filename, fatname);
-    int file_found = 0;
+    fat32_entry_t ent;
+    int file_found = shell_find_file(filename, &ent) == 0;
     int status = 1;
     
-    for (int i = 0; i < n; i++) {
-        if (!(entries[i].attr & 0x10)) { // файл
-            if (!memcmp(entries[i].name, fatname, 11)) {
-                uint32_t size = entries[i].file_size;
-                uint32_t first_cluster = (entries[i].first_cluster_high << 16) | entries[i].first_cluster_low;
-                uint8_t *buf = kmalloc(size + 1); // +1 для null-terminator
-                if (!buf) { 
-                    kprintf("sh: OOM\n"); 
-                    kfree(entries); 
-                    return 1;
-                }
-                
-                int rd = fat32_read_file(drive_num, first_cluster, buf, size);
-                if (rd > 0) {
-                    buf[rd] = '\0'; // Добавляем null-terminator
+    if (file_found) {
+        uint32_t size = ent.size;
+        uint32_t first_cluster = ent.first_cluster;
+        uint8_t *buf = kmalloc(size + 1); // +1 для null-terminator
+        if (!buf) { 
+            kprintf("sh: OOM\n"); 
+            return 1;
+        }
+        
+        int rd = fat32_read_file(drive_num, first_cluster, buf, size);
+        if (rd > 0) {
+            buf[rd] = '\0'; // Добавляем null-terminator
+            
+            // Разбиваем файл на строки и выполняем каждую
+            char *line = strtok((char*)buf, "\n\r");
+            while (line != NULL) {
+                // Пропускаем пустые строки и комментарии
+                if (strlen(line) > 0 && line[0] != '#') {
+                    // Убираем пробелы в начале и конце
+                    while (*line == ' ' || *line == '\t') line++;
+                    char *end = line + strlen(line) - 1;
+                    while (end > line && (*end == ' ' || *end == '\t' || *end == '\r')) end--;
+                    *(end + 1) = '\0';
                     
-                    // Разбиваем файл на строки и выполняем каждую
-                    char *line = strtok((char*)buf, "\n\r");
-                    while (line != NULL) {
-                        // Пропускаем пустые строки и комментарии
-                        if (strlen(line) > 0 && line[0] != '#') {
-                            // Убираем пробелы в начале и конце
-                            while (*line == ' ' || *line == '\t') line++;
-                            char *end = line + strlen(line) - 1;
-                            while (end > line && (*end == ' ' || *end == '\t' || *end == '\r')) end--;
-                            *(end + 1) = '\0';
-                            
-                            if (strlen(line) > 0) {
-                                int cmd_status = sh_exec_single(line);
-                                if (cmd_status != 0) {
-                                    kprintf("sh: command failed: %s\n", line);
-                                }
-                            }
+                    if (strlen(line) > 0) {
+                        int cmd_status = sh_exec_single(line);
+                        if (cmd_status != 0) {
+                            kprintf("sh: command failed: %s\n", line);
                         }
-                        line = strtok(NULL, "\n\r");
                     }
-                    status = 0;
                 }
-                kfree(buf);
-                file_found = 1;
-                break;
+                line = strtok(NULL, "\n\r");
             }
+            status = 0;
         }
+        kfree(buf);
     }
     
-    kfree(entries);
-    
     if (!file_found) {
         kprintf("<(0C)>sh: %s: not found<(07)>\n", filename);
         status = 1;
     }
-    
+
     return status;
 }
 